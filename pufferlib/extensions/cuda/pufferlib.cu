@@ -31,9 +31,6 @@ void vtrace_check_cuda(torch::Tensor values, torch::Tensor rewards,
         TORCH_CHECK(t.size(0) == num_steps, "First dimension must match num_steps");
         TORCH_CHECK(t.size(1) == horizon, "Second dimension must match horizon");
         TORCH_CHECK(t.dtype() == torch::kFloat32, "All tensors must be float32");
-        if (!t.is_contiguous()) {
-            t.contiguous();
-        }
     }
 }
 
@@ -58,15 +55,23 @@ void compute_puff_advantage_cuda(torch::Tensor values, torch::Tensor rewards,
     vtrace_check_cuda(values, rewards, dones, importance, advantages, num_steps, horizon);
     TORCH_CHECK(values.is_cuda(), "All tensors must be on GPU");
 
+    // Strided inputs are materialized; strided advantages are computed into
+    // a copy and written back after the kernel
+    torch::Tensor values_c = values.contiguous();
+    torch::Tensor rewards_c = rewards.contiguous();
+    torch::Tensor dones_c = dones.contiguous();
+    torch::Tensor importance_c = importance.contiguous();
+    torch::Tensor advantages_c = advantages.contiguous();
+
     int threads_per_block = 256;
     int blocks = (num_steps + threads_per_block - 1) / threads_per_block;
 
     puff_advantage_kernel<<<blocks, threads_per_block>>>(
-        values.data_ptr<float>(),
-        rewards.data_ptr<float>(),
-        dones.data_ptr<float>(),
-        importance.data_ptr<float>(),
-        advantages.data_ptr<float>(),
+        values_c.data_ptr<float>(),
+        rewards_c.data_ptr<float>(),
+        dones_c.data_ptr<float>(),
+        importance_c.data_ptr<float>(),
+        advantages_c.data_ptr<float>(),
         gamma,
         lambda,
         rho_clip,
@@ -79,6 +84,9 @@ void compute_puff_advantage_cuda(torch::Tensor values, torch::Tensor rewards,
     if (err != cudaSuccess) {
         throw std::runtime_error(cudaGetErrorString(err));
     }
+    if (!advantages.is_contiguous()) {
+        advantages.copy_(advantages_c);
+    }
 }
 
 TORCH_LIBRARY_IMPL(pufferlib, CUDA, m) {
@@ -1,7 +1,9 @@
 #include <Python.h>
 #include <ATen/Operators.h>
+#include <ATen/Parallel.h>
 #include <torch/all.h>
 #include <torch/library.h>
+#include <algorithm>
 #include <vector>
 
 extern "C" {
@@ -44,7 +46,8 @@ void vtrace_check(torch::Tensor values, torch::Tensor rewards,
         torch::Tensor dones, torch::Tensor importance, torch::Tensor advantages,
         int num_steps, int horizon) {
 
-    // Validate input tensors
+    // Validate input tensors. Strides are handled by the caller, which
+    // materializes contiguous copies before taking raw pointers.
     torch::Device device = values.device();
     for (const torch::Tensor& t : {values, rewards, dones, importance, advantages}) {
         TORCH_CHECK(t.dim() == 2, "Tensor must be 2D");
@@ -52,18 +55,58 @@ void vtrace_check(torch::Tensor values, torch::Tensor rewards,
         TORCH_CHECK(t.size(0) == num_steps, "First dimension must match num_steps");
         TORCH_CHECK(t.size(1) == horizon, "Second dimension must match horizon");
         TORCH_CHECK(t.dtype() == torch::kFloat32, "All tensors must be float32");
-        if (!t.is_contiguous()) {
-            t.contiguous();
-        }
     }
 }
 
+// Rows advanced together by puff_advantage_block
+constexpr int ADVANTAGE_BLOCK = 8;
+
+// Same recurrence as puff_advantage_row over ADVANTAGE_BLOCK rows at once.
+// Each step of the recurrence depends on the last, so a single row is
+// latency bound; stepping a block of independent rows in lockstep keeps
+// one accumulator per row in registers and vectorizes across rows.
+// Clipping is a compare rather than fminf, which is a libm call without
+// -ffast-math and matches fminf for NaN importance.
+void puff_advantage_block(const float* __restrict values, const float* __restrict rewards,
+        const float* __restrict dones, const float* __restrict importance,
+        float* __restrict advantages, float gamma, float lambda,
+        float rho_clip, float c_clip, int horizon) {
+    float lastpufferlam[ADVANTAGE_BLOCK] = {0};
+    for (int t = horizon-2; t >= 0; t--) {
+        int t_next = t + 1;
+        for (int b = 0; b < ADVANTAGE_BLOCK; b++) {
+            int offset = b*horizon;
+            float nextnonterminal = 1.0 - dones[offset + t_next];
+            float ratio = importance[offset + t];
+            float rho_t = ratio < rho_clip ? ratio : rho_clip;
+            float c_t = ratio < c_clip ? ratio : c_clip;
+            float delta = rho_t*(rewards[offset + t_next]
+                + gamma*values[offset + t_next]*nextnonterminal - values[offset + t]);
+            lastpufferlam[b] = delta + gamma*lambda*c_t*lastpufferlam[b]*nextnonterminal;
+            advantages[offset + t] = lastpufferlam[b];
+        }
+    }
+}
 
 // [num_steps, horizon]
 void puff_advantage(float* values, float* rewards, float* dones, float* importance,
         float* advantages, float gamma, float lambda, float rho_clip, float c_clip,
         int num_steps, const int horizon){
-    for (int offset = 0; offset < num_steps*horizon; offset+=horizon) {
+    // Rows are independent, so blocks of rows are split across the ATen
+    // thread pool. Leftover rows past the last full block run one at a time.
+    int num_blocks = num_steps/ADVANTAGE_BLOCK;
+    int64_t grain = std::max<int64_t>(1, 2048/std::max(horizon, 1));
+    at::parallel_for(0, num_blocks, grain, [&](int64_t begin, int64_t end) {
+        for (int64_t block = begin; block < end; block++) {
+            int offset = block*ADVANTAGE_BLOCK*horizon;
+            puff_advantage_block(values + offset, rewards + offset,
+                dones + offset, importance + offset, advantages + offset,
+                gamma, lambda, rho_clip, c_clip, horizon
+            );
+        }
+    });
+    for (int row = num_blocks*ADVANTAGE_BLOCK; row < num_steps; row++) {
+        int offset = row*horizon;
         puff_advantage_row(values + offset, rewards + offset,
             dones + offset, importance + offset, advantages + offset,
             gamma, lambda, rho_clip, c_clip, horizon
@@ -78,10 +121,21 @@ void compute_puff_advantage_cpu(torch::Tensor values, torch::Tensor rewards,
     int num_steps = values.size(0);
     int horizon = values.size(1);
     vtrace_check(values, rewards, dones, importance, advantages, num_steps, horizon);
-    puff_advantage(values.data_ptr<float>(), rewards.data_ptr<float>(),
-        dones.data_ptr<float>(), importance.data_ptr<float>(), advantages.data_ptr<float>(),
+
+    // contiguous() returns a copy for strided inputs, so results for a
+    // strided advantages tensor are written to a copy and then copied back
+    torch::Tensor values_c = values.contiguous();
+    torch::Tensor rewards_c = rewards.contiguous();
+    torch::Tensor dones_c = dones.contiguous();
+    torch::Tensor importance_c = importance.contiguous();
+    torch::Tensor advantages_c = advantages.contiguous();
+    puff_advantage(values_c.data_ptr<float>(), rewards_c.data_ptr<float>(),
+        dones_c.data_ptr<float>(), importance_c.data_ptr<float>(), advantages_c.data_ptr<float>(),
         gamma, lambda, rho_clip, c_clip, num_steps, horizon
     );
+    if (!advantages.is_contiguous()) {
+        advantages.copy_(advantages_c);
+    }
 }
 
 TORCH_LIBRARY(pufferlib, m) {
@@ -1,8 +1,20 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <math.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define PUF_X86 1
+#include <immintrin.h>
+#else
+#define PUF_X86 0
+#endif
 
 typedef struct {
     void* data;
@@ -28,14 +40,43 @@ void* alloc(Arena* allocator, size_t size) {
     return ptr;
 }
 
-// File format is obained by flattening and concatenating all pytorch layers
+// File format is obained by flattening and concatenating all pytorch layers.
+// Files from export() prepend a manifest: "PUFW", a version, the tensor count
+// and the byte offset of the data, then for each tensor its name, shape and
+// offset in floats (see export in pufferl.py). Those are mmapped read-only,
+// so eval workers share one copy, and every get_weights is checked against
+// the manifest. Files without the header are read positionally as before.
+#define PUF_WEIGHTS_MAGIC "PUFW"
+#define PUF_WEIGHTS_VERSION 1
+#define PUF_MAX_DIMS 8
+
+typedef struct WeightTensor WeightTensor;
+struct WeightTensor {
+    char name[128];
+    int shape[PUF_MAX_DIMS];
+    int ndim;
+    size_t offset;
+    size_t numel;
+};
+
 typedef struct Weights Weights;
 struct Weights {
     float* data;
     int size;
     int idx;
+    int quantized;
+    WeightTensor* tensors;
+    int num_tensors;
+    int tensor_idx;
+    void* map;
+    size_t map_size;
 };
 
+static void puf_weights_fail(const char* what, const char* detail) {
+    fprintf(stderr, "Error loading weights: %s%s\n", what, detail);
+    exit(1);
+}
+
 void _load_weights(const char* filename, float* weights, size_t num_weights) {
     FILE* file = fopen(filename, "rb");
     if (!file) {
@@ -50,8 +91,112 @@ void _load_weights(const char* filename, float* weights, size_t num_weights) {
     }
 }
 
+// Bounds-checked reader over the mmapped header
+typedef struct {
+    const char* data;
+    size_t size;
+    size_t pos;
+} PufReader;
+
+static const void* puf_read(PufReader* reader, size_t bytes) {
+    if (reader->pos + bytes > reader->size) {
+        puf_weights_fail("truncated manifest", "");
+    }
+    const void* ptr = reader->data + reader->pos;
+    reader->pos += bytes;
+    return ptr;
+}
+
+static uint32_t puf_read_u32(PufReader* reader) {
+    uint32_t value;
+    memcpy(&value, puf_read(reader, sizeof(value)), sizeof(value));
+    return value;
+}
+
+static uint64_t puf_read_u64(PufReader* reader) {
+    uint64_t value;
+    memcpy(&value, puf_read(reader, sizeof(value)), sizeof(value));
+    return value;
+}
+
+// Returns NULL if the file has no manifest
+static Weights* puf_map_weights(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    char magic[4];
+    size_t map_size = lseek(fd, 0, SEEK_END);
+    if (map_size < 16 || pread(fd, magic, 4, 0) != 4 || memcmp(magic, PUF_WEIGHTS_MAGIC, 4) != 0) {
+        close(fd);
+        return NULL;
+    }
+    void* map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        puf_weights_fail("mmap failed for ", filename);
+    }
+
+    PufReader reader = {.data = map, .size = map_size, .pos = 4};
+    uint32_t version = puf_read_u32(&reader);
+    if (version != PUF_WEIGHTS_VERSION) {
+        puf_weights_fail("unsupported manifest version in ", filename);
+    }
+    int num_tensors = puf_read_u32(&reader);
+    size_t data_offset = puf_read_u32(&reader);
+    if (data_offset % sizeof(float) != 0 || data_offset > map_size) {
+        puf_weights_fail("bad data offset in ", filename);
+    }
+
+    Weights* weights = calloc(1, sizeof(Weights) + num_tensors*sizeof(WeightTensor));
+    weights->tensors = (WeightTensor*)(weights + 1);
+    weights->num_tensors = num_tensors;
+    weights->data = (float*)((char*)map + data_offset);
+    weights->size = (map_size - data_offset)/sizeof(float);
+    weights->map = map;
+    weights->map_size = map_size;
+    for (int i = 0; i < num_tensors; i++) {
+        WeightTensor* tensor = &weights->tensors[i];
+        uint32_t name_len = puf_read_u32(&reader);
+        if (name_len >= sizeof(tensor->name)) {
+            puf_weights_fail("tensor name too long in ", filename);
+        }
+        memcpy(tensor->name, puf_read(&reader, name_len), name_len);
+        tensor->ndim = puf_read_u32(&reader);
+        if (tensor->ndim > PUF_MAX_DIMS) {
+            puf_weights_fail("too many dimensions for ", tensor->name);
+        }
+        tensor->numel = 1;
+        for (int d = 0; d < tensor->ndim; d++) {
+            tensor->shape[d] = puf_read_u32(&reader);
+            tensor->numel *= tensor->shape[d];
+        }
+        tensor->offset = puf_read_u64(&reader);
+        if (tensor->offset + tensor->numel > (size_t)weights->size) {
+            puf_weights_fail("data out of bounds for ", tensor->name);
+        }
+    }
+    return weights;
+}
+
+// num_weights is the total the caller's network expects. A manifest that
+// disagrees is an error; for legacy files it is the number of floats read.
 Weights* load_weights(const char* filename, size_t num_weights) {
-    Weights* weights = calloc(1, sizeof(Weights) + num_weights*sizeof(float));
+    Weights* weights = puf_map_weights(filename);
+    if (weights != NULL) {
+        size_t total = 0;
+        for (int i = 0; i < weights->num_tensors; i++) {
+            total += weights->tensors[i].numel;
+        }
+        if (total != num_weights) {
+            char detail[256];
+            snprintf(detail, sizeof(detail), "%s holds %zu weights, network expects %zu",
+                filename, total, num_weights);
+            puf_weights_fail("size mismatch: ", detail);
+        }
+        return weights;
+    }
+    weights = calloc(1, sizeof(Weights) + num_weights*sizeof(float));
     weights->data = (float*)(weights + 1);
     _load_weights(filename, weights->data, num_weights);
     weights->size = num_weights;
@@ -59,13 +204,125 @@ Weights* load_weights(const char* filename, size_t num_weights) {
     return weights;
 }
 
+void free_weights(Weights* weights) {
+    if (weights->map != NULL) {
+        munmap(weights->map, weights->map_size);
+    }
+    free(weights);
+}
+
+// Moves the cursor to a named tensor. Names match exactly or as a suffix
+// after a '.', so "actor.weight" finds "policy.actor.weight". No-op for
+// legacy files, which have no names.
+void seek_weights(Weights* weights, const char* name) {
+    if (weights->tensors == NULL) {
+        return;
+    }
+    size_t name_len = strlen(name);
+    int found = -1;
+    for (int i = 0; i < weights->num_tensors; i++) {
+        const char* tensor_name = weights->tensors[i].name;
+        size_t len = strlen(tensor_name);
+        bool exact = strcmp(tensor_name, name) == 0;
+        bool suffix = len > name_len && tensor_name[len - name_len - 1] == '.'
+            && strcmp(tensor_name + len - name_len, name) == 0;
+        if (exact) {
+            found = i;
+            break;
+        }
+        if (suffix) {
+            if (found >= 0) {
+                puf_weights_fail("ambiguous tensor name ", name);
+            }
+            found = i;
+        }
+    }
+    if (found < 0) {
+        puf_weights_fail("missing tensor ", name);
+    }
+    weights->tensor_idx = found;
+    weights->idx = weights->tensors[found].offset;
+}
+
 float* get_weights(Weights* weights, int num_weights) {
+    if (weights->tensors != NULL) {
+        // Every read must be exactly the next tensor in the manifest
+        if (weights->tensor_idx >= weights->num_tensors) {
+            puf_weights_fail("read past the last tensor", "");
+        }
+        WeightTensor* tensor = &weights->tensors[weights->tensor_idx];
+        if (tensor->offset != (size_t)weights->idx || tensor->numel != (size_t)num_weights) {
+            char detail[256];
+            snprintf(detail, sizeof(detail), "%s has %zu values, layer expects %d",
+                tensor->name, tensor->numel, num_weights);
+            puf_weights_fail("layout mismatch: ", detail);
+        }
+        weights->tensor_idx++;
+    }
     float* data = &weights->data[weights->idx];
     weights->idx += num_weights;
     assert(weights->idx <= weights->size);
     return data;
 }
 
+// Int8 checkpoints (see quantize in pufferl.py) have no manifest. They hold
+// every parameter in named_parameters() order, read positionally, with Linear
+// and LSTM weight matrices stored as fp32 per-row scales followed by int8
+// values padded to 4 bytes. Layers made from them run the int8 kernels;
+// everything else reads the dequantized fp32 copy.
+#define PUF_QK 32
+
+int _int8_stride(int input_dim) {
+    return (input_dim + PUF_QK - 1)/PUF_QK*PUF_QK;
+}
+
+Weights* load_weights_int8(const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        perror("Error opening file");
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    size_t num_weights = ftell(file)/sizeof(float);
+    rewind(file);
+    Weights* weights = calloc(1, sizeof(Weights) + num_weights*sizeof(float));
+    weights->data = (float*)(weights + 1);
+    size_t read_size = fread(weights->data, sizeof(float), num_weights, file);
+    fclose(file);
+    if (read_size != num_weights) {
+        perror("Error reading file");
+    }
+    weights->size = num_weights;
+    weights->idx = 0;
+    weights->quantized = 1;
+    return weights;
+}
+
+// Bytes needed by get_weights_int8 for a [rows, cols] matrix
+size_t _int8_matrix_size(int rows, int cols) {
+    return (size_t)rows*cols*sizeof(float) + (size_t)rows*_int8_stride(cols);
+}
+
+// Reads a [rows, cols] int8 matrix into buffer. Returns the dequantized
+// weights and sets the row-padded int8 weights and their per-row scales.
+float* get_weights_int8(Weights* weights, void* buffer, int rows, int cols,
+        int8_t** qweights, float** scales) {
+    *scales = get_weights(weights, rows);
+    int8_t* src = (int8_t*)get_weights(weights, (rows*cols + 3)/4);
+    int stride = _int8_stride(cols);
+    float* dequant = buffer;
+    int8_t* dst = (int8_t*)(dequant + (size_t)rows*cols);
+    memset(dst, 0, (size_t)rows*stride);
+    for (int r = 0; r < rows; r++) {
+        memcpy(dst + (size_t)r*stride, src + (size_t)r*cols, cols);
+        for (int c = 0; c < cols; c++) {
+            dequant[r*cols + c] = (*scales)[r]*src[r*cols + c];
+        }
+    }
+    *qweights = dst;
+    return dequant;
+}
+
 // PufferNet implementation of PyTorch functions
 // These are tested against the PyTorch implementation
 void _relu(float* input, float* output, int size) {
@@ -85,28 +342,352 @@ inline float _sigmoid(float x) {
     return 1.0f / (1.0f + expf(-x));
 }
 
+// Blocked GEMM behind _linear and _linear_accumulate:
+// output[m, n] (+)= input[m, k] * weights[n, k]^T + bias[n]
+// Weights are packed PUF_KC x PUF_NC at a time into PUF_NR wide column
+// panels, so the micro-kernel streams them contiguously while reusing
+// PUF_MR input rows. On x86 an AVX2/FMA micro-kernel is picked at runtime.
+#define PUF_MR 4
+#define PUF_NR 16
+#define PUF_KC 256
+#define PUF_NC 64
+
+// Micro-kernels add an MR x NR tile into the PUF_NR floats at each out[r]
+typedef void (*puf_kernel_fn)(const float** rows, int k0, const float* packed,
+        int kc, float** out);
+
+static void puf_kernel_generic(const float** rows, int k0, const float* packed,
+        int kc, float** out) {
+    // Local tile so the accumulators are not aliased with the inputs
+    float c[PUF_MR][PUF_NR] = {{0}};
+    for (int p = 0; p < kc; p++) {
+        const float* b = packed + p*PUF_NR;
+        for (int r = 0; r < PUF_MR; r++) {
+            float a = rows[r][k0 + p];
+            for (int j = 0; j < PUF_NR; j++) {
+                c[r][j] += a*b[j];
+            }
+        }
+    }
+    for (int r = 0; r < PUF_MR; r++) {
+        for (int j = 0; j < PUF_NR; j++) {
+            out[r][j] += c[r][j];
+        }
+    }
+}
+
+#if PUF_X86
+__attribute__((target("avx2,fma")))
+static void puf_kernel_avx2(const float** rows, int k0, const float* packed,
+        int kc, float** out) {
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    const float* a0 = rows[0] + k0;
+    const float* a1 = rows[1] + k0;
+    const float* a2 = rows[2] + k0;
+    const float* a3 = rows[3] + k0;
+    for (int p = 0; p < kc; p++) {
+        __m256 b0 = _mm256_loadu_ps(packed + p*PUF_NR);
+        __m256 b1 = _mm256_loadu_ps(packed + p*PUF_NR + 8);
+        __m256 a = _mm256_broadcast_ss(a0 + p);
+        c00 = _mm256_fmadd_ps(a, b0, c00);
+        c01 = _mm256_fmadd_ps(a, b1, c01);
+        a = _mm256_broadcast_ss(a1 + p);
+        c10 = _mm256_fmadd_ps(a, b0, c10);
+        c11 = _mm256_fmadd_ps(a, b1, c11);
+        a = _mm256_broadcast_ss(a2 + p);
+        c20 = _mm256_fmadd_ps(a, b0, c20);
+        c21 = _mm256_fmadd_ps(a, b1, c21);
+        a = _mm256_broadcast_ss(a3 + p);
+        c30 = _mm256_fmadd_ps(a, b0, c30);
+        c31 = _mm256_fmadd_ps(a, b1, c31);
+    }
+    _mm256_storeu_ps(out[0], _mm256_add_ps(_mm256_loadu_ps(out[0]), c00));
+    _mm256_storeu_ps(out[0] + 8, _mm256_add_ps(_mm256_loadu_ps(out[0] + 8), c01));
+    _mm256_storeu_ps(out[1], _mm256_add_ps(_mm256_loadu_ps(out[1]), c10));
+    _mm256_storeu_ps(out[1] + 8, _mm256_add_ps(_mm256_loadu_ps(out[1] + 8), c11));
+    _mm256_storeu_ps(out[2], _mm256_add_ps(_mm256_loadu_ps(out[2]), c20));
+    _mm256_storeu_ps(out[2] + 8, _mm256_add_ps(_mm256_loadu_ps(out[2] + 8), c21));
+    _mm256_storeu_ps(out[3], _mm256_add_ps(_mm256_loadu_ps(out[3]), c30));
+    _mm256_storeu_ps(out[3] + 8, _mm256_add_ps(_mm256_loadu_ps(out[3] + 8), c31));
+}
+#endif
+
+static puf_kernel_fn puf_gemm_kernel(void) {
+    static puf_kernel_fn kernel = NULL;
+    if (kernel == NULL) {
+        kernel = puf_kernel_generic;
+#if PUF_X86
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            kernel = puf_kernel_avx2;
+        }
+#endif
+    }
+    return kernel;
+}
+
+// Packs weights[n0:n0+nc, k0:k0+kc] as [panel][k][PUF_NR], zero padding past n
+static void puf_pack_weights(const float* weights, float* packed, int input_dim,
+        int output_dim, int n0, int nc, int k0, int kc) {
+    for (int panel = 0; panel < nc; panel += PUF_NR) {
+        float* dst = packed + panel*kc;
+        for (int j = 0; j < PUF_NR; j++) {
+            int o = n0 + panel + j;
+            if (panel + j >= nc || o >= output_dim) {
+                for (int p = 0; p < kc; p++) dst[p*PUF_NR + j] = 0.0f;
+                continue;
+            }
+            const float* src = weights + (size_t)o*input_dim + k0;
+            for (int p = 0; p < kc; p++) dst[p*PUF_NR + j] = src[p];
+        }
+    }
+}
+
+// Multiplies every input row by one packed [kc, nc] block of the weights
+static void puf_gemm_block(float* input, const float* packed, float* output,
+        int batch_size, int input_dim, int output_dim, int n0, int nc, int k0, int kc) {
+    float scratch[PUF_MR][PUF_NR];
+    const float* rows[PUF_MR];
+    float* out[PUF_MR];
+    puf_kernel_fn kernel = puf_gemm_kernel();
+    for (int m0 = 0; m0 < batch_size; m0 += PUF_MR) {
+        int mr = batch_size - m0 < PUF_MR ? batch_size - m0 : PUF_MR;
+        // Short tiles repeat their last row; the extra results are dropped
+        for (int r = 0; r < PUF_MR; r++) {
+            int row = r < mr ? m0 + r : m0 + mr - 1;
+            rows[r] = input + (size_t)row*input_dim;
+        }
+        for (int panel = 0; panel < nc; panel += PUF_NR) {
+            int nr = nc - panel < PUF_NR ? nc - panel : PUF_NR;
+            if (mr == PUF_MR && nr == PUF_NR) {
+                for (int r = 0; r < PUF_MR; r++) {
+                    out[r] = output + (size_t)(m0 + r)*output_dim + n0 + panel;
+                }
+                kernel(rows, k0, packed + panel*kc, kc, out);
+                continue;
+            }
+            // Edge tiles go through scratch and only the valid part is kept
+            memset(scratch, 0, sizeof(scratch));
+            for (int r = 0; r < PUF_MR; r++) out[r] = scratch[r];
+            kernel(rows, k0, packed + panel*kc, kc, out);
+            for (int r = 0; r < mr; r++) {
+                float* dst = output + (size_t)(m0 + r)*output_dim + n0 + panel;
+                for (int j = 0; j < nr; j++) dst[j] += scratch[r][j];
+            }
+        }
+    }
+}
+
+void _gemm_nt(float* input, float* weights, float* output,
+        int batch_size, int input_dim, int output_dim) {
+    float packed[PUF_KC*PUF_NC] __attribute__((aligned(32)));
+    for (int n0 = 0; n0 < output_dim; n0 += PUF_NC) {
+        int nc = output_dim - n0 < PUF_NC ? output_dim - n0 : PUF_NC;
+        for (int k0 = 0; k0 < input_dim; k0 += PUF_KC) {
+            int kc = input_dim - k0 < PUF_KC ? input_dim - k0 : PUF_KC;
+            puf_pack_weights(weights, packed, input_dim, output_dim, n0, nc, k0, kc);
+            puf_gemm_block(input, packed, output, batch_size, input_dim, output_dim, n0, nc, k0, kc);
+        }
+    }
+}
+
+// Pre-packed weights, for layers applied many times per forward pass.
+// Blocks are stored in the order _gemm_nt would pack them.
+size_t _packed_weights_size(int input_dim, int output_dim) {
+    return (size_t)((output_dim + PUF_NR - 1)/PUF_NR*PUF_NR)*input_dim;
+}
+
+void _pack_weights(float* weights, float* packed, int input_dim, int output_dim) {
+    size_t offset = 0;
+    for (int n0 = 0; n0 < output_dim; n0 += PUF_NC) {
+        int nc = output_dim - n0 < PUF_NC ? output_dim - n0 : PUF_NC;
+        int nc_padded = (nc + PUF_NR - 1)/PUF_NR*PUF_NR;
+        for (int k0 = 0; k0 < input_dim; k0 += PUF_KC) {
+            int kc = input_dim - k0 < PUF_KC ? input_dim - k0 : PUF_KC;
+            puf_pack_weights(weights, packed + offset, input_dim, output_dim, n0, nc, k0, kc);
+            offset += (size_t)nc_padded*kc;
+        }
+    }
+}
+
+void _gemm_nt_packed(float* input, float* packed, float* output,
+        int batch_size, int input_dim, int output_dim) {
+    size_t offset = 0;
+    for (int n0 = 0; n0 < output_dim; n0 += PUF_NC) {
+        int nc = output_dim - n0 < PUF_NC ? output_dim - n0 : PUF_NC;
+        int nc_padded = (nc + PUF_NR - 1)/PUF_NR*PUF_NR;
+        for (int k0 = 0; k0 < input_dim; k0 += PUF_KC) {
+            int kc = input_dim - k0 < PUF_KC ? input_dim - k0 : PUF_KC;
+            puf_gemm_block(input, packed + offset, output, batch_size, input_dim, output_dim, n0, nc, k0, kc);
+            offset += (size_t)nc_padded*kc;
+        }
+    }
+}
+
 void _linear(float* input, float* weights, float* bias, float* output,
         int batch_size, int input_dim, int output_dim) {
     for (int b = 0; b < batch_size; b++) {
-        for (int o = 0; o < output_dim; o++) {
-            float sum = 0.0f;
-            for (int i = 0; i < input_dim; i++)
-                sum += input[b*input_dim + i] * weights[o*input_dim + i];
-            output[b*output_dim + o] = sum + bias[o];
-        }
+        memcpy(&output[b*output_dim], bias, output_dim*sizeof(float));
     }
+    _gemm_nt(input, weights, output, batch_size, input_dim, output_dim);
 }
 
 void _linear_accumulate(float* input, float* weights, float* bias, float* output,
         int batch_size, int input_dim, int output_dim) {
     for (int b = 0; b < batch_size; b++) {
         for (int o = 0; o < output_dim; o++) {
-            float sum = 0.0f;
-            for (int i = 0; i < input_dim; i++)
-                sum += input[b*input_dim + i] * weights[o*input_dim + i];
-            output[b*output_dim + o] += sum + bias[o];
+            output[b*output_dim + o] += bias[o];
+        }
+    }
+    _gemm_nt(input, weights, output, batch_size, input_dim, output_dim);
+}
+
+// Int8 _linear: weights are quantized per output row and each input row is
+// quantized on the fly with its own scale, so every output is one int32 dot
+// product rescaled by both. The x86 kernels feed |x| as u8 and sign(x)*w as
+// s8 to maddubs (AVX2) or dpbusd (AVX-VNNI), which cannot saturate since
+// both sides are clamped to [-127, 127].
+typedef void (*puf_qdot_fn)(const int8_t* x, const int8_t* weights,
+        int stride, int rows, int32_t* out);
+
+static void puf_qdot_generic(const int8_t* x, const int8_t* weights,
+        int stride, int rows, int32_t* out) {
+    for (int r = 0; r < rows; r++) {
+        const int8_t* w = weights + (size_t)r*stride;
+        int32_t sum = 0;
+        for (int k = 0; k < stride; k++) {
+            sum += x[k]*w[k];
+        }
+        out[r] = sum;
+    }
+}
+
+#if PUF_X86
+__attribute__((target("avx2")))
+static inline int32_t puf_hsum_epi32(__m256i v) {
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+    return _mm_cvtsi128_si32(s);
+}
+
+// Four weight rows share each activation load. MADD(acc, xu, ws) adds the
+// u8 x s8 products of xu and ws into the int32 lanes of acc.
+#define PUF_QDOT_X86(name, isa, MADD) \
+__attribute__((target(isa))) \
+static void name(const int8_t* x, const int8_t* weights, \
+        int stride, int rows, int32_t* out) { \
+    int r = 0; \
+    for (; r + 4 <= rows; r += 4) { \
+        const int8_t* w = weights + (size_t)r*stride; \
+        __m256i acc0 = _mm256_setzero_si256(); \
+        __m256i acc1 = _mm256_setzero_si256(); \
+        __m256i acc2 = _mm256_setzero_si256(); \
+        __m256i acc3 = _mm256_setzero_si256(); \
+        for (int k = 0; k < stride; k += PUF_QK) { \
+            __m256i xv = _mm256_loadu_si256((const __m256i*)(x + k)); \
+            __m256i xu = _mm256_sign_epi8(xv, xv); \
+            acc0 = MADD(acc0, xu, _mm256_sign_epi8(_mm256_loadu_si256((const __m256i*)(w + k)), xv)); \
+            acc1 = MADD(acc1, xu, _mm256_sign_epi8(_mm256_loadu_si256((const __m256i*)(w + stride + k)), xv)); \
+            acc2 = MADD(acc2, xu, _mm256_sign_epi8(_mm256_loadu_si256((const __m256i*)(w + 2*stride + k)), xv)); \
+            acc3 = MADD(acc3, xu, _mm256_sign_epi8(_mm256_loadu_si256((const __m256i*)(w + 3*stride + k)), xv)); \
+        } \
+        out[r] = puf_hsum_epi32(acc0); \
+        out[r + 1] = puf_hsum_epi32(acc1); \
+        out[r + 2] = puf_hsum_epi32(acc2); \
+        out[r + 3] = puf_hsum_epi32(acc3); \
+    } \
+    for (; r < rows; r++) { \
+        const int8_t* w = weights + (size_t)r*stride; \
+        __m256i acc = _mm256_setzero_si256(); \
+        for (int k = 0; k < stride; k += PUF_QK) { \
+            __m256i xv = _mm256_loadu_si256((const __m256i*)(x + k)); \
+            acc = MADD(acc, _mm256_sign_epi8(xv, xv), \
+                _mm256_sign_epi8(_mm256_loadu_si256((const __m256i*)(w + k)), xv)); \
+        } \
+        out[r] = puf_hsum_epi32(acc); \
+    } \
+}
+
+#define PUF_MADD_AVX2(acc, xu, ws) _mm256_add_epi32((acc), \
+    _mm256_madd_epi16(_mm256_maddubs_epi16((xu), (ws)), _mm256_set1_epi16(1)))
+#define PUF_MADD_VNNI(acc, xu, ws) _mm256_dpbusd_avx_epi32((acc), (xu), (ws))
+
+PUF_QDOT_X86(puf_qdot_avx2, "avx2", PUF_MADD_AVX2)
+
+// AVX-VNNI needs GCC 11 or Clang 12
+#if (defined(__clang__) && __clang_major__ >= 12) || (!defined(__clang__) && __GNUC__ >= 11)
+#define PUF_AVXVNNI 1
+PUF_QDOT_X86(puf_qdot_vnni, "avx2,avxvnni", PUF_MADD_VNNI)
+#endif
+#endif
+
+static puf_qdot_fn puf_qdot_kernel(void) {
+    static puf_qdot_fn kernel = NULL;
+    if (kernel == NULL) {
+        kernel = puf_qdot_generic;
+#if PUF_X86
+        if (__builtin_cpu_supports("avx2")) {
+            kernel = puf_qdot_avx2;
+        }
+#ifdef PUF_AVXVNNI
+        if (__builtin_cpu_supports("avxvnni")) {
+            kernel = puf_qdot_vnni;
         }
+#endif
+#endif
     }
+    return kernel;
+}
+
+// Quantizes one activation row into x, zero padded to stride. Returns its scale.
+static float puf_quantize_row(const float* input, int8_t* x, int input_dim, int stride) {
+    float amax = 0.0f;
+    for (int k = 0; k < input_dim; k++) {
+        float v = fabsf(input[k]);
+        if (v > amax) amax = v;
+    }
+    memset(x, 0, stride);
+    if (amax == 0.0f) {
+        return 0.0f;
+    }
+    float inv_scale = 127.0f/amax;
+    for (int k = 0; k < input_dim; k++) {
+        float v = input[k]*inv_scale;
+        x[k] = (int8_t)(v >= 0.0f ? v + 0.5f : v - 0.5f);
+    }
+    return amax/127.0f;
+}
+
+static void puf_linear_int8(float* input, int8_t* weights, float* scales, float* bias,
+        float* output, int batch_size, int input_dim, int output_dim, bool accumulate) {
+    int stride = _int8_stride(input_dim);
+    int8_t x[stride];
+    int32_t dots[output_dim];
+    puf_qdot_fn qdot = puf_qdot_kernel();
+    for (int b = 0; b < batch_size; b++) {
+        float* out = output + (size_t)b*output_dim;
+        float x_scale = puf_quantize_row(input + (size_t)b*input_dim, x, input_dim, stride);
+        qdot(x, weights, stride, output_dim, dots);
+        for (int o = 0; o < output_dim; o++) {
+            float value = bias[o] + x_scale*scales[o]*dots[o];
+            out[o] = accumulate ? out[o] + value : value;
+        }
+    }
+}
+
+void _linear_int8(float* input, int8_t* weights, float* scales, float* bias,
+        float* output, int batch_size, int input_dim, int output_dim) {
+    puf_linear_int8(input, weights, scales, bias, output,
+        batch_size, input_dim, output_dim, false);
+}
+
+void _linear_int8_accumulate(float* input, int8_t* weights, float* scales, float* bias,
+        float* output, int batch_size, int input_dim, int output_dim) {
+    puf_linear_int8(input, weights, scales, bias, output,
+        batch_size, input_dim, output_dim, true);
 }
 
 void _conv2d(float* input, float* weights, float* bias,
@@ -199,43 +780,199 @@ void _conv3d(float* input, float* weights, float* bias,
     }
 }
 
+// Fused LSTM cell: a single pass over the [batch, 4*hidden] gate buffer
+// applies the nonlinearities and updates c and h. They use a Cephes style
+// polynomial expf (~1e-7 relative error), vectorized with AVX2 on x86.
+static inline float puf_fast_expf(float x) {
+    x = x < -87.3f ? -87.3f : x;
+    x = x > 88.3f ? 88.3f : x;
+    float t = x*1.44269504f;
+    int n = (int)(t >= 0.0f ? t + 0.5f : t - 0.5f);
+    float r = x - n*0.693359375f + n*2.12194440e-4f;
+    float p = 1.9875691500e-4f;
+    p = p*r + 1.3981999507e-3f;
+    p = p*r + 8.3334519073e-3f;
+    p = p*r + 4.1665795894e-2f;
+    p = p*r + 1.6666665459e-1f;
+    p = p*r + 5.0000001201e-1f;
+    union { int32_t i; float f; } scale = { .i = (n + 127) << 23 };
+    return (p*r*r + r + 1.0f)*scale.f;
+}
+
+static inline float puf_fast_sigmoid(float x) {
+    return 1.0f/(1.0f + puf_fast_expf(-x));
+}
+
+static inline float puf_fast_tanh(float x) {
+    return 2.0f/(1.0f + puf_fast_expf(-2.0f*x)) - 1.0f;
+}
+
+// Gates are ordered input, forget, cell, output as in PyTorch
+static inline void puf_lstm_unit(const float* gates, float* state_h, float* state_c,
+        int hidden_size, int i) {
+    float input_gate = puf_fast_sigmoid(gates[i]);
+    float forget_gate = puf_fast_sigmoid(gates[hidden_size + i]);
+    float cell_gate = puf_fast_tanh(gates[2*hidden_size + i]);
+    float output_gate = puf_fast_sigmoid(gates[3*hidden_size + i]);
+    state_c[i] = forget_gate*state_c[i] + input_gate*cell_gate;
+    state_h[i] = output_gate*puf_fast_tanh(state_c[i]);
+}
+
+typedef void (*puf_lstm_cell_fn)(float* state_h, float* state_c, float* gates,
+        int batch_size, int hidden_size);
+
+static void puf_lstm_cell_generic(float* state_h, float* state_c, float* gates,
+        int batch_size, int hidden_size) {
+    for (int b = 0; b < batch_size; b++) {
+        float* g = gates + (size_t)4*b*hidden_size;
+        float* h = state_h + (size_t)b*hidden_size;
+        float* c = state_c + (size_t)b*hidden_size;
+        for (int i = 0; i < hidden_size; i++) {
+            puf_lstm_unit(g, h, c, hidden_size, i);
+        }
+    }
+}
+
+#if PUF_X86
+__attribute__((target("avx2,fma")))
+static inline __m256 puf_exp_avx2(__m256 x) {
+    x = _mm256_max_ps(x, _mm256_set1_ps(-87.3f));
+    x = _mm256_min_ps(x, _mm256_set1_ps(88.3f));
+    __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504f)),
+        _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+    __m256 p = _mm256_set1_ps(1.9875691500e-4f);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+    __m256 y = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+    __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(y, _mm256_castsi256_ps(e));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 puf_sigmoid_avx2(__m256 x) {
+    __m256 one = _mm256_set1_ps(1.0f);
+    return _mm256_div_ps(one, _mm256_add_ps(one, puf_exp_avx2(_mm256_sub_ps(_mm256_setzero_ps(), x))));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 puf_tanh_avx2(__m256 x) {
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 e = puf_exp_avx2(_mm256_mul_ps(x, _mm256_set1_ps(-2.0f)));
+    return _mm256_sub_ps(_mm256_div_ps(_mm256_set1_ps(2.0f), _mm256_add_ps(one, e)), one);
+}
+
+__attribute__((target("avx2,fma")))
+static void puf_lstm_cell_avx2(float* state_h, float* state_c, float* gates,
+        int batch_size, int hidden_size) {
+    for (int b = 0; b < batch_size; b++) {
+        float* g = gates + (size_t)4*b*hidden_size;
+        float* h = state_h + (size_t)b*hidden_size;
+        float* c = state_c + (size_t)b*hidden_size;
+        int i = 0;
+        for (; i + 8 <= hidden_size; i += 8) {
+            __m256 input_gate = puf_sigmoid_avx2(_mm256_loadu_ps(g + i));
+            __m256 forget_gate = puf_sigmoid_avx2(_mm256_loadu_ps(g + hidden_size + i));
+            __m256 cell_gate = puf_tanh_avx2(_mm256_loadu_ps(g + 2*hidden_size + i));
+            __m256 output_gate = puf_sigmoid_avx2(_mm256_loadu_ps(g + 3*hidden_size + i));
+            __m256 cell = _mm256_fmadd_ps(forget_gate, _mm256_loadu_ps(c + i),
+                _mm256_mul_ps(input_gate, cell_gate));
+            _mm256_storeu_ps(c + i, cell);
+            _mm256_storeu_ps(h + i, _mm256_mul_ps(output_gate, puf_tanh_avx2(cell)));
+        }
+        for (; i < hidden_size; i++) {
+            puf_lstm_unit(g, h, c, hidden_size, i);
+        }
+    }
+}
+#endif
+
+static void puf_lstm_cell(float* state_h, float* state_c, float* gates,
+        int batch_size, int hidden_size) {
+    static puf_lstm_cell_fn cell = NULL;
+    if (cell == NULL) {
+        cell = puf_lstm_cell_generic;
+#if PUF_X86
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            cell = puf_lstm_cell_avx2;
+        }
+#endif
+    }
+    cell(state_h, state_c, gates, batch_size, hidden_size);
+}
+
+// Bias of both projections, shared by the LSTM steps below
+static void puf_lstm_bias(float* buffer, float* bias_input, float* bias_state,
+        int rows, int gate_size) {
+    for (int r = 0; r < rows; r++) {
+        float* gates = buffer + (size_t)r*gate_size;
+        for (int o = 0; o < gate_size; o++) {
+            gates[o] = bias_input[o] + bias_state[o];
+        }
+    }
+}
+
+// One step. Packs weights block by block on the stack, so nothing is allocated.
 void _lstm(float* input, float* state_h, float* state_c, float* weights_input,
         float* weights_state, float* bias_input, float*bias_state,
         float *buffer, int batch_size, int input_size, int hidden_size) {
-    _linear(input, weights_input, bias_input, buffer, batch_size, input_size, 4*hidden_size);
-    _linear_accumulate(state_h, weights_state, bias_state, buffer, batch_size, hidden_size, 4*hidden_size);
-
-    // Activation functions
-    for (int b=0; b<batch_size; b++) {
-        int b_offset = 4*b*hidden_size;
-        for (int i=0; i<2*hidden_size; i++) {
-            int buf_adr = b_offset + i;
-            buffer[buf_adr] = _sigmoid(buffer[buf_adr]);
-        }
-        for (int i=2*hidden_size; i<3*hidden_size; i++) {
-            int buf_adr = b_offset + i;
-            buffer[buf_adr] = tanh(buffer[buf_adr]);
-        }
-        for (int i=3*hidden_size; i<4*hidden_size; i++) {
-            int buf_adr = b_offset + i;
-            buffer[buf_adr] = _sigmoid(buffer[buf_adr]);
-        }
-    }
-
-    // Gates
-    for (int b=0; b<batch_size; b++) {
-        int hidden_offset = b*hidden_size;
-        int b_offset = 4*b*hidden_size;
-        for (int i=0; i<hidden_size; i++) {
-            state_c[hidden_offset + i] = (
-                buffer[b_offset + hidden_size + i] * state_c[hidden_offset + i]
-                + buffer[b_offset + i] * buffer[b_offset + 2*hidden_size + i]
-            );
-            state_h[hidden_offset + i] = (
-                buffer[b_offset + 3*hidden_size + i] * tanh(state_c[hidden_offset + i])
-            );
+    int gate_size = 4*hidden_size;
+    puf_lstm_bias(buffer, bias_input, bias_state, batch_size, gate_size);
+    _gemm_nt(input, weights_input, buffer, batch_size, input_size, gate_size);
+    _gemm_nt(state_h, weights_state, buffer, batch_size, hidden_size, gate_size);
+    puf_lstm_cell(state_h, state_c, buffer, batch_size, hidden_size);
+}
+
+// Runs an LSTM over input [seq_len, batch_size, input_size] like
+// torch.nn.LSTM, updating state_h/state_c in place and writing each step's h
+// to output [seq_len, batch_size, hidden_size] unless it is NULL. The input
+// projections of every step are one GEMM up front, so buffer needs
+// seq_len*batch_size*4*hidden_size floats. The recurrent weights are packed
+// once per call when there is more than one step to amortize it over.
+void _lstm_sequence(float* input, float* state_h, float* state_c, float* weights_input,
+        float* weights_state, float* bias_input, float* bias_state, float* output,
+        float* buffer, int seq_len, int batch_size, int input_size, int hidden_size) {
+    int gate_size = 4*hidden_size;
+    int rows = seq_len*batch_size;
+    puf_lstm_bias(buffer, bias_input, bias_state, rows, gate_size);
+    _gemm_nt(input, weights_input, buffer, rows, input_size, gate_size);
+
+    float* packed = NULL;
+    if (seq_len > 1) {
+        packed = malloc(_packed_weights_size(hidden_size, gate_size)*sizeof(float));
+    }
+    if (packed != NULL) {
+        _pack_weights(weights_state, packed, hidden_size, gate_size);
+    }
+    for (int t = 0; t < seq_len; t++) {
+        float* gates = buffer + (size_t)t*batch_size*gate_size;
+        if (packed != NULL) {
+            _gemm_nt_packed(state_h, packed, gates, batch_size, hidden_size, gate_size);
+        } else {
+            _gemm_nt(state_h, weights_state, gates, batch_size, hidden_size, gate_size);
+        }
+        puf_lstm_cell(state_h, state_c, gates, batch_size, hidden_size);
+        if (output != NULL) {
+            memcpy(output + (size_t)t*batch_size*hidden_size, state_h,
+                (size_t)batch_size*hidden_size*sizeof(float));
         }
     }
+    free(packed);
+}
+
+void _lstm_int8(float* input, float* state_h, float* state_c,
+        int8_t* weights_input, float* scales_input, int8_t* weights_state, float* scales_state,
+        float* bias_input, float* bias_state, float* buffer,
+        int batch_size, int input_size, int hidden_size) {
+    _linear_int8(input, weights_input, scales_input, bias_input, buffer,
+        batch_size, input_size, 4*hidden_size);
+    _linear_int8_accumulate(state_h, weights_state, scales_state, bias_state, buffer,
+        batch_size, hidden_size, 4*hidden_size);
+    puf_lstm_cell(state_h, state_c, buffer, batch_size, hidden_size);
 }
 
 void _embedding(int* input, float* weights, float* output, int batch_size, int num_embeddings, int embedding_dim) {
@@ -259,9 +996,9 @@ void _layernorm(float* input, float* weights, float* bias, float* output, int ba
         }
         variance /= (float)input_dim;
 
-        float denom = sqrtf(variance + 1e-5f);
+        float inv_std = 1.0f/sqrtf(variance + 1e-5f);
         for (int i = 0; i < input_dim; i++) {
-            float norm = (input[b*input_dim + i] - mean)/denom;
+            float norm = (input[b*input_dim + i] - mean)*inv_std;
             output[b*input_dim + i] = norm*weights[i] + bias[i];
         }
     }
@@ -316,31 +1053,95 @@ void _argmax_multidiscrete(float* input, int* output, int batch_size, int logit_
     }
 }
 
-void _softmax_multidiscrete(float* input, int* output, int batch_size, int logit_sizes[], int num_actions) {
+// Counter-based RNG for sampling. Every draw is a pure function of
+// (seed, agent, counter), hashed with the SplitMix64 finalizer, so agents can
+// be sampled in any order or on any thread with the same results.
+static inline uint64_t puf_splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30))*0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27))*0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+uint64_t _rng_stream(uint64_t seed, uint64_t agent) {
+    return puf_splitmix64(seed ^ puf_splitmix64(agent));
+}
+
+// Uniform float in [0, 1) from the top 24 bits
+float _rng_uniform(uint64_t stream, uint64_t counter) {
+    return (puf_splitmix64(stream + counter*0xD1B54A32D192ED03ull) >> 40)*(1.0f/16777216.0f);
+}
+
+// Samples each action head from softmax(logits). Agent b draws from stream
+// (seed, first_agent + b) at counters step*num_actions + a, so results only
+// depend on the seed, the global agent index and the step. The softmax is
+// max-stabilized with one expf per logit and the uniform is scaled by the
+// sum instead of normalizing. With gumbel set, the Gumbel-max trick picks
+// argmax(logit - log(-log(u))) in a single branch-free pass instead.
+void _sample_multidiscrete(float* input, int* output, int batch_size, int logit_sizes[],
+        int num_actions, uint64_t seed, uint64_t step, int first_agent, bool gumbel) {
+    int max_logits = 0;
+    for (int a = 0; a < num_actions; a++) {
+        max_logits = logit_sizes[a] > max_logits ? logit_sizes[a] : max_logits;
+    }
+    float probs[max_logits];
     int in_adr = 0;
     for (int b = 0; b < batch_size; b++) {
+        uint64_t stream = _rng_stream(seed, first_agent + b);
         for (int a = 0; a < num_actions; a++) {
             int out_adr = b*num_actions + a;
-            float logit_exp_sum = 0;
             int num_action_types = logit_sizes[a];
+            float* logits = input + in_adr;
+            uint64_t counter = step*num_actions + a;
+            in_adr += num_action_types;
+
+            if (gumbel) {
+                // One uniform per logit
+                uint64_t base = counter*max_logits;
+                int best = 0;
+                float best_score = -INFINITY;
+                for (int i = 0; i < num_action_types; i++) {
+                    float u = _rng_uniform(stream, base + i) + 0.5f/16777216.0f;
+                    float score = logits[i] - logf(-logf(u));
+                    if (score > best_score) {
+                        best_score = score;
+                        best = i;
+                    }
+                }
+                output[out_adr] = best;
+                continue;
+            }
+
+            float max_logit = logits[0];
+            for (int i = 1; i < num_action_types; i++) {
+                max_logit = logits[i] > max_logit ? logits[i] : max_logit;
+            }
+            float sum = 0.0f;
             for (int i = 0; i < num_action_types; i++) {
-                logit_exp_sum += expf(input[in_adr + i]);
+                probs[i] = expf(logits[i] - max_logit);
+                sum += probs[i];
             }
-            float prob = rand() / (float)RAND_MAX;
-            float logit_prob = 0;
-            output[out_adr] = 0;
+            float target = _rng_uniform(stream, counter)*sum;
+            float cumulative = 0.0f;
+            output[out_adr] = num_action_types - 1;
             for (int i = 0; i < num_action_types; i++) {
-                logit_prob += expf(input[in_adr + i]) / logit_exp_sum;
-                if (prob < logit_prob) {
+                cumulative += probs[i];
+                if (target < cumulative) {
                     output[out_adr] = i;
                     break;
                 }
             }
-            in_adr += num_action_types;
         }
     }
 }
 
+// Seeds from the global rand() once per call. Prefer _sample_multidiscrete
+// or the Multidiscrete layer, which carry their own seed and step.
+void _softmax_multidiscrete(float* input, int* output, int batch_size, int logit_sizes[], int num_actions) {
+    _sample_multidiscrete(input, output, batch_size, logit_sizes, num_actions,
+        (uint64_t)rand(), 0, 0, false);
+}
+
 void _max_dim1(float* input, float* output, int batch_size, int seq_len, int feature_dim) {
     for (int b = 0; b < batch_size; b++) {
         for (int f = 0; f < feature_dim; f++) {
@@ -356,37 +1157,111 @@ void _max_dim1(float* input, float* output, int batch_size, int seq_len, int fea
     }
 }
 
+// Fused set encoder: linear -> layernorm -> linear -> max over the set.
+// input is [batch_size, seq_len, input_dim], output is [batch_size, hidden_dim].
+// Objects go through PUF_SET_TILE at a time so the intermediates stay in
+// L1 instead of being written out as [batch_size, seq_len, hidden_dim].
+// If counts is given, only the first counts[b] objects of each set are
+// encoded and the rest are treated as padding, whose (constant) encoding
+// is passed in and folded into the max. counts may be NULL.
+// Both weight matrices come packed by _pack_weights, so callers that run the
+// encoder every step pack them once.
+#define PUF_SET_TILE 32
+
+void _set_encoder_max(float* input, float* packed_one, float* bias_one,
+        float* norm_weights, float* norm_bias, float* packed_two, float* bias_two,
+        float* output, int batch_size, int seq_len, int input_dim, int hidden_dim,
+        int* counts, float* padding) {
+    float hidden[PUF_SET_TILE*hidden_dim];
+    float encoded[PUF_SET_TILE*hidden_dim];
+    for (int b = 0; b < batch_size; b++) {
+        float* out = &output[b*hidden_dim];
+        int count = counts ? counts[b] : seq_len;
+        if (count < seq_len && padding) {
+            memcpy(out, padding, hidden_dim*sizeof(float));
+        } else {
+            for (int f = 0; f < hidden_dim; f++) {
+                out[f] = -INFINITY;
+            }
+        }
+        for (int s0 = 0; s0 < count; s0 += PUF_SET_TILE) {
+            int tile = count - s0 < PUF_SET_TILE ? count - s0 : PUF_SET_TILE;
+            float* x = &input[((size_t)b*seq_len + s0)*input_dim];
+            for (int s = 0; s < tile; s++) {
+                memcpy(&hidden[s*hidden_dim], bias_one, hidden_dim*sizeof(float));
+                memcpy(&encoded[s*hidden_dim], bias_two, hidden_dim*sizeof(float));
+            }
+            _gemm_nt_packed(x, packed_one, hidden, tile, input_dim, hidden_dim);
+            _layernorm(hidden, norm_weights, norm_bias, hidden, tile, hidden_dim);
+            _gemm_nt_packed(hidden, packed_two, encoded, tile, hidden_dim, hidden_dim);
+            for (int s = 0; s < tile; s++) {
+                float* row = &encoded[s*hidden_dim];
+                for (int f = 0; f < hidden_dim; f++) {
+                    if (row[f] > out[f]) out[f] = row[f];
+                }
+            }
+        }
+    }
+}
+
 // User API. Provided to help organize layers
 typedef struct Linear Linear;
 struct Linear {
     float* output;
     float* weights;
     float* bias;
+    int8_t* qweights;
+    float* scales;
     int batch_size;
     int input_dim;
     int output_dim;
 };
 
+// With int8 weights, weights holds the dequantized copy and linear runs the
+// int8 kernel on qweights
 Linear* make_linear(Weights* weights, int batch_size, int input_dim, int output_dim) {
     size_t buffer_size = batch_size*output_dim*sizeof(float);
-    Linear* layer = calloc(1, sizeof(Linear) + buffer_size);
+    size_t int8_size = weights->quantized ? _int8_matrix_size(output_dim, input_dim) : 0;
+    Linear* layer = calloc(1, sizeof(Linear) + buffer_size + int8_size);
     *layer = (Linear){
         .output = (float*)(layer + 1),
-        .weights = get_weights(weights, output_dim*input_dim),
-        .bias = get_weights(weights, output_dim),
         .batch_size = batch_size,
         .input_dim = input_dim,
         .output_dim = output_dim,
     };
+    if (weights->quantized) {
+        layer->weights = get_weights_int8(weights, (char*)layer->output + buffer_size,
+            output_dim, input_dim, &layer->qweights, &layer->scales);
+    } else {
+        layer->weights = get_weights(weights, output_dim*input_dim);
+    }
+    layer->bias = get_weights(weights, output_dim);
     return layer;
 }
 
+// Runs rows [start, start + count) of the batch, so threads can split a layer
+void linear_rows(Linear* layer, float* input, int start, int count) {
+    float* rows = input + (size_t)start*layer->input_dim;
+    float* output = layer->output + (size_t)start*layer->output_dim;
+    if (layer->qweights) {
+        _linear_int8(rows, layer->qweights, layer->scales, layer->bias, output,
+            count, layer->input_dim, layer->output_dim);
+        return;
+    }
+    _linear(rows, layer->weights, layer->bias, output,
+        count, layer->input_dim, layer->output_dim);
+}
+
 void linear(Linear* layer, float* input) {
-    _linear(input, layer->weights, layer->bias, layer->output,
-        layer->batch_size, layer->input_dim, layer->output_dim);
+    linear_rows(layer, input, 0, layer->batch_size);
 }
 
 void linear_accumulate(Linear* layer, float* input) {
+    if (layer->qweights) {
+        _linear_int8_accumulate(input, layer->qweights, layer->scales, layer->bias,
+            layer->output, layer->batch_size, layer->input_dim, layer->output_dim);
+        return;
+    }
     _linear_accumulate(input, layer->weights, layer->bias, layer->output,
         layer->batch_size, layer->input_dim, layer->output_dim);
 }
@@ -551,35 +1426,110 @@ struct LSTM {
     float* bias_input;
     float*bias_state;
     float *buffer;
+    float* packed;
+    float* bias;
+    float* concat;
+    int8_t* qweights_input;
+    int8_t* qweights_state;
+    float* scales_input;
+    float* scales_state;
     int batch_size;
     int input_size;
     int hidden_size;
 };
 
+// fp32 layers pack [weights_input weights_state] once, so each step is one
+// GEMM of [input state_h] into the gates followed by the fused cell
 LSTM* make_lstm(Weights* weights, int batch_size, int input_size, int hidden_size) {
     int state_size = batch_size*hidden_size;
-    LSTM* layer = calloc(1, sizeof(LSTM) + 6*state_size*sizeof(float));
+    int gate_size = 4*hidden_size;
+    int concat_size = input_size + hidden_size;
+    size_t buffer_size = 6*state_size*sizeof(float);
+    size_t input_int8_size = 0;
+    size_t state_int8_size = 0;
+    size_t fused_size = 0;
+    if (weights->quantized) {
+        input_int8_size = _int8_matrix_size(gate_size, input_size);
+        state_int8_size = _int8_matrix_size(gate_size, hidden_size);
+    } else {
+        fused_size = (_packed_weights_size(concat_size, gate_size) + gate_size
+            + (size_t)batch_size*concat_size)*sizeof(float);
+    }
+    LSTM* layer = calloc(1, sizeof(LSTM) + buffer_size
+        + input_int8_size + state_int8_size + fused_size);
     float* buffer = (float*)(layer + 1);
     *layer = (LSTM){
         .state_h = buffer,
         .state_c = buffer + state_size,
-        .weights_input = get_weights(weights, 4*hidden_size*input_size),
-        .weights_state = get_weights(weights, 4*hidden_size*hidden_size),
-        .bias_input = get_weights(weights, 4*hidden_size),
-        .bias_state = get_weights(weights, 4*hidden_size),
         .buffer = buffer + 2*state_size,
         .batch_size = batch_size,
         .input_size = input_size,
         .hidden_size = hidden_size,
 
     };
+    if (weights->quantized) {
+        char* int8_buffer = (char*)buffer + buffer_size;
+        layer->weights_input = get_weights_int8(weights, int8_buffer, gate_size,
+            input_size, &layer->qweights_input, &layer->scales_input);
+        layer->weights_state = get_weights_int8(weights, int8_buffer + input_int8_size,
+            gate_size, hidden_size, &layer->qweights_state, &layer->scales_state);
+    } else {
+        layer->weights_input = get_weights(weights, gate_size*input_size);
+        layer->weights_state = get_weights(weights, gate_size*hidden_size);
+    }
+    layer->bias_input = get_weights(weights, gate_size);
+    layer->bias_state = get_weights(weights, gate_size);
+    if (weights->quantized) {
+        return layer;
+    }
+
+    layer->packed = (float*)((char*)buffer + buffer_size);
+    layer->bias = layer->packed + _packed_weights_size(concat_size, gate_size);
+    layer->concat = layer->bias + gate_size;
+    float* fused = malloc((size_t)gate_size*concat_size*sizeof(float));
+    for (int o = 0; o < gate_size; o++) {
+        memcpy(fused + (size_t)o*concat_size, layer->weights_input + (size_t)o*input_size,
+            input_size*sizeof(float));
+        memcpy(fused + (size_t)o*concat_size + input_size,
+            layer->weights_state + (size_t)o*hidden_size, hidden_size*sizeof(float));
+        layer->bias[o] = layer->bias_input[o] + layer->bias_state[o];
+    }
+    _pack_weights(fused, layer->packed, concat_size, gate_size);
+    free(fused);
     return layer;
 }
 
+// Runs rows [start, start + count) of the batch, so threads can split a layer
+void lstm_rows(LSTM* layer, float* input, int start, int count) {
+    int input_size = layer->input_size;
+    int hidden_size = layer->hidden_size;
+    int gate_size = 4*hidden_size;
+    float* rows = input + (size_t)start*input_size;
+    float* state_h = layer->state_h + (size_t)start*hidden_size;
+    float* state_c = layer->state_c + (size_t)start*hidden_size;
+    float* gates = layer->buffer + (size_t)start*gate_size;
+    if (layer->qweights_input) {
+        _lstm_int8(rows, state_h, state_c,
+            layer->qweights_input, layer->scales_input,
+            layer->qweights_state, layer->scales_state,
+            layer->bias_input, layer->bias_state,
+            gates, count, input_size, hidden_size);
+        return;
+    }
+    int concat_size = input_size + hidden_size;
+    float* concat = layer->concat + (size_t)start*concat_size;
+    for (int b = 0; b < count; b++) {
+        float* row = concat + (size_t)b*concat_size;
+        memcpy(row, rows + (size_t)b*input_size, input_size*sizeof(float));
+        memcpy(row + input_size, state_h + (size_t)b*hidden_size, hidden_size*sizeof(float));
+        memcpy(gates + (size_t)b*gate_size, layer->bias, gate_size*sizeof(float));
+    }
+    _gemm_nt_packed(concat, layer->packed, gates, count, concat_size, gate_size);
+    puf_lstm_cell(state_h, state_c, gates, count, hidden_size);
+}
+
 void lstm(LSTM* layer, float* input) {
-    _lstm(input, layer->state_h, layer->state_c, layer->weights_input,
-        layer->weights_state, layer->bias_input, layer->bias_state,
-        layer->buffer, layer->batch_size, layer->input_size, layer->hidden_size);
+    lstm_rows(layer, input, 0, layer->batch_size);
 }
 
 typedef struct Embedding Embedding;
@@ -688,22 +1638,35 @@ struct Multidiscrete {
     int batch_size;
     int logit_sizes[32];
     int num_actions;
+    uint64_t seed;
+    uint64_t step;
+    bool gumbel;
 };
 
+// Seeded from rand() by default; call seed_multidiscrete for reproducible
+// sampling
 Multidiscrete* make_multidiscrete(int batch_size, int logit_sizes[], int num_actions) {
     Multidiscrete* layer = calloc(1, sizeof(Multidiscrete));
     layer->batch_size = batch_size;
     layer->num_actions = num_actions;
+    layer->seed = (uint64_t)rand();
     memcpy(layer->logit_sizes, logit_sizes, num_actions*sizeof(int));
     return layer;
 }
 
+void seed_multidiscrete(Multidiscrete* layer, uint64_t seed) {
+    layer->seed = seed;
+    layer->step = 0;
+}
+
 void argmax_multidiscrete(Multidiscrete* layer, float* input, int* output) {
     _argmax_multidiscrete(input, output, layer->batch_size, layer->logit_sizes, layer->num_actions);
 }
 
 void softmax_multidiscrete(Multidiscrete* layer, float* input, int* output) {
-    _softmax_multidiscrete(input, output, layer->batch_size, layer->logit_sizes, layer->num_actions);
+    _sample_multidiscrete(input, output, layer->batch_size, layer->logit_sizes,
+        layer->num_actions, layer->seed, layer->step, 0, layer->gumbel);
+    layer->step++;
 }
 
 // Default models
@@ -30,6 +30,9 @@ cdef extern from "puffernet.h":
     void _lstm(float* input, float* state_h, float* state_c, float* weights_input,
         float* weights_state, float* bias_input, float*bias_state,
         float *buffer, int batch_size, int input_size, int hidden_size)
+    void _lstm_sequence(float* input, float* state_h, float* state_c, float* weights_input,
+        float* weights_state, float* bias_input, float* bias_state, float* output,
+        float* buffer, int seq_len, int batch_size, int input_size, int hidden_size)
     void _layernorm(float* input, float* weights, float* bias, float* output,
         int batch_size, int input_size)
     void _one_hot(int* input, int* output, int batch_size,
@@ -38,6 +41,9 @@ cdef extern from "puffernet.h":
         int batch_size, int x_size, int y_size)
     void _argmax_multidiscrete(float* input, int* output,
         int batch_size, int logit_sizes[], int num_actions)
+    void _sample_multidiscrete(float* input, int* output, int batch_size,
+        int logit_sizes[], int num_actions, unsigned long long seed,
+        unsigned long long step, int first_agent, bint gumbel)
 
 def puf_linear_layer(cnp.ndarray input, cnp.ndarray weights, cnp.ndarray bias, cnp.ndarray output,
         int batch_size, int input_dim, int output_dim):
@@ -71,6 +77,15 @@ def puf_lstm(cnp.ndarray input, cnp.ndarray state_h, cnp.ndarray state_c, cnp.nd
         <float*> weights_input.data, <float*> weights_state.data, <float*> bias_input.data,
         <float*> bias_state.data, <float*> buffer.data, batch_size, input_size, hidden_size)
 
+def puf_lstm_sequence(cnp.ndarray input, cnp.ndarray state_h, cnp.ndarray state_c,
+        cnp.ndarray weights_input, cnp.ndarray weights_state, cnp.ndarray bias_input,
+        cnp.ndarray bias_state, cnp.ndarray output, cnp.ndarray buffer,
+        int seq_len, int batch_size, int input_size, int hidden_size):
+    _lstm_sequence(<float*> input.data, <float*> state_h.data, <float*> state_c.data,
+        <float*> weights_input.data, <float*> weights_state.data, <float*> bias_input.data,
+        <float*> bias_state.data, <float*> output.data, <float*> buffer.data,
+        seq_len, batch_size, input_size, hidden_size)
+
 def puf_embedding(cnp.ndarray input, cnp.ndarray weights, cnp.ndarray output,
         int batch_size, int num_embeddings, int embedding_dim):
     _embedding(<int*> input.data, <float*> weights.data, <float*> output.data,
@@ -91,3 +106,9 @@ def puf_argmax_multidiscrete(cnp.ndarray input, cnp.ndarray output,
         int batch_size, cnp.ndarray logit_sizes, int num_actions):
     _argmax_multidiscrete(<float*> input.data, <int*> output.data,
         batch_size, <int*> logit_sizes.data, num_actions)
+
+def puf_sample_multidiscrete(cnp.ndarray input, cnp.ndarray output,
+        int batch_size, cnp.ndarray logit_sizes, int num_actions,
+        unsigned long long seed, unsigned long long step, int first_agent=0, bint gumbel=False):
+    _sample_multidiscrete(<float*> input.data, <int*> output.data,
+        batch_size, <int*> logit_sizes.data, num_actions, seed, step, first_agent, gumbel)
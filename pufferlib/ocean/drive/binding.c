@@ -1,9 +1,41 @@
+#include <Python.h>
 #include "drive.h"
+#include "raster.h"
 #define Env Drive
 #define MY_SHARED
 #define MY_PUT
+#define MY_LOG_MERGE
+#define MY_SEED
+#define MY_METHODS {"vec_init_drive", (PyCFunction)vec_init_drive, METH_VARARGS | METH_KEYWORDS, "Initialize every env from map ids and agent offsets in one call"}, \
+    {"vec_raster", vec_raster, METH_VARARGS, "Render top-down RGBA frames of every env without a GL context"}, \
+    {"vec_snapshot", vec_snapshot, METH_VARARGS, "Save the mid-episode state of every env into a uint8 array"}, \
+    {"vec_restore", vec_restore, METH_VARARGS, "Restore every env from a vec_snapshot array"}, \
+    {"vec_fork", vec_fork, METH_VARARGS, "Make a vec env of copies of one env that share its map data"}, \
+    {"vec_record", vec_record, METH_VARARGS, "Stream every env's observations, actions, rewards and terminals to a file"}, \
+    {"vec_record_detach", vec_record_detach, METH_VARARGS, "Stop a vec env recording but keep its file open for vec_record_attach"}, \
+    {"vec_record_attach", vec_record_attach, METH_VARARGS, "Continue a detached recording on a new vec env"}, \
+    {"read_trajectories", read_trajectories, METH_VARARGS, "Load a file written by vec_record into arrays"}
+static PyObject* vec_init_drive(PyObject* self, PyObject* args, PyObject* kwargs);
+static PyObject* vec_raster(PyObject* self, PyObject* args);
+static PyObject* vec_snapshot(PyObject* self, PyObject* args);
+static PyObject* vec_restore(PyObject* self, PyObject* args);
+static PyObject* vec_fork(PyObject* self, PyObject* args);
+static PyObject* vec_record(PyObject* self, PyObject* args);
+static PyObject* vec_record_detach(PyObject* self, PyObject* args);
+static PyObject* vec_record_attach(PyObject* self, PyObject* args);
+static PyObject* read_trajectories(PyObject* self, PyObject* args);
+typedef struct {
+    LogHistograms histograms;
+#ifdef DRIVE_PROFILE
+    StepProfile profile;
+#endif
+} LogMerge;
 #include "../env_binding.h"
 
+static void my_seed(Env* env, int seed) {
+    seed_rng(&env->rng, (uint64_t)(uint32_t)seed);
+}
+
 static int my_put(Env* env, PyObject* args, PyObject* kwargs) {
     PyObject* obs = PyDict_GetItemString(kwargs, "observations");
     if (!PyObject_TypeCheck(obs, &PyArray_Type)) {
@@ -71,7 +103,8 @@ static PyObject* my_shared(PyObject* self, PyObject* args, PyObject* kwargs) {
     int num_agents = unpack(kwargs, "num_agents");
     int num_maps = unpack(kwargs, "num_maps");
     clock_gettime(CLOCK_REALTIME, &ts);
-    srand(ts.tv_nsec);
+    uint64_t rng;
+    seed_rng(&rng, ts.tv_nsec);
     int total_agent_count = 0;
     int env_count = 0;
     int max_envs = num_agents;
@@ -80,8 +113,9 @@ static PyObject* my_shared(PyObject* self, PyObject* args, PyObject* kwargs) {
     // getting env count
     while(total_agent_count < num_agents && env_count < max_envs){
         char map_file[100];
-        int map_id = rand() % num_maps;
+        int map_id = rng_int(&rng, num_maps);
         Drive* env = calloc(1, sizeof(Drive));
+        seed_rng(&env->rng, rng_next(&rng));
         sprintf(map_file, "resources/drive/binaries/map_%03d.bin", map_id);
         env->entities = load_map_binary(map_file, env);
         PyObject* obj = NULL;
@@ -155,40 +189,684 @@ static PyObject* my_shared(PyObject* self, PyObject* args, PyObject* kwargs) {
     // return agent_offsets;
 }
 
-static int my_init(Env* env, PyObject* args, PyObject* kwargs) {
-    env->human_agent_idx = unpack(kwargs, "human_agent_idx");
-    env->ini_file = unpack_str(kwargs, "ini_file");
-    env_init_config conf;
-    if(ini_parse(env->ini_file, handler, &conf) < 0) {
-        printf("Error while loading %s", env->ini_file);
-    }
-    env->action_type = conf.action_type;
-    env->reward_vehicle_collision = conf.reward_vehicle_collision;
-    env->reward_offroad_collision = conf.reward_offroad_collision;
-    env->reward_goal = conf.reward_goal;
-    env->reward_goal_post_respawn = conf.reward_goal_post_respawn;
-    env->reward_vehicle_collision_post_respawn = conf.reward_vehicle_collision_post_respawn;
-    env->reward_ade = conf.reward_ade;
-    env->goal_radius = conf.goal_radius;
-    env->use_goal_generation = conf.use_goal_generation;
-    env->spawn_immunity_timer = conf.spawn_immunity_timer;
-    env->policy_agents_per_env = unpack(kwargs, "num_policy_controlled_agents");
-    env->control_all_agents = unpack(kwargs, "control_all_agents");
-    env->deterministic_agent_selection = unpack(kwargs, "deterministic_agent_selection");
-    env->control_non_vehicles = (int)unpack(kwargs, "control_non_vehicles");
-    int map_id = unpack(kwargs, "map_id");
-    int max_agents = unpack(kwargs, "max_agents");
-    int init_steps = unpack(kwargs, "init_steps");
+// Settings shared by every env in a batch, unpacked from kwargs once
+typedef struct {
+    int human_agent_idx;
+    const EnvConfigEntry* config;
+    int policy_agents_per_env;
+    int control_all_agents;
+    int deterministic_agent_selection;
+    int control_non_vehicles;
+    int persist_trajectory_cache;
+    int max_partner_observations;
+    int init_steps;
+} DriveInitArgs;
+
+static int unpack_init_args(PyObject* kwargs, DriveInitArgs* init_args) {
+    init_args->config = unpack_config(kwargs);
+    if (init_args->config == NULL) {
+        return 1;
+    }
+    init_args->human_agent_idx = unpack(kwargs, "human_agent_idx");
+    init_args->policy_agents_per_env = unpack(kwargs, "num_policy_controlled_agents");
+    init_args->control_all_agents = unpack(kwargs, "control_all_agents");
+    init_args->deterministic_agent_selection = unpack(kwargs, "deterministic_agent_selection");
+    init_args->control_non_vehicles = (int)unpack(kwargs, "control_non_vehicles");
+    init_args->persist_trajectory_cache = (int)unpack(kwargs, "persist_trajectory_cache");
+    init_args->max_partner_observations = (int)unpack(kwargs, "max_partner_observations");
+    init_args->init_steps = unpack(kwargs, "init_steps");
+    return PyErr_Occurred() != NULL;
+}
+
+// Loads the map and initializes one env. Touches no Python state, so it is
+// safe to call without the GIL.
+static void init_drive_env(Env* env, const DriveInitArgs* init_args, int map_id, int max_agents) {
+    const env_init_config* conf = &init_args->config->config;
+    env->human_agent_idx = init_args->human_agent_idx;
+    env->ini_file = init_args->config->path;
+    env->action_type = conf->action_type;
+    env->reward_vehicle_collision = conf->reward_vehicle_collision;
+    env->reward_offroad_collision = conf->reward_offroad_collision;
+    env->reward_goal = conf->reward_goal;
+    env->reward_goal_post_respawn = conf->reward_goal_post_respawn;
+    env->reward_vehicle_collision_post_respawn = conf->reward_vehicle_collision_post_respawn;
+    env->reward_ade = conf->reward_ade;
+    env->goal_radius = conf->goal_radius;
+    env->use_goal_generation = conf->use_goal_generation;
+    env->spawn_immunity_timer = conf->spawn_immunity_timer;
+    env->policy_agents_per_env = init_args->policy_agents_per_env;
+    env->control_all_agents = init_args->control_all_agents;
+    env->deterministic_agent_selection = init_args->deterministic_agent_selection;
+    env->control_non_vehicles = init_args->control_non_vehicles;
+    env->persist_trajectory_cache = init_args->persist_trajectory_cache;
+    env->max_partner_observations = init_args->max_partner_observations;
     char map_file[100];
     sprintf(map_file, "resources/drive/binaries/map_%03d.bin", map_id);
     env->num_agents = max_agents;
     env->map_name = strdup(map_file);
-    env->init_steps = init_steps;
-    env->timestep = init_steps;
+    env->init_steps = init_args->init_steps;
+    env->timestep = init_args->init_steps;
     init(env);
+}
+
+static int my_init(Env* env, PyObject* args, PyObject* kwargs) {
+    DriveInitArgs init_args;
+    if (unpack_init_args(kwargs, &init_args)) {
+        return 1;
+    }
+    int map_id = unpack(kwargs, "map_id");
+    int max_agents = unpack(kwargs, "max_agents");
+    if (PyErr_Occurred()) {
+        return 1;
+    }
+    init_drive_env(env, &init_args, map_id, max_agents);
     return 0;
 }
 
+typedef struct {
+    VecEnv* vec;
+    const DriveInitArgs* init_args;
+    const int* map_ids;
+    const int* agent_offsets;
+    int next_env;   // claimed by workers with an atomic add
+    int failed_map; // -1, or a map id whose binary could not be read
+} DriveInitBatch;
+
+static void* vec_init_drive_worker(void* arg) {
+    DriveInitBatch* batch = (DriveInitBatch*)arg;
+    int i;
+    while ((i = __atomic_fetch_add(&batch->next_env, 1, __ATOMIC_RELAXED)) < batch->vec->num_envs) {
+        char map_file[100];
+        sprintf(map_file, "resources/drive/binaries/map_%03d.bin", batch->map_ids[i]);
+        if (access(map_file, R_OK) != 0) {
+            __atomic_store_n(&batch->failed_map, batch->map_ids[i], __ATOMIC_RELAXED);
+            continue;
+        }
+        int max_agents = batch->agent_offsets[i + 1] - batch->agent_offsets[i];
+        init_drive_env(batch->vec->envs[i], batch->init_args, batch->map_ids[i], max_agents);
+    }
+    return NULL;
+}
+
+// vec_init_drive(obs, act, rew, term, trunc, map_ids, agent_offsets, seed, **kwargs)
+// Builds every env of a Drive vector in one call. Env i gets map map_ids[i]
+// and agent rows [agent_offsets[i], agent_offsets[i + 1]) of each buffer.
+// Settings are unpacked once and maps load in parallel on num_threads
+// threads (default: all cores) with the GIL released.
+static PyObject* vec_init_drive(PyObject* self, PyObject* args, PyObject* kwargs) {
+    if (PyTuple_Size(args) != 8) {
+        PyErr_SetString(PyExc_TypeError, "vec_init_drive requires 8 arguments");
+        return NULL;
+    }
+    if (kwargs == NULL) {
+        PyErr_SetString(PyExc_TypeError, "vec_init_drive requires env keyword arguments");
+        return NULL;
+    }
+
+    static const char* names[5] = {"Observations", "Actions", "Rewards", "Terminals", "Truncations"};
+    PyArrayObject* buffers[5];
+    for (int b = 0; b < 5; b++) {
+        buffers[b] = unpack_contiguous_array(PyTuple_GetItem(args, b), names[b]);
+        if (!buffers[b]) {
+            return NULL;
+        }
+    }
+    if (PyArray_ITEMSIZE(buffers[1]) == sizeof(double)) {
+        PyErr_SetString(PyExc_ValueError, "Action tensor passed as float64 (pass np.float32 buffer)");
+        return NULL;
+    }
+
+    PyArrayObject* map_ids = (PyArrayObject*)PyArray_FROMANY(
+        PyTuple_GetItem(args, 5), NPY_INT32, 1, 1, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    if (!map_ids) {
+        return NULL;
+    }
+    PyArrayObject* agent_offsets = (PyArrayObject*)PyArray_FROMANY(
+        PyTuple_GetItem(args, 6), NPY_INT32, 1, 1, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    if (!agent_offsets) {
+        Py_DECREF(map_ids);
+        return NULL;
+    }
+    int num_envs = PyArray_DIM(map_ids, 0);
+    const int* offsets = (const int*)PyArray_DATA(agent_offsets);
+    if (num_envs <= 0 || PyArray_DIM(agent_offsets, 0) != num_envs + 1) {
+        PyErr_SetString(PyExc_ValueError, "agent_offsets must have one more entry than map_ids");
+        goto fail;
+    }
+    for (int i = 0; i < num_envs; i++) {
+        if (offsets[i] < 0 || offsets[i + 1] <= offsets[i] || offsets[i + 1] > PyArray_DIM(buffers[0], 0)) {
+            PyErr_SetString(PyExc_ValueError, "agent_offsets must be increasing and within the buffers");
+            goto fail;
+        }
+    }
+
+    PyObject* seed_arg = PyTuple_GetItem(args, 7);
+    if (!PyObject_TypeCheck(seed_arg, &PyLong_Type)) {
+        PyErr_SetString(PyExc_TypeError, "seed must be an integer");
+        goto fail;
+    }
+    int seed = PyLong_AsLong(seed_arg);
+
+    DriveInitArgs init_args;
+    if (unpack_init_args(kwargs, &init_args)) {
+        goto fail;
+    }
+    int num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (PyDict_GetItemString(kwargs, "num_threads") != NULL) {
+        num_threads = unpack(kwargs, "num_threads");
+    }
+    if (num_threads > num_envs) num_threads = num_envs;
+    if (num_threads < 1) num_threads = 1;
+
+    VecEnv* vec = (VecEnv*)calloc(1, sizeof(VecEnv));
+    vec->num_envs = num_envs;
+    vec->envs = (Env**)calloc(num_envs, sizeof(Env*));
+    for (int i = 0; i < num_envs; i++) {
+        Env* env = (Env*)calloc(1, sizeof(Env));
+        vec->envs[i] = env;
+        env->observations = (void*)((char*)PyArray_DATA(buffers[0]) + offsets[i]*PyArray_STRIDE(buffers[0], 0));
+        env->actions = (void*)((char*)PyArray_DATA(buffers[1]) + offsets[i]*PyArray_STRIDE(buffers[1], 0));
+        env->rewards = (void*)((char*)PyArray_DATA(buffers[2]) + offsets[i]*PyArray_STRIDE(buffers[2], 0));
+        env->terminals = (void*)((char*)PyArray_DATA(buffers[3]) + offsets[i]*PyArray_STRIDE(buffers[3], 0));
+        // Same per-env seeds as vec_init
+        my_seed(env, i + seed*num_envs);
+    }
+
+    DriveInitBatch batch = {
+        .vec = vec,
+        .init_args = &init_args,
+        .map_ids = (const int*)PyArray_DATA(map_ids),
+        .agent_offsets = offsets,
+        .next_env = 0,
+        .failed_map = -1,
+    };
+    Py_BEGIN_ALLOW_THREADS
+    pthread_t* threads = (pthread_t*)calloc(num_threads, sizeof(pthread_t));
+    int started = 0;
+    for (int t = 1; t < num_threads; t++) {
+        if (pthread_create(&threads[t], NULL, vec_init_drive_worker, &batch) != 0) {
+            break;
+        }
+        started = t;
+    }
+    vec_init_drive_worker(&batch);
+    for (int t = 1; t <= started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+    Py_END_ALLOW_THREADS
+
+    if (batch.failed_map >= 0) {
+        for (int i = 0; i < num_envs; i++) {
+            if (vec->envs[i]->entities != NULL) {
+                c_close(vec->envs[i]);
+            }
+            free(vec->envs[i]);
+        }
+        free(vec->envs);
+        free(vec);
+        PyErr_Format(PyExc_FileNotFoundError,
+            "resources/drive/binaries/map_%03d.bin not found", batch.failed_map);
+        goto fail;
+    }
+
+    Py_DECREF(map_ids);
+    Py_DECREF(agent_offsets);
+    return PyLong_FromVoidPtr(vec);
+
+fail:
+    Py_DECREF(map_ids);
+    Py_DECREF(agent_offsets);
+    return NULL;
+}
+
+// vec_raster(vec, scale, num_threads, log_trajectories=0)
+// Returns one (height, width, 4) uint8 RGBA array per env, drawn by the CPU
+// rasterizer in raster.h. Arrays are allocated with the GIL held, then
+// filled on num_threads threads with the GIL released.
+static PyObject* vec_raster(PyObject* self, PyObject* args) {
+    int num_args = PyTuple_Size(args);
+    if (num_args != 3 && num_args != 4) {
+        PyErr_SetString(PyExc_TypeError, "vec_raster requires 3 or 4 arguments");
+        return NULL;
+    }
+    VecEnv* vec = unpack_vecenv(args);
+    if (!vec) {
+        return NULL;
+    }
+    float scale = (float)PyFloat_AsDouble(PyTuple_GetItem(args, 1));
+    int num_threads = PyLong_AsLong(PyTuple_GetItem(args, 2));
+    int log_trajectories = num_args == 4 ? PyObject_IsTrue(PyTuple_GetItem(args, 3)) : 0;
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+    if (scale <= 0.0f) {
+        PyErr_SetString(PyExc_ValueError, "scale must be positive");
+        return NULL;
+    }
+
+    PyObject* frames_list = PyList_New(vec->num_envs);
+    RasterFrame** frames = (RasterFrame**)calloc(vec->num_envs, sizeof(RasterFrame*));
+    for (int i = 0; i < vec->num_envs; i++) {
+        int width, height;
+        raster_frame_size(vec->envs[i], scale, &width, &height);
+        npy_intp dims[3] = {height, width, 4};
+        PyObject* pixels = PyArray_SimpleNew(3, dims, NPY_UINT8);
+        if (!pixels) {
+            for (int j = 0; j < i; j++) {
+                free_raster_frame(frames[j]);
+            }
+            free(frames);
+            Py_DECREF(frames_list);
+            return NULL;
+        }
+        PyList_SET_ITEM(frames_list, i, pixels);
+        frames[i] = make_raster_frame(vec->envs[i], scale, PyArray_DATA((PyArrayObject*)pixels));
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    vec_async_drain(vec);
+    raster_topdown_batch(vec->envs, frames, vec->num_envs, num_threads, log_trajectories);
+    Py_END_ALLOW_THREADS
+
+    for (int i = 0; i < vec->num_envs; i++) {
+        free_raster_frame(frames[i]);
+    }
+    free(frames);
+    return frames_list;
+}
+
+static size_t vec_snapshot_size(VecEnv* vec) {
+    size_t size = 0;
+    for (int i = 0; i < vec->num_envs; i++) {
+        size += snapshot_size(vec->envs[i]);
+    }
+    return size;
+}
+
+// vec_snapshot(vec, out=None)
+// Returns a 1D uint8 array with c_snapshot of each env back to back. Pass
+// a previous snapshot as out to reuse its memory.
+static PyObject* vec_snapshot(PyObject* self, PyObject* args) {
+    int num_args = PyTuple_Size(args);
+    if (num_args != 1 && num_args != 2) {
+        PyErr_SetString(PyExc_TypeError, "vec_snapshot requires 1 or 2 arguments");
+        return NULL;
+    }
+    VecEnv* vec = unpack_vecenv(args);
+    if (!vec) {
+        return NULL;
+    }
+    npy_intp size = (npy_intp)vec_snapshot_size(vec);
+    PyArrayObject* out = NULL;
+    if (num_args == 2 && PyTuple_GetItem(args, 1) != Py_None) {
+        out = unpack_contiguous_array(PyTuple_GetItem(args, 1), "Snapshot");
+        if (!out) {
+            return NULL;
+        }
+        if (PyArray_TYPE(out) != NPY_UINT8 || PyArray_NBYTES(out) != size) {
+            PyErr_SetString(PyExc_ValueError, "out must be a uint8 array from vec_snapshot of this vec env");
+            return NULL;
+        }
+        Py_INCREF(out);
+    } else {
+        out = (PyArrayObject*)PyArray_SimpleNew(1, &size, NPY_UINT8);
+        if (!out) {
+            return NULL;
+        }
+    }
+
+    char* buffer = PyArray_DATA(out);
+    Py_BEGIN_ALLOW_THREADS
+    vec_async_drain(vec);
+    for (int i = 0; i < vec->num_envs; i++) {
+        c_snapshot(vec->envs[i], buffer);
+        buffer += snapshot_size(vec->envs[i]);
+    }
+    Py_END_ALLOW_THREADS
+    return (PyObject*)out;
+}
+
+// vec_restore(vec, snapshot)
+// Restores every env from an array made by vec_snapshot on this vec env
+static PyObject* vec_restore(PyObject* self, PyObject* args) {
+    if (PyTuple_Size(args) != 2) {
+        PyErr_SetString(PyExc_TypeError, "vec_restore requires 2 arguments");
+        return NULL;
+    }
+    VecEnv* vec = unpack_vecenv(args);
+    if (!vec) {
+        return NULL;
+    }
+    PyArrayObject* snapshot = unpack_contiguous_array(PyTuple_GetItem(args, 1), "Snapshot");
+    if (!snapshot) {
+        return NULL;
+    }
+    if (PyArray_NBYTES(snapshot) != (npy_intp)vec_snapshot_size(vec)) {
+        PyErr_SetString(PyExc_ValueError, "Snapshot size does not match this vec env");
+        return NULL;
+    }
+
+    // Check every env first so a mismatch leaves all of them untouched
+    const char* data = PyArray_DATA(snapshot);
+    const char* buffer = data;
+    for (int i = 0; i < vec->num_envs; i++) {
+        if (!snapshot_matches(vec->envs[i], buffer)) {
+            PyErr_Format(PyExc_ValueError, "Snapshot of env %d was taken from a different scenario", i);
+            return NULL;
+        }
+        buffer += snapshot_size(vec->envs[i]);
+    }
+
+    buffer = data;
+    Py_BEGIN_ALLOW_THREADS
+    vec_async_drain(vec);
+    for (int i = 0; i < vec->num_envs; i++) {
+        c_restore(vec->envs[i], buffer);
+        buffer += snapshot_size(vec->envs[i]);
+    }
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
+// vec_fork(vec, env_index, num_forks, obs, actions, rewards, terminals, truncations)
+// Returns a new vec env of num_forks copies of env env_index, taken at its
+// current timestep. See fork_env for what the copies share. Fork i writes
+// rows [i*n, (i+1)*n) of the buffers, where n is the env's agent count.
+// Stepping is deterministic, so forks stay identical until they are given
+// different actions, e.g. from the policy's sampler.
+static PyObject* vec_fork(PyObject* self, PyObject* args) {
+    if (PyTuple_Size(args) != 8) {
+        PyErr_SetString(PyExc_TypeError, "vec_fork requires 8 arguments");
+        return NULL;
+    }
+    VecEnv* vec = unpack_vecenv(args);
+    if (!vec) {
+        return NULL;
+    }
+    int env_index = PyLong_AsLong(PyTuple_GetItem(args, 1));
+    int num_forks = PyLong_AsLong(PyTuple_GetItem(args, 2));
+    if (PyErr_Occurred()) {
+        return NULL;
+    }
+    if (env_index < 0 || env_index >= vec->num_envs) {
+        PyErr_SetString(PyExc_IndexError, "env_index out of range");
+        return NULL;
+    }
+    if (num_forks <= 0) {
+        PyErr_SetString(PyExc_ValueError, "num_forks must be positive");
+        return NULL;
+    }
+
+    static const char* names[5] = {"Observations", "Actions", "Rewards", "Terminals", "Truncations"};
+    PyArrayObject* buffers[5];
+    for (int b = 0; b < 5; b++) {
+        buffers[b] = unpack_contiguous_array(PyTuple_GetItem(args, b + 3), names[b]);
+        if (!buffers[b]) {
+            return NULL;
+        }
+    }
+    if (PyArray_ITEMSIZE(buffers[1]) == sizeof(double)) {
+        PyErr_SetString(PyExc_ValueError, "Action tensor passed as float64 (pass np.float32 buffer)");
+        return NULL;
+    }
+
+    Env* source = vec->envs[env_index];
+    int agents = source->active_agent_count;
+    for (int b = 0; b < 5; b++) {
+        if (PyArray_DIM(buffers[b], 0) < (npy_intp)agents*num_forks) {
+            PyErr_Format(PyExc_ValueError, "%s needs %d rows for %d forks of %d agents",
+                names[b], agents*num_forks, num_forks, agents);
+            return NULL;
+        }
+    }
+
+    VecEnv* forks = (VecEnv*)calloc(1, sizeof(VecEnv));
+    forks->num_envs = num_forks;
+    forks->envs = (Env**)calloc(num_forks, sizeof(Env*));
+    Py_BEGIN_ALLOW_THREADS
+    vec_async_drain(vec);
+    for (int i = 0; i < num_forks; i++) {
+        Env* env = (Env*)calloc(1, sizeof(Env));
+        forks->envs[i] = env;
+        int row = i*agents;
+        env->observations = (void*)((char*)PyArray_DATA(buffers[0]) + row*PyArray_STRIDE(buffers[0], 0));
+        env->actions = (void*)((char*)PyArray_DATA(buffers[1]) + row*PyArray_STRIDE(buffers[1], 0));
+        env->rewards = (void*)((char*)PyArray_DATA(buffers[2]) + row*PyArray_STRIDE(buffers[2], 0));
+        env->terminals = (void*)((char*)PyArray_DATA(buffers[3]) + row*PyArray_STRIDE(buffers[3], 0));
+        fork_env(source, env);
+    }
+    Py_END_ALLOW_THREADS
+    return PyLong_FromVoidPtr(forks);
+}
+
+static void vec_record_stop(VecEnv* vec) {
+    for (int i = 0; i < vec->num_envs; i++) {
+        if (vec->envs[i]->recorder) {
+            recorder_release(vec->envs[i]->recorder);
+            vec->envs[i]->recorder = NULL;
+        }
+    }
+}
+
+// Attaches every env of vec to rec. Returns -1 if the agent count differs
+// from the recording's.
+static int vec_record_attach_envs(VecEnv* vec, TrajectoryRecorder* rec) {
+    int* agents = (int*)malloc(vec->num_envs*sizeof(int));
+    for (int i = 0; i < vec->num_envs; i++) {
+        agents[i] = vec->envs[i]->active_agent_count;
+    }
+    int status = recorder_attach(rec, vec->num_envs, agents);
+    free(agents);
+    for (int i = 0; status == 0 && i < vec->num_envs; i++) {
+        vec->envs[i]->recorder = rec;
+        vec->envs[i]->recorder_index = i;
+    }
+    return status;
+}
+
+// vec_record(vec, path, chunk_steps=32)
+// Starts recording every step of every env to path, see recorder.h, and
+// stops any recording already running. Pass None as path to just stop.
+// Stopping, or closing the vec env, flushes the file; use
+// vec_record_detach and vec_record_attach to carry a recording over to a
+// new vec env instead.
+static PyObject* vec_record(PyObject* self, PyObject* args) {
+    int num_args = PyTuple_Size(args);
+    if (num_args != 2 && num_args != 3) {
+        PyErr_SetString(PyExc_TypeError, "vec_record requires 2 or 3 arguments");
+        return NULL;
+    }
+    VecEnv* vec = unpack_vecenv(args);
+    if (!vec) {
+        return NULL;
+    }
+    PyObject* path_arg = PyTuple_GetItem(args, 1);
+    const char* path = NULL;
+    if (path_arg != Py_None) {
+        path = PyUnicode_AsUTF8(path_arg);
+        if (!path) {
+            return NULL;
+        }
+    }
+    int chunk_steps = 32;
+    if (num_args == 3) {
+        chunk_steps = PyLong_AsLong(PyTuple_GetItem(args, 2));
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+        if (chunk_steps <= 0) {
+            PyErr_SetString(PyExc_ValueError, "chunk_steps must be positive");
+            return NULL;
+        }
+    }
+
+    TrajectoryRecorder* rec = NULL;
+    Py_BEGIN_ALLOW_THREADS
+    vec_async_drain(vec);
+    vec_record_stop(vec);
+    if (path != NULL) {
+        int num_agents = 0;
+        for (int i = 0; i < vec->num_envs; i++) {
+            num_agents += vec->envs[i]->active_agent_count;
+        }
+        Env* env = vec->envs[0];
+        rec = recorder_open(path, num_agents, get_obs_size(env), 2, env->action_type == 1, chunk_steps);
+        if (rec != NULL) {
+            vec_record_attach_envs(vec, rec);
+            recorder_release(rec);
+        }
+    }
+    Py_END_ALLOW_THREADS
+    if (path != NULL && rec == NULL) {
+        PyErr_Format(PyExc_OSError, "Could not open %s for recording", path);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+// vec_record_detach(vec)
+// Stops vec's envs recording but keeps the file open. Returns a handle for
+// vec_record_attach, or None if vec is not recording.
+static PyObject* vec_record_detach(PyObject* self, PyObject* args) {
+    if (PyTuple_Size(args) != 1) {
+        PyErr_SetString(PyExc_TypeError, "vec_record_detach requires 1 argument");
+        return NULL;
+    }
+    VecEnv* vec = unpack_vecenv(args);
+    if (!vec) {
+        return NULL;
+    }
+    TrajectoryRecorder* rec = NULL;
+    Py_BEGIN_ALLOW_THREADS
+    vec_async_drain(vec);
+    rec = vec->envs[0]->recorder;
+    if (rec != NULL) {
+        recorder_hold(rec);
+        vec_record_stop(vec);
+    }
+    Py_END_ALLOW_THREADS
+    if (rec == NULL) {
+        Py_RETURN_NONE;
+    }
+    return PyLong_FromVoidPtr(rec);
+}
+
+// vec_record_attach(vec, handle)
+// Continues a recording from vec_record_detach on vec's envs and consumes
+// the handle. vec must have the same total agent count; if it doesn't, the
+// recording is closed with a warning.
+static PyObject* vec_record_attach(PyObject* self, PyObject* args) {
+    if (PyTuple_Size(args) != 2) {
+        PyErr_SetString(PyExc_TypeError, "vec_record_attach requires 2 arguments");
+        return NULL;
+    }
+    VecEnv* vec = unpack_vecenv(args);
+    if (!vec) {
+        return NULL;
+    }
+    TrajectoryRecorder* rec = (TrajectoryRecorder*)PyLong_AsVoidPtr(PyTuple_GetItem(args, 1));
+    if (!rec) {
+        if (!PyErr_Occurred()) {
+            PyErr_SetString(PyExc_ValueError, "Invalid recording handle");
+        }
+        return NULL;
+    }
+    int status;
+    Py_BEGIN_ALLOW_THREADS
+    vec_async_drain(vec);
+    vec_record_stop(vec);
+    status = vec_record_attach_envs(vec, rec);
+    // Drops the detach hold; closes the file if nothing was attached
+    recorder_release(rec);
+    Py_END_ALLOW_THREADS
+    if (status != 0) {
+        if (PyErr_WarnEx(PyExc_RuntimeWarning,
+                "Recording stopped: the new vec env has a different agent count", 1) < 0) {
+            return NULL;
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+// read_trajectories(path)
+// Returns a dict of observations (steps, agents, obs_size), actions
+// (steps, agents, action_size), rewards and terminals (steps, agents)
+static PyObject* read_trajectories(PyObject* self, PyObject* args) {
+    const char* path;
+    if (!PyArg_ParseTuple(args, "s", &path)) {
+        return NULL;
+    }
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, path);
+        return NULL;
+    }
+    RecorderHeader h;
+    long data_start = sizeof(RecorderHeader);
+    npy_intp steps = 0;
+    int max_chunk = 0;
+    int n = recorder_read_header(file, &h);
+    while (n == 0 && (n = recorder_read_chunk(file, &h, NULL, 0)) > 0) {
+        steps += n;
+        if (n > max_chunk) max_chunk = n;
+        n = 0;
+    }
+    if (n < 0) {
+        fclose(file);
+        PyErr_Format(PyExc_ValueError, "%s is not a complete vec_record file", path);
+        return NULL;
+    }
+
+    npy_intp agents = h.num_agents;
+    npy_intp obs_dims[3] = {steps, agents, h.obs_size};
+    npy_intp action_dims[3] = {steps, agents, h.action_size};
+    PyArrayObject* arrays[RECORDER_COLUMNS] = {
+        (PyArrayObject*)PyArray_SimpleNew(3, obs_dims, NPY_FLOAT32),
+        (PyArrayObject*)PyArray_SimpleNew(3, action_dims, h.float_actions ? NPY_FLOAT32 : NPY_INT32),
+        (PyArrayObject*)PyArray_SimpleNew(2, obs_dims, NPY_FLOAT32),
+        (PyArrayObject*)PyArray_SimpleNew(2, obs_dims, NPY_UINT8),
+    };
+    if (!arrays[0] || !arrays[1] || !arrays[2] || !arrays[3]) {
+        for (int col = 0; col < RECORDER_COLUMNS; col++) {
+            Py_XDECREF(arrays[col]);
+        }
+        fclose(file);
+        return NULL;
+    }
+    static const char* keys[RECORDER_COLUMNS] = {"observations", "actions", "rewards", "terminals"};
+    PyObject* dict = PyDict_New();
+    for (int col = 0; col < RECORDER_COLUMNS; col++) {
+        PyDict_SetItemString(dict, keys[col], (PyObject*)arrays[col]);
+        Py_DECREF(arrays[col]);
+    }
+
+    int failed = 0;
+    Py_BEGIN_ALLOW_THREADS
+    fseek(file, data_start, SEEK_SET);
+    npy_intp step = 0;
+    while (step < steps) {
+        void* columns[RECORDER_COLUMNS];
+        for (int col = 0; col < RECORDER_COLUMNS; col++) {
+            columns[col] = (char*)PyArray_DATA(arrays[col]) + step*PyArray_STRIDE(arrays[col], 0);
+        }
+        int chunk = recorder_read_chunk(file, &h, columns, max_chunk);
+        if (chunk <= 0) {
+            failed = 1;
+            break;
+        }
+        step += chunk;
+    }
+    fclose(file);
+    Py_END_ALLOW_THREADS
+    if (failed) {
+        Py_DECREF(dict);
+        PyErr_Format(PyExc_ValueError, "%s is not a complete vec_record file", path);
+        return NULL;
+    }
+    return dict;
+}
+
 static int my_log(PyObject* dict, Log* log) {
     assign_to_dict(dict, "n", log->n);
     assign_to_dict(dict, "offroad_rate", log->offroad_rate);
@@ -207,3 +885,58 @@ static int my_log(PyObject* dict, Log* log) {
     assign_to_dict(dict, "static_car_count", log->static_car_count);
     return 0;
 }
+
+static void my_log_merge(LogMerge* merged, Env* env) {
+    merge_log_histograms(&merged->histograms, &env->histograms);
+    clear_log_histograms(&env->histograms);
+#ifdef DRIVE_PROFILE
+    merge_step_profile(&merged->profile, &env->profile);
+    memset(&env->profile, 0, sizeof(StepProfile));
+#endif
+}
+
+static void assign_quantiles(PyObject* dict, const char* name, LogHistogram* h) {
+    if (h->count == 0) return;
+    static const float quantiles[3] = {0.5f, 0.9f, 0.99f};
+    static const char* suffixes[3] = {"p50", "p90", "p99"};
+    char key[64];
+    for (int i = 0; i < 3; i++) {
+        snprintf(key, sizeof(key), "%s_%s", name, suffixes[i]);
+        assign_to_dict(dict, key, log_histogram_quantile(h, quantiles[i]));
+    }
+}
+
+#ifdef DRIVE_PROFILE
+// Per env step averages since the last log call
+static void assign_phase(PyObject* dict, const char* name, PhaseTimer* t, long steps) {
+    char key[64];
+    snprintf(key, sizeof(key), "profile_%s_us", name);
+    assign_to_dict(dict, key, 1e6 * t->seconds / steps);
+    snprintf(key, sizeof(key), "profile_%s_cycles", name);
+    assign_to_dict(dict, key, (double)t->cycles / steps);
+}
+
+static void assign_profile(PyObject* dict, StepProfile* p) {
+    if (p->steps == 0) return;
+    assign_phase(dict, "dynamics", &p->dynamics, p->steps);
+    assign_phase(dict, "metrics", &p->metrics, p->steps);
+    assign_phase(dict, "collision", &p->collision, p->steps);
+    assign_phase(dict, "observations", &p->observations, p->steps);
+    assign_phase(dict, "logging", &p->logging, p->steps);
+    assign_phase(dict, "reset", &p->reset, p->steps);
+    assign_to_dict(dict, "profile_segments_scanned", (float)p->segments_scanned / p->steps);
+    assign_to_dict(dict, "profile_obb_tests", (float)p->obb_tests / p->steps);
+    assign_to_dict(dict, "profile_road_obs_truncated", (float)p->road_obs_truncated / p->steps);
+    assign_to_dict(dict, "profile_respawns", (float)p->respawns / p->steps);
+}
+#endif
+
+static int my_log_merged(PyObject* dict, LogMerge* merged) {
+    assign_quantiles(dict, "episode_return", &merged->histograms.episode_return);
+    assign_quantiles(dict, "avg_displacement_error", &merged->histograms.avg_displacement_error);
+    assign_quantiles(dict, "collision_time", &merged->histograms.collision_time);
+#ifdef DRIVE_PROFILE
+    assign_profile(dict, &merged->profile);
+#endif
+    return 0;
+}
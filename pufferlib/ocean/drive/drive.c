@@ -2,6 +2,7 @@
 #include <unistd.h>
 #include "drive.h"
 #include "puffernet.h"
+#include "raster.h"
 #include <sys/wait.h>
 #include <math.h>
 #include <raylib.h>
@@ -10,11 +11,67 @@
 #include <stdio.h>
 #include "error.h"
 
+// Frames buffered between rendering and the ffmpeg pipe
+#define VIDEO_RING_SIZE 4
+
+// Rendered frames go through a ring drained by a writer thread, so
+// rendering the next frame overlaps with ffmpeg consuming the last one.
+// Frame buffers cycle between the free list and the ring and are only
+// allocated once per recording.
 typedef struct {
     int pipefd[2];
     pid_t pid;
+    size_t frame_bytes;
+    unsigned char* free_frames[VIDEO_RING_SIZE];
+    int num_free;
+    unsigned char* ring[VIDEO_RING_SIZE];
+    int head;      // oldest frame not yet written
+    int count;
+    bool closing;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t writer;
 } VideoRecorder;
 
+static void* video_writer(void* arg) {
+    VideoRecorder* recorder = (VideoRecorder*)arg;
+    bool pipe_open = true;
+    pthread_mutex_lock(&recorder->lock);
+    while (true) {
+        while (recorder->count == 0 && !recorder->closing) {
+            pthread_cond_wait(&recorder->cond, &recorder->lock);
+        }
+        if (recorder->count == 0) {
+            break;
+        }
+        unsigned char* frame = recorder->ring[recorder->head];
+        pthread_mutex_unlock(&recorder->lock);
+
+        // Pipe writes may be partial; after a failure the rest are dropped
+        size_t written = 0;
+        while (pipe_open && written < recorder->frame_bytes) {
+            ssize_t n = write(recorder->pipefd[1], frame + written, recorder->frame_bytes - written);
+            if (n <= 0) {
+                fprintf(stderr, "Failed to write video frame\n");
+                pipe_open = false;
+                break;
+            }
+            written += n;
+        }
+
+        pthread_mutex_lock(&recorder->lock);
+        recorder->head = (recorder->head + 1) % VIDEO_RING_SIZE;
+        recorder->count--;
+        recorder->free_frames[recorder->num_free++] = frame;
+        pthread_cond_broadcast(&recorder->cond);
+    }
+    pthread_mutex_unlock(&recorder->lock);
+    return NULL;
+}
+
+// Starts ffmpeg encoding raw RGBA frames into output_filename. A .gif
+// output is encoded in one pass with a generated palette, so no
+// intermediate PNG frames are needed; anything else is encoded as H.264.
 bool OpenVideo(VideoRecorder *recorder, const char *output_filename, int width, int height) {
     if (pipe(recorder->pipefd) == -1) {
         fprintf(stderr, "Failed to create pipe\n");
@@ -29,40 +86,114 @@ bool OpenVideo(VideoRecorder *recorder, const char *output_filename, int width,
 
     char size_str[64];
     snprintf(size_str, sizeof(size_str), "%dx%d", width, height);
+    const char* ext = strrchr(output_filename, '.');
+    bool gif = ext != NULL && strcmp(ext, ".gif") == 0;
 
     if (recorder->pid == 0) { // Child process: run ffmpeg
         close(recorder->pipefd[1]);
         dup2(recorder->pipefd[0], STDIN_FILENO);
         close(recorder->pipefd[0]);
-        execlp("ffmpeg", "ffmpeg",
-               "-y",
-               "-f", "rawvideo",
-               "-pix_fmt", "rgba",
-               "-s", size_str,
-               "-r", "30",
-               "-i", "-",
-               "-c:v", "libx264",
-               "-pix_fmt", "yuv420p",
-               "-preset", "fast",
-               "-crf", "18",
-               "-loglevel", "error",
-               output_filename,
-               NULL);
+        if (gif) {
+            execlp("ffmpeg", "ffmpeg",
+                   "-y",
+                   "-f", "rawvideo",
+                   "-pix_fmt", "rgba",
+                   "-s", size_str,
+                   "-r", "30",
+                   "-i", "-",
+                   "-vf", "split[a][b];[a]palettegen[p];[b][p]paletteuse",
+                   "-loop", "0",
+                   "-loglevel", "error",
+                   output_filename,
+                   NULL);
+        } else {
+            execlp("ffmpeg", "ffmpeg",
+                   "-y",
+                   "-f", "rawvideo",
+                   "-pix_fmt", "rgba",
+                   "-s", size_str,
+                   "-r", "30",
+                   "-i", "-",
+                   "-c:v", "libx264",
+                   "-pix_fmt", "yuv420p",
+                   "-preset", "fast",
+                   "-crf", "18",
+                   "-loglevel", "error",
+                   output_filename,
+                   NULL);
+        }
         TraceLog(LOG_ERROR, "Failed to launch ffmpeg");
-        return false;
+        _exit(1);
     }
 
     close(recorder->pipefd[0]); // Close read end in parent
+
+    recorder->frame_bytes = (size_t)width * height * 4;
+    recorder->num_free = VIDEO_RING_SIZE;
+    for (int i = 0; i < VIDEO_RING_SIZE; i++) {
+        recorder->free_frames[i] = (unsigned char*)malloc(recorder->frame_bytes);
+    }
+    recorder->head = 0;
+    recorder->count = 0;
+    recorder->closing = false;
+    pthread_mutex_init(&recorder->lock, NULL);
+    pthread_cond_init(&recorder->cond, NULL);
+    pthread_create(&recorder->writer, NULL, video_writer, recorder);
     return true;
 }
 
+// Takes a free frame buffer, waiting for the writer if all are queued
+unsigned char* AcquireFrame(VideoRecorder *recorder) {
+    pthread_mutex_lock(&recorder->lock);
+    while (recorder->num_free == 0) {
+        pthread_cond_wait(&recorder->cond, &recorder->lock);
+    }
+    unsigned char* frame = recorder->free_frames[--recorder->num_free];
+    pthread_mutex_unlock(&recorder->lock);
+    return frame;
+}
+
+// Queues a filled frame from AcquireFrame for the writer thread
+void SubmitFrame(VideoRecorder *recorder, unsigned char* frame) {
+    pthread_mutex_lock(&recorder->lock);
+    recorder->ring[(recorder->head + recorder->count) % VIDEO_RING_SIZE] = frame;
+    recorder->count++;
+    pthread_cond_broadcast(&recorder->cond);
+    pthread_mutex_unlock(&recorder->lock);
+}
+
+// Queues the current screen. The GL readback itself is synchronous since
+// rlgl has no async pixel transfer; the pipe write happens on the writer.
 void WriteFrame(VideoRecorder *recorder, int width, int height) {
     unsigned char *screen_data = rlReadScreenPixels(width, height);
-    write(recorder->pipefd[1], screen_data, width * height * 4 * sizeof(*screen_data));
+    unsigned char *frame = AcquireFrame(recorder);
+    memcpy(frame, screen_data, recorder->frame_bytes);
     RL_FREE(screen_data);
+    SubmitFrame(recorder, frame);
 }
 
+// Renders env with the CPU rasterizer straight into a queued frame, for
+// runs without a GL context
+void WriteRasterFrame(VideoRecorder *recorder, Drive *env, RasterFrame *frame, int log_trajectories) {
+    unsigned char* pixels = frame->pixels;
+    frame->pixels = AcquireFrame(recorder);
+    raster_topdown(env, frame, log_trajectories);
+    SubmitFrame(recorder, frame->pixels);
+    frame->pixels = pixels;
+}
+
+// Drains queued frames, then waits for ffmpeg to finish the file
 void CloseVideo(VideoRecorder *recorder) {
+    pthread_mutex_lock(&recorder->lock);
+    recorder->closing = true;
+    pthread_cond_broadcast(&recorder->cond);
+    pthread_mutex_unlock(&recorder->lock);
+    pthread_join(recorder->writer, NULL);
+    for (int i = 0; i < VIDEO_RING_SIZE; i++) {
+        free(recorder->free_frames[i]);
+    }
+    pthread_mutex_destroy(&recorder->lock);
+    pthread_cond_destroy(&recorder->cond);
     close(recorder->pipefd[1]);
     waitpid(recorder->pid, NULL, 0);
 }
@@ -159,18 +290,128 @@ void renderAgentView(Drive* env, Client* client, int map_height, int obs_only, i
     EndDrawing();
 }
 
+// Persistent worker pool. thread_pool_run hands tasks [0, num_tasks) to the
+// workers and the calling thread, which claim them with an atomic counter,
+// and returns once every task is done. Tasks must be independent.
+// It only serves DriveNet inference in this binary; the Python binding steps
+// envs on VecAsync (env_binding.h) and never runs DriveNet, so the two pools
+// do not coexist in one process.
+typedef void (*PoolTask)(void* ctx, int task);
+
+typedef struct ThreadPool ThreadPool;
+struct ThreadPool {
+    int num_threads;  // including the calling thread
+    pthread_t* threads;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    int generation;
+    int running;
+    int next_task;
+    int num_tasks;
+    PoolTask task;
+    void* ctx;
+    int shutdown;
+};
+
+static void thread_pool_claim(ThreadPool* pool) {
+    int task;
+    while ((task = __atomic_fetch_add(&pool->next_task, 1, __ATOMIC_RELAXED)) < pool->num_tasks) {
+        pool->task(pool->ctx, task);
+    }
+}
+
+static void* thread_pool_worker(void* arg) {
+    ThreadPool* pool = (ThreadPool*)arg;
+    int seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (pool->generation == seen && !pool->shutdown) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        thread_pool_claim(pool);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->running--;
+        if (pool->running == 0) {
+            pthread_cond_broadcast(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+ThreadPool* make_thread_pool(int num_threads) {
+    ThreadPool* pool = (ThreadPool*)calloc(1, sizeof(ThreadPool));
+    pool->num_threads = num_threads < 1 ? 1 : num_threads;
+    pool->threads = (pthread_t*)calloc(pool->num_threads, sizeof(pthread_t));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (int t = 0; t < pool->num_threads - 1; t++) {
+        pthread_create(&pool->threads[t], NULL, thread_pool_worker, pool);
+    }
+    return pool;
+}
+
+void thread_pool_run(ThreadPool* pool, PoolTask task, void* ctx, int num_tasks) {
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->ctx = ctx;
+    pool->num_tasks = num_tasks;
+    pool->next_task = 0;
+    pool->running = pool->num_threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    thread_pool_claim(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running > 0) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void free_thread_pool(ThreadPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int t = 0; t < pool->num_threads - 1; t++) {
+        pthread_join(pool->threads[t], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool);
+}
+
 typedef struct DriveNet DriveNet;
 struct DriveNet {
     int num_agents;
+    int num_partners;  // partner slots per observation, the env's max_partner_observations
+    int obs_size;
+    ThreadPool* pool;  // NULL runs forward on the calling thread
     float* obs_self;
     float* obs_partner;
     float* obs_road;
-    float* partner_linear_output;
-    float* road_linear_output;
-    float* partner_layernorm_output;
-    float* road_layernorm_output;
-    float* partner_linear_output_two;
-    float* road_linear_output_two;
+    int* partner_counts;
+    int* road_counts;
+    float partner_padding[64];
+    float road_padding[64];
+    float* partner_packed_one;  // set encoder weights, packed once for _set_encoder_max
+    float* partner_packed_two;
+    float* road_packed_one;
+    float* road_packed_two;
     Linear* ego_encoder;
     Linear* road_encoder;
     Linear* partner_encoder;
@@ -193,44 +434,98 @@ struct DriveNet {
     Multidiscrete* multidiscrete;
 };
 
-DriveNet* init_drivenet(Weights* weights, int num_agents) {
+// Parameter count of the torch Drive policy with its LSTM, in export order
+int drivenet_num_weights(void) {
+    int hidden_size = 256;
+    int input_size = 64;
+    int encoder = input_size + 2*input_size + input_size*input_size + input_size;
+    int ego = 7*input_size + encoder;
+    int road = 13*input_size + encoder;
+    int partner = 7*input_size + encoder;
+    int shared = 3*input_size*hidden_size + hidden_size;
+    int heads = hidden_size*20 + 20 + hidden_size + 1;
+    int lstm = 4*hidden_size*(hidden_size + 256) + 2*4*256;
+    return ego + road + partner + shared + heads + lstm;
+}
+
+DriveNet* init_drivenet(Weights* weights, int num_agents, int num_partners) {
     DriveNet* net = calloc(1, sizeof(DriveNet));
     int hidden_size = 256;
     int input_size = 64;
 
     net->num_agents = num_agents;
+    net->num_partners = num_partners;
+    net->obs_size = 7 + num_partners*7 + MAX_ROAD_SEGMENT_OBSERVATIONS*7;
     net->obs_self = calloc(num_agents*7, sizeof(float)); // 7 features
-    net->obs_partner = calloc(num_agents*63*7, sizeof(float)); // 63 objects, 7 features
+    net->obs_partner = calloc(num_agents*num_partners*7, sizeof(float)); // num_partners objects, 7 features
     net->obs_road = calloc(num_agents*200*13, sizeof(float)); // 200 objects, 13 features
-    net->partner_linear_output = calloc(num_agents*63*input_size, sizeof(float));
-    net->road_linear_output = calloc(num_agents*200*input_size, sizeof(float));
-    net->partner_linear_output_two = calloc(num_agents*63*input_size, sizeof(float));
-    net->road_linear_output_two = calloc(num_agents*200*input_size, sizeof(float));
-    net->partner_layernorm_output = calloc(num_agents*63*input_size, sizeof(float));
-    net->road_layernorm_output = calloc(num_agents*200*input_size, sizeof(float));
+    net->partner_counts = calloc(num_agents, sizeof(int));
+    net->road_counts = calloc(num_agents, sizeof(int));
+    // Layers bind to the names of the torch Drive policy, which only
+    // checks the layout with checkpoints that carry a manifest
+    seek_weights(weights, "ego_encoder.0.weight");
     net->ego_encoder = make_linear(weights, num_agents, 7, input_size);
+    seek_weights(weights, "ego_encoder.1.weight");
     net->ego_layernorm = make_layernorm(weights, num_agents, input_size);
+    seek_weights(weights, "ego_encoder.2.weight");
     net->ego_encoder_two = make_linear(weights, num_agents, input_size, input_size);
+    seek_weights(weights, "road_encoder.0.weight");
     net->road_encoder = make_linear(weights, num_agents, 13, input_size);
+    seek_weights(weights, "road_encoder.1.weight");
     net->road_layernorm = make_layernorm(weights, num_agents, input_size);
+    seek_weights(weights, "road_encoder.2.weight");
     net->road_encoder_two = make_linear(weights, num_agents, input_size, input_size);
+    seek_weights(weights, "partner_encoder.0.weight");
     net->partner_encoder = make_linear(weights, num_agents, 7, input_size);
+    seek_weights(weights, "partner_encoder.1.weight");
     net->partner_layernorm = make_layernorm(weights, num_agents, input_size);
+    seek_weights(weights, "partner_encoder.2.weight");
     net->partner_encoder_two = make_linear(weights, num_agents, input_size, input_size);
-    net->partner_max = make_max_dim1(num_agents, 63, input_size);
+    net->partner_max = make_max_dim1(num_agents, num_partners, input_size);
     net->road_max = make_max_dim1(num_agents, 200, input_size);
     net->cat1 = make_cat_dim1(num_agents, input_size, input_size);
     net->cat2 = make_cat_dim1(num_agents, input_size + input_size, input_size);
     net->gelu = make_gelu(num_agents, 3*input_size);
+    seek_weights(weights, "shared_embedding.1.weight");
     net->shared_embedding = make_linear(weights, num_agents, input_size*3, hidden_size);
     net->relu = make_relu(num_agents, hidden_size);
+    seek_weights(weights, "actor.weight");
     net->actor = make_linear(weights, num_agents, hidden_size, 20);
+    seek_weights(weights, "value_fn.weight");
     net->value_fn = make_linear(weights, num_agents, hidden_size, 1);
+    seek_weights(weights, "lstm.weight_ih_l0");
     net->lstm = make_lstm(weights, num_agents, hidden_size, 256);
     memset(net->lstm->state_h, 0, num_agents*256*sizeof(float));
     memset(net->lstm->state_c, 0, num_agents*256*sizeof(float));
     int logit_sizes[2] = {7, 13};
     net->multidiscrete = make_multidiscrete(num_agents, logit_sizes, 2);
+
+    size_t packed_one = _packed_weights_size(7, input_size);
+    size_t packed_road_one = _packed_weights_size(13, input_size);
+    size_t packed_two = _packed_weights_size(input_size, input_size);
+    net->partner_packed_one = calloc(packed_one + packed_road_one + 2*packed_two, sizeof(float));
+    net->partner_packed_two = net->partner_packed_one + packed_one;
+    net->road_packed_one = net->partner_packed_two + packed_two;
+    net->road_packed_two = net->road_packed_one + packed_road_one;
+    _pack_weights(net->partner_encoder->weights, net->partner_packed_one, 7, input_size);
+    _pack_weights(net->partner_encoder_two->weights, net->partner_packed_two, input_size, input_size);
+    _pack_weights(net->road_encoder->weights, net->road_packed_one, 13, input_size);
+    _pack_weights(net->road_encoder_two->weights, net->road_packed_two, input_size, input_size);
+
+    // Empty partner slots are all zeros; empty road slots are zeros with
+    // road type 0, which one-hot encodes to a 1 in feature 6. Their
+    // encodings only depend on the weights, so compute them once here.
+    float partner_pad[7] = {0};
+    float road_pad[13] = {0};
+    road_pad[6] = 1.0f;
+    _set_encoder_max(partner_pad, net->partner_packed_one, net->partner_encoder->bias,
+            net->partner_layernorm->weights, net->partner_layernorm->bias,
+            net->partner_packed_two, net->partner_encoder_two->bias,
+            net->partner_padding, 1, 1, 7, input_size, NULL, NULL);
+    _set_encoder_max(road_pad, net->road_packed_one, net->road_encoder->bias,
+            net->road_layernorm->weights, net->road_layernorm->bias,
+            net->road_packed_two, net->road_encoder_two->bias,
+            net->road_padding, 1, 1, 13, input_size, NULL, NULL);
     return net;
 }
 
@@ -238,12 +533,9 @@ void free_drivenet(DriveNet* net) {
     free(net->obs_self);
     free(net->obs_partner);
     free(net->obs_road);
-    free(net->partner_linear_output);
-    free(net->road_linear_output);
-    free(net->partner_linear_output_two);
-    free(net->road_linear_output_two);
-    free(net->partner_layernorm_output);
-    free(net->road_layernorm_output);
+    free(net->partner_counts);
+    free(net->road_counts);
+    free(net->partner_packed_one);
     free(net->ego_encoder);
     free(net->road_encoder);
     free(net->partner_encoder);
@@ -264,38 +556,56 @@ void free_drivenet(DriveNet* net) {
     free(net->actor);
     free(net->value_fn);
     free(net->lstm);
+    if (net->pool != NULL) {
+        free_thread_pool(net->pool);
+    }
     free(net);
 }
 
-void forward(DriveNet* net, float* observations, int* actions) {
-    // Clear previous observations
-    memset(net->obs_self, 0, net->num_agents * 7 * sizeof(float));
-    memset(net->obs_partner, 0, net->num_agents * 63 * 7 * sizeof(float));
-    memset(net->obs_road, 0, net->num_agents * 200 * 13 * sizeof(float));
+// Slots are filled front to back by compute_observations, so everything
+// after the last non-zero row is padding
+static int count_valid_rows(float* rows, int num_rows, int row_size) {
+    for (int i = num_rows - 1; i >= 0; i--) {
+        for (int j = 0; j < row_size; j++) {
+            if (rows[i*row_size + j] != 0.0f) return i + 1;
+        }
+    }
+    return 0;
+}
 
-    // Reshape observations into 2D boards and additional features
+// Every buffer in DriveNet is per agent up to and including the LSTM, so
+// agents [start, start + count) run on their own rows of each layer and
+// threads can split the batch without sharing scratch
+static void forward_agents(DriveNet* net, float* observations, int* actions, int start, int count) {
+    // Reshape observations into 2D boards and additional features. Padded
+    // slots are never read, so only the live objects are copied.
     float (*obs_self)[7] = (float (*)[7])net->obs_self;
-    float (*obs_partner)[63][7] = (float (*)[63][7])net->obs_partner;
+    int num_partners = net->num_partners;
+    float (*obs_partner)[num_partners][7] = (float (*)[num_partners][7])net->obs_partner;
     float (*obs_road)[200][13] = (float (*)[200][13])net->obs_road;
 
-    for (int b = 0; b < net->num_agents; b++) {
-        int b_offset = b * (7 + 63*7 + 200*7);  // offset for each batch
+    for (int b = start; b < start + count; b++) {
+        int b_offset = b * net->obs_size;  // offset for each batch
         int partner_offset = b_offset + 7;
-        int road_offset = b_offset + 7 + 63*7;
+        int road_offset = b_offset + 7 + num_partners*7;
         // Process self observation
         for(int i = 0; i < 7; i++) {
             obs_self[b][i] = observations[b_offset + i];
         }
 
         // Process partner observation
-        for(int i = 0; i < 63; i++) {
+        int live_partners = count_valid_rows(&observations[partner_offset], num_partners, 7);
+        net->partner_counts[b] = live_partners;
+        for(int i = 0; i < live_partners; i++) {
             for(int j = 0; j < 7; j++) {
                 obs_partner[b][i][j] = observations[partner_offset + i*7 + j];
             }
         }
 
         // Process road observation
-        for(int i = 0; i < 200; i++) {
+        int num_roads = count_valid_rows(&observations[road_offset], 200, 7);
+        net->road_counts[b] = num_roads;
+        for(int i = 0; i < num_roads; i++) {
             for(int j = 0; j < 7; j++) {
                 obs_road[b][i][j] = observations[road_offset + i*7 + j];
             }
@@ -310,78 +620,90 @@ void forward(DriveNet* net, float* observations, int* actions) {
     }
 
     // Forward pass through the network
-    linear(net->ego_encoder, net->obs_self);
-    layernorm(net->ego_layernorm, net->ego_encoder->output);
-    linear(net->ego_encoder_two, net->ego_layernorm->output);
-    for (int b = 0; b < net->num_agents; b++) {
-        for (int obj = 0; obj < 63; obj++) {
-            // Get the 7 features for this object
-            float* obj_features = &net->obs_partner[b*63*7 + obj*7];
-            // Apply linear layer to this object
-            _linear(obj_features, net->partner_encoder->weights, net->partner_encoder->bias,
-                   &net->partner_linear_output[b*63*64 + obj*64], 1, 7, 64);
-        }
-    }
+    int input_size = 64;
+    linear_rows(net->ego_encoder, net->obs_self, start, count);
+    _layernorm(net->ego_encoder->output + start*input_size, net->ego_layernorm->weights,
+            net->ego_layernorm->bias, net->ego_layernorm->output + start*input_size,
+            count, input_size);
+    linear_rows(net->ego_encoder_two, net->ego_layernorm->output, start, count);
+
+    // Partner and road objects share encoder weights, so each set runs
+    // through one fused linear -> layernorm -> linear -> max pass over its
+    // live objects, with the padding encoding folded into the max
+    _set_encoder_max(net->obs_partner + start*num_partners*7, net->partner_packed_one, net->partner_encoder->bias,
+            net->partner_layernorm->weights, net->partner_layernorm->bias,
+            net->partner_packed_two, net->partner_encoder_two->bias,
+            net->partner_max->output + start*input_size, count, num_partners, 7, input_size,
+            net->partner_counts + start, net->partner_padding);
+    _set_encoder_max(net->obs_road + start*200*13, net->road_packed_one, net->road_encoder->bias,
+            net->road_layernorm->weights, net->road_layernorm->bias,
+            net->road_packed_two, net->road_encoder_two->bias,
+            net->road_max->output + start*input_size, count, 200, 13, input_size,
+            net->road_counts + start, net->road_padding);
+    _cat_dim1(net->ego_encoder_two->output + start*input_size, net->road_max->output + start*input_size,
+            net->cat1->output + start*2*input_size, count, input_size, input_size);
+    _cat_dim1(net->cat1->output + start*2*input_size, net->partner_max->output + start*input_size,
+            net->cat2->output + start*3*input_size, count, 2*input_size, input_size);
+    _gelu(net->cat2->output + start*3*input_size, net->gelu->output + start*3*input_size,
+            count*3*input_size);
+    linear_rows(net->shared_embedding, net->gelu->output, start, count);
+    _relu(net->shared_embedding->output + start*256, net->relu->output + start*256, count*256);
+    lstm_rows(net->lstm, net->relu->output, start, count);
+    linear_rows(net->actor, net->lstm->state_h, start, count);
+    linear_rows(net->value_fn, net->lstm->state_h, start, count);
+
+    // Sample actions from the actor logits. Draws are keyed by agent index,
+    // so the result does not depend on how agents are split across threads.
+    Multidiscrete* multidiscrete = net->multidiscrete;
+    _sample_multidiscrete(net->actor->output + start*20, actions + start*2, count,
+            multidiscrete->logit_sizes, multidiscrete->num_actions, multidiscrete->seed,
+            multidiscrete->step, start, multidiscrete->gumbel);
+}
 
-    for (int b = 0; b < net->num_agents; b++) {
-        for (int obj = 0; obj < 63; obj++) {
-            float* after_first = &net->partner_linear_output[b*63*64 + obj*64];
-            _layernorm(after_first, net->partner_layernorm->weights, net->partner_layernorm->bias,
-                        &net->partner_layernorm_output[b*63*64 + obj*64], 1, 64);
-        }
-    }
-    for (int b = 0; b < net->num_agents; b++) {
-        for (int obj = 0; obj < 63; obj++) {
-            // Get the 7 features for this object
-            float* obj_features = &net->partner_layernorm_output[b*63*64 + obj*64];
-            // Apply linear layer to this object
-            _linear(obj_features, net->partner_encoder_two->weights, net->partner_encoder_two->bias,
-                   &net->partner_linear_output_two[b*63*64 + obj*64], 1, 64, 64);
+typedef struct {
+    DriveNet* net;
+    float* observations;
+    int* actions;
+    int agents_per_task;
+} ForwardTask;
+
+static void forward_task(void* ctx, int task) {
+    ForwardTask* args = (ForwardTask*)ctx;
+    int start = task*args->agents_per_task;
+    int count = args->net->num_agents - start;
+    if (count > args->agents_per_task) count = args->agents_per_task;
+    forward_agents(args->net, args->observations, args->actions, start, count);
+}
 
-        }
+// Uses num_threads threads (including the caller) for forward
+void drivenet_set_threads(DriveNet* net, int num_threads) {
+    if (net->pool != NULL) {
+        free_thread_pool(net->pool);
+        net->pool = NULL;
     }
-
-    // Process road objects: apply linear to each object individually
-    for (int b = 0; b < net->num_agents; b++) {
-        for (int obj = 0; obj < 200; obj++) {
-            // Get the 13 features for this object
-            float* obj_features = &net->obs_road[b*200*13 + obj*13];
-            // Apply linear layer to this object
-            _linear(obj_features, net->road_encoder->weights, net->road_encoder->bias,
-                   &net->road_linear_output[b*200*64 + obj*64], 1, 13, 64);
-        }
+    if (num_threads > 1) {
+        net->pool = make_thread_pool(num_threads);
     }
+}
 
-    // Apply layer norm and second linear to each road object
-    for (int b = 0; b < net->num_agents; b++) {
-        for (int obj = 0; obj < 200; obj++) {
-            float* after_first = &net->road_linear_output[b*200*64 + obj*64];
-            _layernorm(after_first, net->road_layernorm->weights, net->road_layernorm->bias,
-                        &net->road_layernorm_output[b*200*64 + obj*64], 1, 64);
-        }
-    }
-    for (int b = 0; b < net->num_agents; b++) {
-        for (int obj = 0; obj < 200; obj++) {
-            float* after_first = &net->road_layernorm_output[b*200*64 + obj*64];
-            _linear(after_first, net->road_encoder_two->weights, net->road_encoder_two->bias,
-                    &net->road_linear_output_two[b*200*64 + obj*64], 1, 64, 64);
-        }
+void forward(DriveNet* net, float* observations, int* actions) {
+    if (net->pool == NULL || net->num_agents < 2) {
+        forward_agents(net, observations, actions, 0, net->num_agents);
+    } else {
+        // One contiguous block of agents per thread
+        int num_threads = net->pool->num_threads;
+        ForwardTask args = {
+            .net = net,
+            .observations = observations,
+            .actions = actions,
+            .agents_per_task = (net->num_agents + num_threads - 1)/num_threads,
+        };
+        int num_tasks = (net->num_agents + args.agents_per_task - 1)/args.agents_per_task;
+        thread_pool_run(net->pool, forward_task, &args, num_tasks);
     }
-
-    max_dim1(net->partner_max, net->partner_linear_output_two);
-    max_dim1(net->road_max, net->road_linear_output_two);
-    cat_dim1(net->cat1, net->ego_encoder_two->output, net->road_max->output);
-    cat_dim1(net->cat2, net->cat1->output, net->partner_max->output);
-    gelu(net->gelu, net->cat2->output);
-    linear(net->shared_embedding, net->gelu->output);
-    relu(net->relu, net->shared_embedding->output);
-    lstm(net->lstm, net->relu->output);
-    linear(net->actor, net->lstm->state_h);
-    linear(net->value_fn, net->lstm->state_h);
-
-    // Get action by taking argmax of actor output
-    softmax_multidiscrete(net->multidiscrete, net->actor->output, actions);
+    net->multidiscrete->step++;
 }
+
 void demo() {
 
     Drive env = {
@@ -397,8 +719,8 @@ void demo() {
     allocate(&env);
     c_reset(&env);
     c_render(&env);
-    Weights* weights = load_weights("resources/drive/puffer_drive_weights.bin", 595925);
-    DriveNet* net = init_drivenet(weights, env.active_agent_count);
+    Weights* weights = load_weights("resources/drive/puffer_drive_weights.bin", drivenet_num_weights());
+    DriveNet* net = init_drivenet(weights, env.active_agent_count, env.max_partner_observations);
     //Client* client = make_client(&env);
     int accel_delta = 2;
     int steer_delta = 4;
@@ -448,38 +770,14 @@ void demo() {
     close_client(env.client);
     free_allocated(&env);
     free_drivenet(net);
-    free(weights);
+    free_weights(weights);
 }
 
 
-static int run_cmd(const char *cmd) {
-    int rc = system(cmd);
-    if (rc != 0) {
-        fprintf(stderr, "[ffmpeg] command failed (%d): %s\n", rc, cmd);
-    }
-    return rc;
-}
-
-// Make a high-quality GIF from numbered PNG frames like frame_000.png
-static int make_gif_from_frames(const char *pattern, int fps,
-                                const char *palette_path,
-                                const char *out_gif) {
-    char cmd[1024];
-
-    // 1) Generate palette (no quotes needed for simple filter)
-    //    NOTE: if your frames start at 000, you don't need -start_number.
-    snprintf(cmd, sizeof(cmd),
-             "ffmpeg -y -framerate %d -i %s -vf palettegen %s",
-             fps, pattern, palette_path);
-    if (run_cmd(cmd) != 0) return -1;
-
-    // 2) Use palette to encode the GIF
-    snprintf(cmd, sizeof(cmd),
-             "ffmpeg -y -framerate %d -i %s -i %s -lavfi paletteuse -loop 0 %s",
-             fps, pattern, palette_path, out_gif);
-    if (run_cmd(cmd) != 0) return -1;
-
-    return 0;
+static double benchmark_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + 1e-9*(double)t.tv_nsec;
 }
 
 int eval_gif(const char* map_name,
@@ -493,7 +791,11 @@ int eval_gif(const char* map_name,
              int init_steps,
              int control_all_agents,
              int policy_agents_per_env,
-             int deterministic_selection) {
+             int deterministic_selection,
+             const char* int8_weights,
+             int inference_threads,
+             int headless,
+             int gif) {
 
     // Use default if no map provided
     if (map_name == NULL) {
@@ -536,10 +838,6 @@ int eval_gif(const char* map_name,
     Client* client = (Client*)calloc(1, sizeof(Client));
     env.client = client;
 
-    SetConfigFlags(FLAG_WINDOW_HIDDEN);
-
-    SetTargetFPS(6000);
-
     float map_width = env.grid_map->bottom_right_x - env.grid_map->top_left_x;
     float map_height = env.grid_map->top_left_y - env.grid_map->bottom_right_y;
 
@@ -549,12 +847,31 @@ int eval_gif(const char* map_name,
     // Calculate video width and height; round to nearest even number
     int img_width = (int)roundf(map_width * scale / 2.0f) * 2;
     int img_height = (int)roundf(map_height * scale / 2.0f) * 2;
-    InitWindow(img_width, img_height, "Puffer Drive");
-    SetConfigFlags(FLAG_MSAA_4X_HINT);
+    // Headless runs draw with the CPU rasterizer and never open a window
+    RasterFrame* raster = NULL;
+    if (headless) {
+        raster = make_raster_frame(&env, scale, NULL);
+    } else {
+        SetConfigFlags(FLAG_WINDOW_HIDDEN);
+        SetTargetFPS(6000);
+        InitWindow(img_width, img_height, "Puffer Drive");
+        SetConfigFlags(FLAG_MSAA_4X_HINT);
+    }
 
-    // Load cpt into network
-    Weights* weights = load_weights("resources/drive/puffer_drive_weights.bin", 595925);
-    DriveNet* net = init_drivenet(weights, env.active_agent_count);
+    // Load cpt into network. An int8 checkpoint from `puffer quantize`
+    // runs the linear and LSTM layers on the int8 kernels.
+    Weights* weights = NULL;
+    if (int8_weights != NULL) {
+        weights = load_weights_int8(int8_weights);
+        if (weights == NULL) {
+            if (!headless) CloseWindow();
+            return -1;
+        }
+    } else {
+        weights = load_weights("resources/drive/puffer_drive_weights.bin", drivenet_num_weights());
+    }
+    DriveNet* net = init_drivenet(weights, env.active_agent_count, env.max_partner_observations);
+    drivenet_set_threads(net, inference_threads);
 
     int frame_count = TRAJECTORY_LENGTH - init_steps;
     char filename[256];
@@ -564,13 +881,17 @@ int eval_gif(const char* map_name,
 
     // Create video recorders
     VideoRecorder topdown_recorder;
-    if (!OpenVideo(&topdown_recorder, "resources/drive/output_topdown.mp4", img_width, img_height)) {
-        CloseWindow();
+    // GIFs are encoded directly from the frame pipe, in a single ffmpeg pass
+    const char* video_ext = gif ? "gif" : "mp4";
+    char video_path[256];
+    snprintf(video_path, sizeof(video_path), "resources/drive/output_topdown.%s", video_ext);
+    if (!OpenVideo(&topdown_recorder, video_path, img_width, img_height)) {
+        if (!headless) CloseWindow();
         return -1;
     }
 
     int rendered_frames = 0;
-    double startTime = GetTime();
+    double startTime = benchmark_now();
 
     // Generate top-down view video
     printf("Recording top-down view...\n");
@@ -578,8 +899,12 @@ int eval_gif(const char* map_name,
     for(int i = 0; i < frame_count; i++) {
         // Only render every frame_skip frames
         if (i % frame_skip == 0) {
-            renderTopDownView(&env, client, map_height, 0, 0, 0, frame_count, NULL, log_trajectories, show_grid);
-            WriteFrame(&topdown_recorder, img_width, img_height);
+            if (headless) {
+                WriteRasterFrame(&topdown_recorder, &env, raster, log_trajectories);
+            } else {
+                renderTopDownView(&env, client, map_height, 0, 0, 0, frame_count, NULL, log_trajectories, show_grid);
+                WriteFrame(&topdown_recorder, img_width, img_height);
+            }
             rendered_frames++;
         }
 
@@ -592,13 +917,15 @@ int eval_gif(const char* map_name,
     c_reset(&env);
     CloseVideo(&topdown_recorder);
 
+    // The agent view is a 3D scene and needs raylib, so headless runs stop here
     VideoRecorder agent_recorder;
-    if (!OpenVideo(&agent_recorder, "resources/drive/output_agent.mp4", img_width, img_height)) {
+    snprintf(video_path, sizeof(video_path), "resources/drive/output_agent.%s", video_ext);
+    if (!headless && !OpenVideo(&agent_recorder, video_path, img_width, img_height)) {
         CloseWindow();
         return -1;
     }
 
-    for(int i = 0; i < frame_count; i++) {
+    for(int i = 0; i < frame_count && !headless; i++) {
 
         if (i % frame_skip == 0) {
             renderAgentView(&env, client, map_height, obs_only, lasers, show_grid);
@@ -611,7 +938,7 @@ int eval_gif(const char* map_name,
             c_step(&env);
     }
 
-    double endTime = GetTime();
+    double endTime = benchmark_now();
     double elapsedTime = endTime - startTime;
     double writeFPS = (elapsedTime > 0) ? rendered_frames / elapsedTime : 0;
 
@@ -619,52 +946,525 @@ int eval_gif(const char* map_name,
            rendered_frames, elapsedTime, writeFPS);
 
     // Close video recorders
-    CloseVideo(&agent_recorder);
-    CloseWindow();
+    if (headless) {
+        free_raster_frame(raster);
+    } else {
+        CloseVideo(&agent_recorder);
+        unload_road_layer(client);
+        CloseWindow();
+    }
 
     // Clean up resources
     free(client);
     free_allocated(&env);
     free_drivenet(net);
-    free(weights);
+    free_weights(weights);
+    return 0;
+}
+
+typedef struct {
+    const char* maps[64];
+    int num_maps;
+    int num_agents;
+    int num_threads;
+    int envs_per_thread;
+    double warmup;
+    double duration;
+    int repeats;
+    const char* csv_path;
+    const char* json_path;
+    const char* label;
+} BenchmarkConfig;
+
+typedef struct {
+    Drive* envs;
+    int num_envs;
+    unsigned int seed;
+    double run_for;
+    double seconds;
+    long env_steps;
+    long agent_steps;
+} BenchmarkWorker;
+
+typedef struct {
+    double seconds;
+    long env_steps;
+    long agent_steps;
+    double sps;
+    StepProfile profile;
+} BenchmarkRun;
+
+static void* benchmark_worker(void* arg) {
+    BenchmarkWorker* w = (BenchmarkWorker*)arg;
+    w->env_steps = 0;
+    w->agent_steps = 0;
+    double start = benchmark_now();
+    double now = start;
+    while (now - start < w->run_for) {
+        for (int e = 0; e < w->num_envs; e++) {
+            Drive* env = &w->envs[e];
+            int (*actions)[2] = (int(*)[2])env->actions;
+            for (int j = 0; j < env->active_agent_count; j++) {
+                actions[j][0] = rand_r(&w->seed) % 7;
+                actions[j][1] = rand_r(&w->seed) % 13;
+            }
+            c_step(env);
+            w->agent_steps += env->active_agent_count;
+        }
+        w->env_steps += w->num_envs;
+        now = benchmark_now();
+    }
+    w->seconds = now - start;
+    return NULL;
+}
+
+// Runs every worker for run_for seconds on its own thread and sums the results
+static void benchmark_pass(BenchmarkWorker* workers, int num_threads, double run_for, BenchmarkRun* run) {
+    pthread_t* threads = (pthread_t*)calloc(num_threads, sizeof(pthread_t));
+    for (int t = 0; t < num_threads; t++) {
+        workers[t].run_for = run_for;
+        for (int e = 0; e < workers[t].num_envs; e++) {
+            memset(&workers[t].envs[e].profile, 0, sizeof(StepProfile));
+        }
+        pthread_create(&threads[t], NULL, benchmark_worker, &workers[t]);
+    }
+    memset(run, 0, sizeof(BenchmarkRun));
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+        if (workers[t].seconds > run->seconds) run->seconds = workers[t].seconds;
+        run->env_steps += workers[t].env_steps;
+        run->agent_steps += workers[t].agent_steps;
+        for (int e = 0; e < workers[t].num_envs; e++) {
+            merge_step_profile(&run->profile, &workers[t].envs[e].profile);
+        }
+    }
+    run->sps = run->seconds > 0 ? run->agent_steps / run->seconds : 0;
+    free(threads);
+}
+
+// Phase time in microseconds per env step
+static double per_step_us(double seconds, long steps) {
+    return steps > 0 ? 1e6*seconds/steps : 0.0;
+}
+
+static void benchmark_write_csv(const BenchmarkConfig* cfg, BenchmarkRun* runs) {
+    // Append so results from successive commits accumulate in one file
+    int write_header = access(cfg->csv_path, F_OK) != 0;
+    FILE* f = fopen(cfg->csv_path, "a");
+    if (f == NULL) {
+        fprintf(stderr, "Error: could not open %s for writing\n", cfg->csv_path);
+        return;
+    }
+    if (write_header) {
+        fprintf(f, "label,repeat,maps,agents,threads,envs,seconds,env_steps,agent_steps,sps,"
+                "dynamics_us,metrics_us,collision_us,observations_us,logging_us,reset_us\n");
+    }
+    for (int r = 0; r < cfg->repeats; r++) {
+        BenchmarkRun* run = &runs[r];
+        long steps = run->profile.steps;
+        fprintf(f, "%s,%d,%d,%d,%d,%d,%.6f,%ld,%ld,%.1f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                cfg->label, r, cfg->num_maps, cfg->num_agents, cfg->num_threads,
+                cfg->num_threads*cfg->envs_per_thread, run->seconds,
+                run->env_steps, run->agent_steps, run->sps,
+                per_step_us(run->profile.dynamics.seconds, steps),
+                per_step_us(run->profile.metrics.seconds, steps),
+                per_step_us(run->profile.collision.seconds, steps),
+                per_step_us(run->profile.observations.seconds, steps),
+                per_step_us(run->profile.logging.seconds, steps),
+                per_step_us(run->profile.reset.seconds, steps));
+    }
+    fclose(f);
+}
+
+static void benchmark_write_json(const BenchmarkConfig* cfg, BenchmarkRun* runs) {
+    FILE* f = fopen(cfg->json_path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Error: could not open %s for writing\n", cfg->json_path);
+        return;
+    }
+    fprintf(f, "{\n  \"label\": \"%s\",\n  \"maps\": [", cfg->label);
+    for (int m = 0; m < cfg->num_maps; m++) {
+        fprintf(f, "%s\"%s\"", m ? ", " : "", cfg->maps[m]);
+    }
+    fprintf(f, "],\n  \"agents\": %d,\n  \"threads\": %d,\n  \"envs\": %d,\n"
+            "  \"warmup\": %.3f,\n  \"duration\": %.3f,\n",
+            cfg->num_agents, cfg->num_threads, cfg->num_threads*cfg->envs_per_thread,
+            cfg->warmup, cfg->duration);
+#ifdef DRIVE_PROFILE
+    fprintf(f, "  \"profiled\": true,\n");
+#else
+    fprintf(f, "  \"profiled\": false,\n");
+#endif
+    fprintf(f, "  \"runs\": [\n");
+    for (int r = 0; r < cfg->repeats; r++) {
+        BenchmarkRun* run = &runs[r];
+        long steps = run->profile.steps;
+        fprintf(f, "    {\"seconds\": %.6f, \"env_steps\": %ld, \"agent_steps\": %ld, \"sps\": %.1f, "
+                "\"phases_us\": {\"dynamics\": %.3f, \"metrics\": %.3f, \"collision\": %.3f, "
+                "\"observations\": %.3f, \"logging\": %.3f, \"reset\": %.3f}}%s\n",
+                run->seconds, run->env_steps, run->agent_steps, run->sps,
+                per_step_us(run->profile.dynamics.seconds, steps),
+                per_step_us(run->profile.metrics.seconds, steps),
+                per_step_us(run->profile.collision.seconds, steps),
+                per_step_us(run->profile.observations.seconds, steps),
+                per_step_us(run->profile.logging.seconds, steps),
+                per_step_us(run->profile.reset.seconds, steps),
+                r + 1 < cfg->repeats ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+}
+
+int benchmark(BenchmarkConfig* cfg) {
+    if (cfg->num_maps == 0) {
+        cfg->maps[cfg->num_maps++] = "resources/drive/binaries/map_000.bin";
+    }
+    for (int m = 0; m < cfg->num_maps; m++) {
+        FILE* map_file = fopen(cfg->maps[m], "rb");
+        if (map_file == NULL) {
+            RAISE_FILE_ERROR(cfg->maps[m]);
+        }
+        fclose(map_file);
+    }
+
+    // Envs are dealt round-robin over the maps and pinned to one thread each
+    double init_start = benchmark_now();
+    BenchmarkWorker* workers = (BenchmarkWorker*)calloc(cfg->num_threads, sizeof(BenchmarkWorker));
+    int map_idx = 0;
+    for (int t = 0; t < cfg->num_threads; t++) {
+        workers[t].num_envs = cfg->envs_per_thread;
+        workers[t].seed = 42 + t;
+        workers[t].envs = (Drive*)calloc(cfg->envs_per_thread, sizeof(Drive));
+        for (int e = 0; e < cfg->envs_per_thread; e++) {
+            Drive* env = &workers[t].envs[e];
+            env->dynamics_model = CLASSIC;
+            env->reward_vehicle_collision = -0.1f;
+            env->reward_offroad_collision = -0.1f;
+            env->goal_radius = 2.0f;
+            env->spawn_immunity_timer = 50;
+            env->num_agents = cfg->num_agents;
+            env->policy_agents_per_env = -1;
+            env->map_name = (char*)cfg->maps[map_idx];
+            map_idx = (map_idx + 1) % cfg->num_maps;
+            allocate(env);
+            c_reset(env);
+        }
+    }
+    printf("Init time: %.3fs (%d envs on %d threads, %d maps)\n", benchmark_now() - init_start,
+           cfg->num_threads*cfg->envs_per_thread, cfg->num_threads, cfg->num_maps);
+#ifndef DRIVE_PROFILE
+    printf("Per-phase timings are zero: rebuild with -DDRIVE_PROFILE "
+           "(scripts/build_ocean.sh drive bench)\n");
+#endif
+
+    BenchmarkRun* runs = (BenchmarkRun*)calloc(cfg->repeats, sizeof(BenchmarkRun));
+    if (cfg->warmup > 0) {
+        BenchmarkRun warm;
+        benchmark_pass(workers, cfg->num_threads, cfg->warmup, &warm);
+    }
+    double sps_min = 0, sps_max = 0, sps_sum = 0;
+    for (int r = 0; r < cfg->repeats; r++) {
+        BenchmarkRun* run = &runs[r];
+        benchmark_pass(workers, cfg->num_threads, cfg->duration, run);
+        long steps = run->profile.steps;
+        printf("Run %d: SPS %.0f | us/step dynamics %.2f metrics %.2f (collision %.2f) "
+               "observations %.2f logging %.2f reset %.2f\n",
+               r, run->sps,
+               per_step_us(run->profile.dynamics.seconds, steps),
+               per_step_us(run->profile.metrics.seconds, steps),
+               per_step_us(run->profile.collision.seconds, steps),
+               per_step_us(run->profile.observations.seconds, steps),
+               per_step_us(run->profile.logging.seconds, steps),
+               per_step_us(run->profile.reset.seconds, steps));
+#ifdef DRIVE_PROFILE
+        if (steps > 0) {
+            printf("       per step: %.1f segments scanned, %.2f OBB tests, %.3f truncated road obs, %.3f respawns\n",
+                   (double)run->profile.segments_scanned / steps, (double)run->profile.obb_tests / steps,
+                   (double)run->profile.road_obs_truncated / steps, (double)run->profile.respawns / steps);
+        }
+#endif
+        if (r == 0 || run->sps < sps_min) sps_min = run->sps;
+        if (r == 0 || run->sps > sps_max) sps_max = run->sps;
+        sps_sum += run->sps;
+    }
+    printf("SPS: mean %.0f min %.0f max %.0f over %d runs\n",
+           sps_sum / cfg->repeats, sps_min, sps_max, cfg->repeats);
+
+    if (cfg->csv_path) benchmark_write_csv(cfg, runs);
+    if (cfg->json_path) benchmark_write_json(cfg, runs);
+
+    for (int t = 0; t < cfg->num_threads; t++) {
+        for (int e = 0; e < workers[t].num_envs; e++) {
+            free_allocated(&workers[t].envs[e]);
+        }
+        free(workers[t].envs);
+    }
+    free(workers);
+    free(runs);
     return 0;
 }
 
-void performance_test() {
-    long test_time = 10;
+typedef struct {
+    const char** maps;
+    int num_maps;
+    int episodes;
+    int num_threads;
+    const char* output_path;
+    const char* int8_weights;
+    float goal_radius;
+    int control_non_vehicles;
+    int init_steps;
+    int control_all_agents;
+    int policy_agents_per_env;
+    int deterministic_selection;
+} BatchEvalConfig;
+
+typedef struct {
+    Log log;  // summed over every agent episode on the map, as add_log does
+    int episodes;
+    int active_agents;
+    double seconds;
+    bool missing;
+} ScenarioResult;
+
+typedef struct {
+    const BatchEvalConfig* cfg;
+    Weights* weights;
+    pthread_mutex_t weights_lock;  // init_drivenet moves the read cursor of the shared weights
+    ScenarioResult* results;
+    int next_map;                  // claimed by workers with an atomic add
+} BatchEval;
+
+// Runs cfg->episodes full episodes of the policy on one map
+static void batch_eval_scenario(BatchEval* eval, int map_idx) {
+    const BatchEvalConfig* cfg = eval->cfg;
+    ScenarioResult* result = &eval->results[map_idx];
+    if (access(cfg->maps[map_idx], R_OK) != 0) {
+        result->missing = true;
+        return;
+    }
+    double start = benchmark_now();
     Drive env = {
         .dynamics_model = CLASSIC,
-        .human_agent_idx = 0,
-	    .map_name = "resources/drive/binaries/map_000.bin"
+        .reward_vehicle_collision = -0.1f,
+        .reward_offroad_collision = -0.1f,
+        .reward_ade = -0.0f,
+        .goal_radius = cfg->goal_radius,
+        .map_name = (char*)cfg->maps[map_idx],
+        .spawn_immunity_timer = 50,
+        .control_non_vehicles = cfg->control_non_vehicles,
+        .init_steps = cfg->init_steps,
+        .control_all_agents = cfg->control_all_agents,
+        .policy_agents_per_env = cfg->policy_agents_per_env,
+        .deterministic_agent_selection = cfg->deterministic_selection
     };
-    clock_t start_time, end_time;
-    double cpu_time_used;
-    start_time = clock();
+    // Seeded by map, so results do not depend on which thread ran the map
+    seed_rng(&env.rng, map_idx);
     allocate(&env);
     c_reset(&env);
-    end_time = clock();
-    cpu_time_used = ((double) (end_time - start_time)) / CLOCKS_PER_SEC;
-    printf("Init time: %f\n", cpu_time_used);
+    result->active_agents = env.active_agent_count;
+    if (env.active_agent_count > 0) {
+        pthread_mutex_lock(&eval->weights_lock);
+        // Weights without a manifest are read in order from the start
+        eval->weights->idx = 0;
+        DriveNet* net = init_drivenet(eval->weights, env.active_agent_count, env.max_partner_observations);
+        pthread_mutex_unlock(&eval->weights_lock);
+        seed_multidiscrete(net->multidiscrete, map_idx);
+
+        // c_step logs and resets the env on the last step of each episode
+        int episode_steps = TRAJECTORY_LENGTH - cfg->init_steps;
+        for (int ep = 0; ep < cfg->episodes; ep++) {
+            memset(net->lstm->state_h, 0, env.active_agent_count*256*sizeof(float));
+            memset(net->lstm->state_c, 0, env.active_agent_count*256*sizeof(float));
+            for (int t = 0; t < episode_steps; t++) {
+                forward(net, env.observations, (int*)env.actions);
+                c_step(&env);
+            }
+            result->episodes++;
+        }
+        free_drivenet(net);
+    }
+    result->log = env.log;
+    result->seconds = benchmark_now() - start;
+    free_allocated(&env);
+}
 
-    long start = time(NULL);
-    int i = 0;
-    int (*actions)[2] = (int(*)[2])env.actions;
+static void* batch_eval_worker(void* arg) {
+    BatchEval* eval = (BatchEval*)arg;
+    int m;
+    while ((m = __atomic_fetch_add(&eval->next_map, 1, __ATOMIC_RELAXED)) < eval->cfg->num_maps) {
+        batch_eval_scenario(eval, m);
+    }
+    return NULL;
+}
+
+// Per agent-episode mean of a summed Log field
+static float scenario_mean(const ScenarioResult* result, float sum) {
+    return result->log.n > 0 ? sum / result->log.n : 0.0f;
+}
+
+#define SCENARIO_COLUMNS 11
+static const char* scenario_columns[SCENARIO_COLUMNS] = {
+    "episodes", "active_agents", "agent_episodes", "completion_rate", "collision_rate",
+    "offroad_rate", "avg_displacement_error", "clean_collision_rate", "dnf_rate",
+    "episode_return", "seconds",
+};
 
-    while (time(NULL) - start < test_time) {
-        // Set random actions for all agents
-        for(int j = 0; j < env.active_agent_count; j++) {
-            int accel = rand() % 7;
-            int steer = rand() % 13;
-            actions[j][0] = accel;  // -1, 0, or 1
-            actions[j][1] = steer;  // Random steering
+static double scenario_value(const ScenarioResult* r, int column) {
+    switch (column) {
+        case 0: return r->episodes;
+        case 1: return r->active_agents;
+        case 2: return r->log.n;
+        case 3: return scenario_mean(r, r->log.completion_rate);
+        case 4: return scenario_mean(r, r->log.collision_rate);
+        case 5: return scenario_mean(r, r->log.offroad_rate);
+        case 6: return scenario_mean(r, r->log.avg_displacement_error);
+        case 7: return scenario_mean(r, r->log.clean_collision_rate);
+        case 8: return scenario_mean(r, r->log.dnf_rate);
+        case 9: return scenario_mean(r, r->log.episode_return);
+        default: return r->seconds;
+    }
+}
+
+// A .json path gets one array per column; anything else gets CSV with
+// one row per map. Maps that could not be read are left out.
+static int batch_eval_write(const BatchEvalConfig* cfg, ScenarioResult* results) {
+    FILE* f = fopen(cfg->output_path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Error: could not open %s for writing\n", cfg->output_path);
+        return -1;
+    }
+    const char* ext = strrchr(cfg->output_path, '.');
+    if (ext != NULL && strcmp(ext, ".json") == 0) {
+        fprintf(f, "{\n  \"map\": [");
+        int first = 1;
+        for (int m = 0; m < cfg->num_maps; m++) {
+            if (results[m].missing) continue;
+            fprintf(f, "%s\"%s\"", first ? "" : ", ", cfg->maps[m]);
+            first = 0;
+        }
+        fprintf(f, "]");
+        for (int c = 0; c < SCENARIO_COLUMNS; c++) {
+            fprintf(f, ",\n  \"%s\": [", scenario_columns[c]);
+            first = 1;
+            for (int m = 0; m < cfg->num_maps; m++) {
+                if (results[m].missing) continue;
+                fprintf(f, "%s%.6g", first ? "" : ", ", scenario_value(&results[m], c));
+                first = 0;
+            }
+            fprintf(f, "]");
+        }
+        fprintf(f, "\n}\n");
+    } else {
+        fprintf(f, "map");
+        for (int c = 0; c < SCENARIO_COLUMNS; c++) {
+            fprintf(f, ",%s", scenario_columns[c]);
+        }
+        fprintf(f, "\n");
+        for (int m = 0; m < cfg->num_maps; m++) {
+            if (results[m].missing) continue;
+            fprintf(f, "%s", cfg->maps[m]);
+            for (int c = 0; c < SCENARIO_COLUMNS; c++) {
+                fprintf(f, ",%.6g", scenario_value(&results[m], c));
+            }
+            fprintf(f, "\n");
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+// Evaluates the policy headlessly on every map, in parallel over maps,
+// and writes per-scenario metrics to cfg->output_path
+int batch_eval(BatchEvalConfig* cfg) {
+    if (cfg->num_maps == 0) {
+        fprintf(stderr, "Error: --batch-eval needs maps from --eval-maps or --eval-map-list\n");
+        return 1;
+    }
+    Weights* weights = NULL;
+    if (cfg->int8_weights != NULL) {
+        weights = load_weights_int8(cfg->int8_weights);
+        if (weights == NULL) {
+            return 1;
         }
+    } else {
+        weights = load_weights("resources/drive/puffer_drive_weights.bin", drivenet_num_weights());
+    }
 
-        c_step(&env);
-        i++;
+    BatchEval eval = {
+        .cfg = cfg,
+        .weights = weights,
+        .results = (ScenarioResult*)calloc(cfg->num_maps, sizeof(ScenarioResult)),
+        .next_map = 0,
+    };
+    pthread_mutex_init(&eval.weights_lock, NULL);
+    int num_threads = cfg->num_threads;
+    if (num_threads > cfg->num_maps) num_threads = cfg->num_maps;
+    if (num_threads < 1) num_threads = 1;
+
+    double start = benchmark_now();
+    pthread_t* threads = (pthread_t*)calloc(num_threads, sizeof(pthread_t));
+    for (int t = 1; t < num_threads; t++) {
+        pthread_create(&threads[t], NULL, batch_eval_worker, &eval);
     }
-    long end = time(NULL);
-    printf("SPS: %ld\n", (i*env.active_agent_count) / (end - start));
-    free_allocated(&env);
+    batch_eval_worker(&eval);
+    for (int t = 1; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+    double elapsed = benchmark_now() - start;
+
+    int evaluated = 0;
+    Log total = {0};
+    for (int m = 0; m < cfg->num_maps; m++) {
+        ScenarioResult* r = &eval.results[m];
+        if (r->missing) {
+            fprintf(stderr, "Warning: skipping %s, map file not found\n", cfg->maps[m]);
+            continue;
+        }
+        evaluated++;
+        total.n += r->log.n;
+        total.completion_rate += r->log.completion_rate;
+        total.collision_rate += r->log.collision_rate;
+        total.offroad_rate += r->log.offroad_rate;
+        total.avg_displacement_error += r->log.avg_displacement_error;
+    }
+    float n = total.n > 0 ? total.n : 1.0f;
+    printf("Evaluated %d maps x %d episodes in %.2fs on %d threads\n",
+           evaluated, cfg->episodes, elapsed, num_threads);
+    printf("Goal %.3f | collision %.3f | offroad %.3f | ADE %.3f over %.0f agent episodes\n",
+           total.completion_rate / n, total.collision_rate / n, total.offroad_rate / n,
+           total.avg_displacement_error / n, total.n);
+
+    int rc = batch_eval_write(cfg, eval.results);
+    if (rc == 0) {
+        printf("Wrote per-scenario metrics to %s\n", cfg->output_path);
+    }
+    pthread_mutex_destroy(&eval.weights_lock);
+    free(eval.results);
+    free_weights(weights);
+    return rc == 0 ? 0 : 1;
+}
+
+// Appends the map paths in list, one per line, to *maps
+static int read_map_list(const char* list, const char*** maps, int* num_maps, int* capacity) {
+    FILE* f = fopen(list, "r");
+    if (f == NULL) {
+        fprintf(stderr, "Error: could not open map list %s\n", list);
+        return -1;
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') continue;
+        if (*num_maps == *capacity) {
+            *capacity = *capacity ? 2*(*capacity) : 64;
+            *maps = (const char**)realloc(*maps, *capacity * sizeof(char*));
+        }
+        (*maps)[(*num_maps)++] = strdup(line);
+    }
+    fclose(f);
+    return 0;
 }
 
 int main(int argc, char* argv[]) {
@@ -680,6 +1480,27 @@ int main(int argc, char* argv[]) {
     int deterministic_selection = 0;
     int policy_agents_per_env = -1;
     int control_non_vehicles = 0;
+    const char* int8_weights = NULL;
+    int inference_threads = 1;
+    int headless = 0;
+    int gif = 0;
+    int run_benchmark = 0;
+    int run_batch_eval = 0;
+    int eval_map_capacity = 0;
+    BatchEvalConfig eval = {
+        .episodes = 1,
+        .num_threads = 1,
+        .output_path = "resources/drive/batch_eval.csv",
+    };
+    BenchmarkConfig bench = {
+        .num_agents = 1024,
+        .num_threads = 1,
+        .envs_per_thread = 1,
+        .warmup = 1.0,
+        .duration = 10.0,
+        .repeats = 3,
+        .label = "",
+    };
 
     // Parse command line arguments
     for (int i = 1; i < argc; i++) {
@@ -738,13 +1559,113 @@ int main(int argc, char* argv[]) {
             }
         } else if (strcmp(argv[i], "--deterministic-selection") == 0) {
             deterministic_selection = 1;
+        } else if (strcmp(argv[i], "--int8-weights") == 0) {
+            if (i + 1 < argc) {
+                int8_weights = argv[i + 1];
+                i++;
+            } else {
+                fprintf(stderr, "Error: --int8-weights option requires a checkpoint path\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            // Threads used to run the policy forward over agents
+            if (i + 1 < argc) inference_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            // Render the top-down video on the CPU, without a window or GL context
+            headless = 1;
+        } else if (strcmp(argv[i], "--gif") == 0) {
+            // Write output_*.gif instead of output_*.mp4
+            gif = 1;
+        } else if (strcmp(argv[i], "--batch-eval") == 0) {
+            run_batch_eval = 1;
+        } else if (strcmp(argv[i], "--eval-maps") == 0) {
+            // Comma separated list of map binaries
+            if (i + 1 < argc) {
+                char* list = argv[++i];
+                for (char* tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+                    if (eval.num_maps == eval_map_capacity) {
+                        eval_map_capacity = eval_map_capacity ? 2*eval_map_capacity : 64;
+                        eval.maps = (const char**)realloc(eval.maps, eval_map_capacity*sizeof(char*));
+                    }
+                    eval.maps[eval.num_maps++] = strdup(tok);
+                }
+            }
+        } else if (strcmp(argv[i], "--eval-map-list") == 0) {
+            // File with one map binary per line
+            if (i + 1 < argc && read_map_list(argv[++i], &eval.maps, &eval.num_maps, &eval_map_capacity) != 0) {
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--eval-episodes") == 0) {
+            if (i + 1 < argc) eval.episodes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--eval-threads") == 0) {
+            if (i + 1 < argc) eval.num_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--eval-output") == 0) {
+            if (i + 1 < argc) eval.output_path = argv[++i];
+        } else if (strcmp(argv[i], "--benchmark") == 0) {
+            run_benchmark = 1;
+        } else if (strcmp(argv[i], "--bench-maps") == 0) {
+            // Comma separated list of map binaries
+            if (i + 1 < argc) {
+                char* list = argv[++i];
+                for (char* tok = strtok(list, ","); tok != NULL && bench.num_maps < 64; tok = strtok(NULL, ",")) {
+                    bench.maps[bench.num_maps++] = tok;
+                }
+            }
+        } else if (strcmp(argv[i], "--bench-agents") == 0) {
+            if (i + 1 < argc) bench.num_agents = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bench-threads") == 0) {
+            if (i + 1 < argc) bench.num_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bench-envs-per-thread") == 0) {
+            if (i + 1 < argc) bench.envs_per_thread = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bench-warmup") == 0) {
+            if (i + 1 < argc) bench.warmup = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--bench-duration") == 0) {
+            if (i + 1 < argc) bench.duration = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--bench-repeats") == 0) {
+            if (i + 1 < argc) bench.repeats = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bench-csv") == 0) {
+            if (i + 1 < argc) bench.csv_path = argv[++i];
+        } else if (strcmp(argv[i], "--bench-json") == 0) {
+            if (i + 1 < argc) bench.json_path = argv[++i];
+        } else if (strcmp(argv[i], "--bench-label") == 0) {
+            if (i + 1 < argc) bench.label = argv[++i];
+        }
+    }
+
+    if (run_benchmark) {
+        if (map_name != NULL && bench.num_maps == 0) bench.maps[bench.num_maps++] = map_name;
+        if (bench.num_threads < 1) bench.num_threads = 1;
+        if (bench.envs_per_thread < 1) bench.envs_per_thread = 1;
+        if (bench.repeats < 1) bench.repeats = 1;
+        if (bench.duration <= 0) bench.duration = 10.0;
+        return benchmark(&bench);
+    }
+
+    if (run_batch_eval) {
+        if (map_name != NULL && eval.num_maps == 0) {
+            eval.maps = (const char**)malloc(sizeof(char*));
+            eval.maps[eval.num_maps++] = strdup(map_name);
+        }
+        if (eval.episodes < 1) eval.episodes = 1;
+        eval.int8_weights = int8_weights;
+        eval.goal_radius = goal_radius;
+        eval.control_non_vehicles = control_non_vehicles;
+        eval.init_steps = init_steps;
+        eval.control_all_agents = control_all_agents;
+        eval.policy_agents_per_env = policy_agents_per_env;
+        eval.deterministic_selection = deterministic_selection;
+        int rc = batch_eval(&eval);
+        for (int m = 0; m < eval.num_maps; m++) {
+            free((char*)eval.maps[m]);
         }
+        free(eval.maps);
+        return rc;
     }
 
     eval_gif(map_name, show_grid, obs_only, lasers, log_trajectories, frame_skip,
              goal_radius, control_non_vehicles, init_steps,
-             control_all_agents, policy_agents_per_env, deterministic_selection);
+             control_all_agents, policy_agents_per_env, deterministic_selection,
+             int8_weights, inference_threads, headless, gif);
     //demo();
-    //performance_test();
     return 0;
 }
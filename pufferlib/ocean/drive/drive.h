@@ -6,11 +6,15 @@
 #include <math.h>
 #include <assert.h>
 #include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include "raylib.h"
 #include "raymath.h"
 #include "rlgl.h"
 #include <time.h>
 #include "error.h"
+#include "recorder.h"
 
 
 
@@ -60,7 +64,12 @@
 
 // Max road segment observation entities
 #define MAX_ROAD_SEGMENT_OBSERVATIONS 200
-#define MAX_AGENTS 64
+// Default partner observation slots; overridden per env by max_partner_observations
+#define MAX_PARTNER_OBSERVATIONS 63
+#define PARTNER_OBSERVATION_RADIUS 50.0f
+#define COLLISION_CHECK_RADIUS 15.0f
+// Cell size of the per-step agent spatial hash
+#define AGENT_GRID_CELL_SIZE 15.0f
 // Observation Space Constants
 #define MAX_SPEED 100.0f
 #define MAX_VEH_LEN 30.0f
@@ -123,6 +132,167 @@ struct Log {
     float static_car_count;
 };
 
+// Streaming fixed-bin histogram. Samples outside [min, max] land in the edge bins.
+#define LOG_HISTOGRAM_BINS 256
+typedef struct LogHistogram LogHistogram;
+struct LogHistogram {
+    float min;
+    float max;
+    unsigned int count;
+    unsigned int bins[LOG_HISTOGRAM_BINS];
+};
+
+// Per-env histograms for percentile metrics. Only the thread stepping an env
+// writes to them; vec_log merges and clears them in its pass over the envs.
+typedef struct LogHistograms LogHistograms;
+struct LogHistograms {
+    LogHistogram episode_return;
+    LogHistogram avg_displacement_error;
+    LogHistogram collision_time;
+};
+
+void log_histogram_init(LogHistogram* h, float min, float max) {
+    memset(h, 0, sizeof(LogHistogram));
+    h->min = min;
+    h->max = max;
+}
+
+void log_histogram_add(LogHistogram* h, float value) {
+    float f = (value - h->min) / (h->max - h->min) * LOG_HISTOGRAM_BINS;
+    int bin = 0;
+    if (f >= LOG_HISTOGRAM_BINS) bin = LOG_HISTOGRAM_BINS - 1;
+    else if (f > 0.0f) bin = (int)f;
+    h->bins[bin]++;
+    h->count++;
+}
+
+void log_histogram_merge(LogHistogram* into, const LogHistogram* from) {
+    into->min = from->min;
+    into->max = from->max;
+    into->count += from->count;
+    for (int b = 0; b < LOG_HISTOGRAM_BINS; b++) {
+        into->bins[b] += from->bins[b];
+    }
+}
+
+// Linear interpolation inside the bin holding the q-th sample
+float log_histogram_quantile(const LogHistogram* h, float q) {
+    if (h->count == 0) return 0.0f;
+    float target = q * h->count;
+    float width = (h->max - h->min) / LOG_HISTOGRAM_BINS;
+    float cumulative = 0.0f;
+    for (int b = 0; b < LOG_HISTOGRAM_BINS; b++) {
+        if (h->bins[b] == 0) continue;
+        float next = cumulative + h->bins[b];
+        if (next >= target) {
+            float frac = (target - cumulative) / h->bins[b];
+            return h->min + (b + frac) * width;
+        }
+        cumulative = next;
+    }
+    return h->max;
+}
+
+void init_log_histograms(LogHistograms* h) {
+    log_histogram_init(&h->episode_return, -50.0f, 10.0f);
+    log_histogram_init(&h->avg_displacement_error, 0.0f, 100.0f);
+    log_histogram_init(&h->collision_time, 0.0f, (float)TRAJECTORY_LENGTH);
+}
+
+void clear_log_histograms(LogHistograms* h) {
+    h->episode_return.count = 0;
+    h->avg_displacement_error.count = 0;
+    h->collision_time.count = 0;
+    memset(h->episode_return.bins, 0, sizeof(h->episode_return.bins));
+    memset(h->avg_displacement_error.bins, 0, sizeof(h->avg_displacement_error.bins));
+    memset(h->collision_time.bins, 0, sizeof(h->collision_time.bins));
+}
+
+void merge_log_histograms(LogHistograms* into, const LogHistograms* from) {
+    log_histogram_merge(&into->episode_return, &from->episode_return);
+    log_histogram_merge(&into->avg_displacement_error, &from->avg_displacement_error);
+    log_histogram_merge(&into->collision_time, &from->collision_time);
+}
+
+// Hot-path instrumentation for c_step, accumulated across steps. Only
+// filled in when built with -DDRIVE_PROFILE; otherwise the PROFILE_*
+// macros compile away and every field stays zero.
+typedef struct PhaseTimer PhaseTimer;
+struct PhaseTimer {
+    double seconds;
+    uint64_t cycles;
+};
+
+typedef struct StepProfile StepProfile;
+struct StepProfile {
+    PhaseTimer dynamics;
+    PhaseTimer metrics;
+    PhaseTimer collision;    // subset of metrics
+    PhaseTimer observations;
+    PhaseTimer logging;
+    PhaseTimer reset;
+    long steps;
+    long segments_scanned;   // road segments tested for offroad/lane alignment
+    long obb_tests;          // vehicle-vehicle box overlap tests
+    long road_obs_truncated; // agents whose road observation hit the cap
+    long respawns;
+};
+
+static inline void merge_phase_timer(PhaseTimer* into, const PhaseTimer* from) {
+    into->seconds += from->seconds;
+    into->cycles += from->cycles;
+}
+
+void merge_step_profile(StepProfile* into, const StepProfile* from) {
+    merge_phase_timer(&into->dynamics, &from->dynamics);
+    merge_phase_timer(&into->metrics, &from->metrics);
+    merge_phase_timer(&into->collision, &from->collision);
+    merge_phase_timer(&into->observations, &from->observations);
+    merge_phase_timer(&into->logging, &from->logging);
+    merge_phase_timer(&into->reset, &from->reset);
+    into->steps += from->steps;
+    into->segments_scanned += from->segments_scanned;
+    into->obb_tests += from->obb_tests;
+    into->road_obs_truncated += from->road_obs_truncated;
+    into->respawns += from->respawns;
+}
+
+#ifdef DRIVE_PROFILE
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t profile_cycles(void) {
+    return __rdtsc();
+}
+#elif defined(__aarch64__)
+static inline uint64_t profile_cycles(void) {
+    uint64_t v;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+}
+#else
+static inline uint64_t profile_cycles(void) {
+    return 0;
+}
+#endif
+static inline double profile_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double)t.tv_sec + 1e-9*(double)t.tv_nsec;
+}
+#define PROFILE_BEGIN(phase) \
+    double profile_start_##phase = profile_now(); \
+    uint64_t profile_cycles_##phase = profile_cycles()
+#define PROFILE_END(env, phase) do { \
+    (env)->profile.phase.cycles += profile_cycles() - profile_cycles_##phase; \
+    (env)->profile.phase.seconds += profile_now() - profile_start_##phase; \
+} while (0)
+#define PROFILE_COUNT(env, counter, n) ((env)->profile.counter += (n))
+#else
+#define PROFILE_BEGIN(phase)
+#define PROFILE_END(env, phase)
+#define PROFILE_COUNT(env, counter, n)
+#endif
+
 typedef struct Entity Entity;
 struct Entity {
     int type;
@@ -159,6 +329,7 @@ struct Entity {
     int valid;
     int respawn_timestep;
     int collided_before_goal;
+    int collision_timestep;  // Step of the first vehicle collision this episode, -1 if none
     int sampled_new_goal;
     int reached_goal_this_episode;
     int num_goals_reached;
@@ -244,6 +415,22 @@ struct GridMap {
     GridMapEntity** neighbor_cache_entities; // preallocated array to hold neighbor entities
 };
 
+// Coarse spatial hash over agent slots (active agents first, then static cars).
+// Rebuilt whenever agents move so that collision and partner queries only visit
+// nearby cells. Positions outside the map bounds are clamped to the border cells.
+typedef struct AgentGrid AgentGrid;
+struct AgentGrid {
+    float origin_x;
+    float origin_y;
+    int cols;
+    int rows;
+    int slot_count;
+    int* cell_start;  // cols*rows + 1 offsets into cell_slots
+    int* cell_slots;  // slots bucketed by cell, ascending within a cell
+    int* slot_cell;
+    int* query;       // scratch for query_agent_grid results
+};
+
 struct Drive {
     Client* client;
     float* observations;
@@ -252,6 +439,8 @@ struct Drive {
     unsigned char* terminals;
     Log log;
     Log* logs;
+    LogHistograms histograms;
+    StepProfile profile;
     int num_agents;
     int active_agent_count;
     int* active_agent_indices;
@@ -271,6 +460,7 @@ struct Drive {
     int init_steps;
     int dynamics_model;
     GridMap* grid_map;
+    AgentGrid* agent_grid;
     int* neighbor_offsets;
     float reward_vehicle_collision;
     float reward_offroad_collision;
@@ -288,17 +478,28 @@ struct Drive {
     int policy_agents_per_env;
     int logs_capacity;
     int use_goal_generation;
-    char* ini_file;
+    const char* ini_file;  // owned by the binding config cache
     int control_non_vehicles;
+    int persist_trajectory_cache;
+    int max_partner_observations;
+    uint64_t rng;  // PCG32 state, see seed_rng. Each env draws only from its own.
+    int* map_refs; // envs sharing this map data through fork_env, NULL if never forked
+    TrajectoryRecorder* recorder;  // shared by the vec env, NULL when not recording
+    int recorder_index;            // this env's slot in recorder
 };
 
+static inline int get_obs_size(Drive* env) {
+    return 7 + 7*env->max_partner_observations + 7*MAX_ROAD_SEGMENT_OBSERVATIONS;
+}
+
 typedef struct {
-    int candidates[MAX_AGENTS];
+    int* candidates;
     int candidates_count;
-    int forced_experts[MAX_AGENTS];
+    int* forced_experts;
     int forced_experts_count;
-    int statics[MAX_AGENTS];
+    int* statics;
     int statics_count;
+    int capacity;
 } SelectionBuckets;
 
 static inline void push_capped(int* arr, int* count, int val, int cap) {
@@ -324,16 +525,43 @@ static inline int vehicle_eligible_t0(const Entity* e) {
     return dist >= 2.0f;
 }
 
-static inline void fisher_yates_shuffle(int* arr, int n) {
+// PCG32 (XSH RR) on a caller-owned state, so envs stepped or initialized
+// on different threads never share a generator
+static inline uint32_t rng_next(uint64_t* state) {
+    uint64_t old = *state;
+    *state = old*6364136223846793005ULL + 1442695040888963407ULL;
+    uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+    uint32_t rot = (uint32_t)(old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+static inline void seed_rng(uint64_t* state, uint64_t seed) {
+    *state = 0;
+    rng_next(state);
+    *state += seed;
+    rng_next(state);
+}
+
+// Uniform integer in [0, n)
+static inline int rng_int(uint64_t* state, int n) {
+    return (int)(rng_next(state) % (uint32_t)n);
+}
+
+static inline void fisher_yates_shuffle(uint64_t* rng, int* arr, int n) {
     for (int i = n - 1; i > 0; --i) {
-        int j = rand() % (i + 1);
+        int j = rng_int(rng, i + 1);
         int tmp = arr[i];
         arr[i] = arr[j];
         arr[j] = tmp;
     }
 }
 
+// Buckets are sized to the map's object count, so no vehicle is dropped
 static void scan_vehicles_initial(const Drive* env, SelectionBuckets* out, int control_all_agents) {
+    out->capacity = env->num_objects;
+    out->candidates = (int*)malloc(out->capacity * sizeof(int));
+    out->forced_experts = (int*)malloc(out->capacity * sizeof(int));
+    out->statics = (int*)malloc(out->capacity * sizeof(int));
     out->candidates_count = 0;
     out->forced_experts_count = 0;
     out->statics_count = 0;
@@ -344,21 +572,28 @@ static void scan_vehicles_initial(const Drive* env, SelectionBuckets* out, int c
 
         int eligible = vehicle_eligible_t0(e);
         if (!eligible) {
-            push_capped(out->statics, &out->statics_count, i, MAX_AGENTS);
+            push_capped(out->statics, &out->statics_count, i, out->capacity);
             continue;
         }
 
         if (control_all_agents) {
-            push_capped(out->candidates, &out->candidates_count, i, MAX_AGENTS);
+            push_capped(out->candidates, &out->candidates_count, i, out->capacity);
         } else {
             if (e->mark_as_expert == 1) {
-                push_capped(out->forced_experts, &out->forced_experts_count, i, MAX_AGENTS);
+                push_capped(out->forced_experts, &out->forced_experts_count, i, out->capacity);
             } else {
-                push_capped(out->candidates, &out->candidates_count, i, MAX_AGENTS);
+                push_capped(out->candidates, &out->candidates_count, i, out->capacity);
             }
         }
     }
 }
+
+static void free_selection_buckets(SelectionBuckets* b) {
+    free(b->candidates);
+    free(b->forced_experts);
+    free(b->statics);
+}
+
 void add_log(Drive* env) {
     for(int i = 0; i < env->active_agent_count; i++){
         Entity* e = &env->entities[env->active_agent_indices[i]];
@@ -386,6 +621,11 @@ void add_log(Drive* env) {
         env->log.avg_displacement_error += displacement_error;
         env->log.episode_length += env->logs[i].episode_length;
         env->log.episode_return += env->logs[i].episode_return;
+        log_histogram_add(&env->histograms.episode_return, env->logs[i].episode_return);
+        log_histogram_add(&env->histograms.avg_displacement_error, displacement_error);
+        if(e->collision_timestep >= 0){
+            log_histogram_add(&env->histograms.collision_time, e->collision_timestep - env->init_steps);
+        }
         // Log composition counts per agent so vec_log averaging recovers the per-env value
         env->log.active_agent_count += env->active_agent_count;
         env->log.expert_static_car_count += env->expert_static_car_count;
@@ -790,20 +1030,46 @@ void init_neighbor_offsets(Drive* env) {
 
 void cache_neighbor_offsets(Drive* env){
     int count = 0;
-    int cell_count = env->grid_map->grid_cols*env->grid_map->grid_rows;
+    int cols = env->grid_map->grid_cols;
+    int rows = env->grid_map->grid_rows;
+    int cell_count = cols*rows;
     env->grid_map->neighbor_cache_entities = (GridMapEntity**)calloc(cell_count, sizeof(GridMapEntity*));
     env->grid_map->neighbor_cache_count = (int*)calloc(cell_count + 1, sizeof(int));
+
+    // With an odd vision range the spiral covers the full square around a
+    // cell, so each cell's neighbor count is a box sum over a summed-area
+    // table instead of a walk over every offset. This pass dominated env init.
+    int radius = env->grid_map->vision_range/2;
+    int* sat = NULL;
+    if (env->grid_map->vision_range % 2 == 1) {
+        sat = (int*)calloc((cols + 1)*(rows + 1), sizeof(int));
+        for (int y = 0; y < rows; y++) {
+            for (int x = 0; x < cols; x++) {
+                sat[(y + 1)*(cols + 1) + x + 1] = env->grid_map->cell_entities_count[y*cols + x]
+                    + sat[y*(cols + 1) + x + 1] + sat[(y + 1)*(cols + 1) + x] - sat[y*(cols + 1) + x];
+            }
+        }
+    }
     for(int i = 0; i < cell_count; i++){
         int cell_x = i % env->grid_map->grid_cols;  // Convert to 2D coordinates
         int cell_y = i / env->grid_map->grid_cols;
         int current_cell_neighbor_count = 0;
-        for(int j = 0; j < env->grid_map->vision_range*env->grid_map->vision_range; j++){
-            int x = cell_x + env->neighbor_offsets[j*2];
-            int y = cell_y + env->neighbor_offsets[j*2+1];
-            int grid_index = env->grid_map->grid_cols*y + x;
-            if(x < 0 || x >= env->grid_map->grid_cols || y < 0 || y >= env->grid_map->grid_rows) continue;
-            int grid_count = env->grid_map->cell_entities_count[grid_index];
-            current_cell_neighbor_count += grid_count;
+        if (sat != NULL) {
+            int x0 = cell_x - radius < 0 ? 0 : cell_x - radius;
+            int y0 = cell_y - radius < 0 ? 0 : cell_y - radius;
+            int x1 = cell_x + radius + 1 > cols ? cols : cell_x + radius + 1;
+            int y1 = cell_y + radius + 1 > rows ? rows : cell_y + radius + 1;
+            current_cell_neighbor_count = sat[y1*(cols + 1) + x1] - sat[y0*(cols + 1) + x1]
+                - sat[y1*(cols + 1) + x0] + sat[y0*(cols + 1) + x0];
+        } else {
+            for(int j = 0; j < env->grid_map->vision_range*env->grid_map->vision_range; j++){
+                int x = cell_x + env->neighbor_offsets[j*2];
+                int y = cell_y + env->neighbor_offsets[j*2+1];
+                int grid_index = env->grid_map->grid_cols*y + x;
+                if(x < 0 || x >= env->grid_map->grid_cols || y < 0 || y >= env->grid_map->grid_rows) continue;
+                int grid_count = env->grid_map->cell_entities_count[grid_index];
+                current_cell_neighbor_count += grid_count;
+            }
         }
         env->grid_map->neighbor_cache_count[i] = current_cell_neighbor_count;
         count += current_cell_neighbor_count;
@@ -814,8 +1080,11 @@ void cache_neighbor_offsets(Drive* env){
         env->grid_map->neighbor_cache_entities[i] = (GridMapEntity*)calloc(current_cell_neighbor_count, sizeof(GridMapEntity));
     }
 
+    free(sat);
+
     env->grid_map->neighbor_cache_count[cell_count] = count;
     for(int i = 0; i < cell_count; i ++){
+        if(env->grid_map->neighbor_cache_count[i] == 0) continue;
         int cell_x = i % env->grid_map->grid_cols;  // Convert to 2D coordinates
         int cell_y = i / env->grid_map->grid_cols;
         int base_index = 0;
@@ -1034,6 +1303,105 @@ int check_aabb_collision(Entity* car1, Entity* car2) {
     return 1;  // Collision
 }
 
+// Agent slots: active agents first, then static cars
+static inline int agent_slot_count(Drive* env) {
+    int count = env->num_controllable_agents;
+    if (count < env->active_agent_count) count = env->active_agent_count;
+    int total = env->active_agent_count + env->static_car_count;
+    return count < total ? count : total;
+}
+
+static inline int agent_slot_index(Drive* env, int slot) {
+    if (slot < env->active_agent_count) return env->active_agent_indices[slot];
+    return env->static_car_indices[slot - env->active_agent_count];
+}
+
+static inline int agent_grid_cell_coord(float value, float origin, int count) {
+    float f = (value - origin) / AGENT_GRID_CELL_SIZE;
+    if (!(f > 0.0f)) return 0;
+    if (f >= (float)count) return count - 1;
+    return (int)f;
+}
+
+void init_agent_grid(Drive* env) {
+    AgentGrid* grid = (AgentGrid*)calloc(1, sizeof(AgentGrid));
+    grid->origin_x = env->grid_map->top_left_x;
+    grid->origin_y = env->grid_map->bottom_right_y;
+    grid->cols = (int)ceilf((env->grid_map->bottom_right_x - env->grid_map->top_left_x) / AGENT_GRID_CELL_SIZE);
+    grid->rows = (int)ceilf((env->grid_map->top_left_y - env->grid_map->bottom_right_y) / AGENT_GRID_CELL_SIZE);
+    if (grid->cols < 1) grid->cols = 1;
+    if (grid->rows < 1) grid->rows = 1;
+    grid->slot_count = agent_slot_count(env);
+    int slots = grid->slot_count > 0 ? grid->slot_count : 1;
+    grid->cell_start = (int*)calloc(grid->cols*grid->rows + 1, sizeof(int));
+    grid->cell_slots = (int*)malloc(slots * sizeof(int));
+    grid->slot_cell = (int*)malloc(slots * sizeof(int));
+    grid->query = (int*)malloc(slots * sizeof(int));
+    env->agent_grid = grid;
+}
+
+void free_agent_grid(AgentGrid* grid) {
+    if (grid == NULL) return;
+    free(grid->cell_start);
+    free(grid->cell_slots);
+    free(grid->slot_cell);
+    free(grid->query);
+    free(grid);
+}
+
+// Counting sort of slots into cells. Call after agents move.
+void update_agent_grid(Drive* env) {
+    AgentGrid* grid = env->agent_grid;
+    int cell_count = grid->cols*grid->rows;
+    memset(grid->cell_start, 0, (cell_count + 1) * sizeof(int));
+    for (int slot = 0; slot < grid->slot_count; slot++) {
+        Entity* e = &env->entities[agent_slot_index(env, slot)];
+        int cx = agent_grid_cell_coord(e->x, grid->origin_x, grid->cols);
+        int cy = agent_grid_cell_coord(e->y, grid->origin_y, grid->rows);
+        int cell = cy*grid->cols + cx;
+        grid->slot_cell[slot] = cell;
+        grid->cell_start[cell + 1]++;
+    }
+    for (int cell = 0; cell < cell_count; cell++) {
+        grid->cell_start[cell + 1] += grid->cell_start[cell];
+    }
+    // cell_start[cell] doubles as the insert cursor and is shifted back afterwards
+    for (int slot = 0; slot < grid->slot_count; slot++) {
+        grid->cell_slots[grid->cell_start[grid->slot_cell[slot]]++] = slot;
+    }
+    for (int cell = cell_count; cell > 0; cell--) {
+        grid->cell_start[cell] = grid->cell_start[cell - 1];
+    }
+    grid->cell_start[0] = 0;
+}
+
+static int compare_ints(const void* a, const void* b) {
+    return *(const int*)a - *(const int*)b;
+}
+
+// Gathers every slot that may lie within radius of (x, y) into grid->query,
+// sorted by slot so results match a linear scan over the slots
+int query_agent_grid(Drive* env, float x, float y, float radius) {
+    AgentGrid* grid = env->agent_grid;
+    int reach = (int)ceilf(radius / AGENT_GRID_CELL_SIZE);
+    int cx = agent_grid_cell_coord(x, grid->origin_x, grid->cols);
+    int cy = agent_grid_cell_coord(y, grid->origin_y, grid->rows);
+    int x0 = cx - reach < 0 ? 0 : cx - reach;
+    int x1 = cx + reach >= grid->cols ? grid->cols - 1 : cx + reach;
+    int y0 = cy - reach < 0 ? 0 : cy - reach;
+    int y1 = cy + reach >= grid->rows ? grid->rows - 1 : cy + reach;
+    int count = 0;
+    for (int row = y0; row <= y1; row++) {
+        int start = grid->cell_start[row*grid->cols + x0];
+        int end = grid->cell_start[row*grid->cols + x1 + 1];
+        for (int k = start; k < end; k++) {
+            grid->query[count++] = grid->cell_slots[k];
+        }
+    }
+    if (count > 1) qsort(grid->query, count, sizeof(int), compare_ints);
+    return count;
+}
+
 int collision_check(Drive* env, int agent_idx) {
     Entity* agent = &env->entities[agent_idx];
 
@@ -1041,20 +1409,16 @@ int collision_check(Drive* env, int agent_idx) {
 
     int car_collided_with_index = -1;
 
-    for(int i = 0; i < MAX_AGENTS; i++){
-        int index = -1;
-        if(i < env->active_agent_count){
-            index = env->active_agent_indices[i];
-        } else if (i < env->num_controllable_agents){
-            index = env->static_car_indices[i - env->active_agent_count];
-        }
-        if(index == -1) continue;
+    int count = query_agent_grid(env, agent->x, agent->y, COLLISION_CHECK_RADIUS);
+    for(int k = 0; k < count; k++){
+        int index = agent_slot_index(env, env->agent_grid->query[k]);
         if(index == agent_idx) continue;
         Entity* entity = &env->entities[index];
         float x1 = entity->x;
         float y1 = entity->y;
         float dist = ((x1 - agent->x)*(x1 - agent->x) + (y1 - agent->y)*(y1 - agent->y));
-        if(dist > 225.0f) continue;
+        if(dist > COLLISION_CHECK_RADIUS*COLLISION_CHECK_RADIUS) continue;
+        PROFILE_COUNT(env, obb_tests, 1);
         if(check_aabb_collision(agent, entity)) {
             car_collided_with_index = index;
             break;
@@ -1174,6 +1538,7 @@ void compute_agent_metrics(Drive* env, int agent_idx) {
 
     GridMapEntity entity_list[MAX_ENTITIES_PER_CELL*25];  // Array big enough for all neighboring cells
     int list_size = checkNeighbors(env, agent->x, agent->y, entity_list, MAX_ENTITIES_PER_CELL*25, collision_offsets, 25);
+    PROFILE_COUNT(env, segments_scanned, list_size);
     for (int i = 0; i < list_size ; i++) {
         if(entity_list[i].entity_idx == -1) continue;
         if(entity_list[i].entity_idx == agent_idx) continue;
@@ -1234,7 +1599,9 @@ void compute_agent_metrics(Drive* env, int agent_idx) {
     }
 
     // Check for vehicle collisions
+    PROFILE_BEGIN(collision);
     int car_collided_with_index = collision_check(env, agent_idx);
+    PROFILE_END(env, collision);
     if (car_collided_with_index != -1) collided = VEHICLE_COLLISION;
 
     agent->collision_state = collided;
@@ -1290,41 +1657,36 @@ int valid_active_agent(Drive* env, int agent_idx){
 void set_active_agents(Drive* env){
     const char* map_name = env->map_name ? env->map_name : "(unset-map)";
 
-    int capacity = env->num_agents;
-    if (capacity < 0) {
-        capacity = 0;
-    } else if (capacity > MAX_AGENTS) {
-        capacity = MAX_AGENTS;
-    }
+    // num_agents == 0 means no per-env limit beyond the map itself
+    int capacity = env->num_agents > 0 ? env->num_agents : env->num_objects;
 
     env->active_agent_count = 0;
     env->static_car_count = 0;
     env->num_controllable_agents = 1;
     env->expert_static_car_count = 0;
-    int active_agent_indices[MAX_AGENTS];
-    int static_car_indices[MAX_AGENTS];
-    int expert_static_car_indices[MAX_AGENTS];
+    int* active_agent_indices = (int*)malloc(env->num_objects * sizeof(int));
+    int* static_car_indices = (int*)malloc(env->num_objects * sizeof(int));
+    int* expert_static_car_indices = (int*)malloc(env->num_objects * sizeof(int));
 
     if (env->control_all_agents == 1) {
         SelectionBuckets b;
         scan_vehicles_initial(env, &b, 1);
 
         int desired = b.candidates_count;
-        if (desired > MAX_AGENTS) desired = MAX_AGENTS;
         if (desired > capacity) desired = capacity;
 
         if (!env->deterministic_agent_selection) {
-            fisher_yates_shuffle(b.candidates, b.candidates_count);
+            fisher_yates_shuffle(&env->rng, b.candidates, b.candidates_count);
         }
 
         for (int k = 0; k < desired; k++) {
             active_agent_indices[env->active_agent_count++] = b.candidates[k];
             env->entities[b.candidates[k]].active_agent = 1;
         }
-        for (int i = 0; i < b.statics_count && env->static_car_count < MAX_AGENTS; i++) {
+        for (int i = 0; i < b.statics_count; i++) {
             static_car_indices[env->static_car_count++] = b.statics[i];
         }
-        for (int k = desired; k < b.candidates_count && env->static_car_count < MAX_AGENTS; k++) {
+        for (int k = desired; k < b.candidates_count; k++) {
             static_car_indices[env->static_car_count++] = b.candidates[k];
             env->entities[b.candidates[k]].active_agent = 0;
         }
@@ -1336,18 +1698,18 @@ void set_active_agents(Drive* env){
         for (int i = 0; i < env->static_car_count; i++) env->static_car_indices[i] = static_car_indices[i];
         for (int i = 0; i < env->expert_static_car_count; i++) env->expert_static_car_indices[i] = expert_static_car_indices[i];
 
+        free_selection_buckets(&b);
         goto finalize;
     } else if (env->policy_agents_per_env > 0) {
         SelectionBuckets b;
         scan_vehicles_initial(env, &b, 0);
 
         int desired = env->policy_agents_per_env;
-        if (desired > MAX_AGENTS) desired = MAX_AGENTS;
         if (desired > b.candidates_count) desired = b.candidates_count;
         if (desired > capacity) desired = capacity;
 
         if (!env->deterministic_agent_selection) {
-            fisher_yates_shuffle(b.candidates, b.candidates_count);
+            fisher_yates_shuffle(&env->rng, b.candidates, b.candidates_count);
         }
         if (desired > 0) {
             for (int k = 0; k < desired; k++) {
@@ -1356,25 +1718,17 @@ void set_active_agents(Drive* env){
             }
             for (int k = desired; k < b.candidates_count; k++) {
                 int idx = b.candidates[k];
-                if (env->expert_static_car_count < MAX_AGENTS) {
-                    expert_static_car_indices[env->expert_static_car_count++] = idx;
-                }
-                if (env->static_car_count < MAX_AGENTS) {
-                    static_car_indices[env->static_car_count++] = idx;
-                }
+                expert_static_car_indices[env->expert_static_car_count++] = idx;
+                static_car_indices[env->static_car_count++] = idx;
                 env->entities[idx].mark_as_expert = 1;
                 env->entities[idx].active_agent = 0;
             }
             for (int k = 0; k < b.forced_experts_count; k++) {
                 int idx = b.forced_experts[k];
-                if (env->expert_static_car_count < MAX_AGENTS) {
-                    expert_static_car_indices[env->expert_static_car_count++] = idx;
-                }
-                if (env->static_car_count < MAX_AGENTS) {
-                    static_car_indices[env->static_car_count++] = idx;
-                }
+                expert_static_car_indices[env->expert_static_car_count++] = idx;
+                static_car_indices[env->static_car_count++] = idx;
             }
-            for (int i = 0; i < b.statics_count && env->static_car_count < MAX_AGENTS; i++) {
+            for (int i = 0; i < b.statics_count; i++) {
                 static_car_indices[env->static_car_count++] = b.statics[i];
             }
 
@@ -1385,8 +1739,10 @@ void set_active_agents(Drive* env){
             for (int i = 0; i < env->static_car_count; i++) env->static_car_indices[i] = static_car_indices[i];
             for (int i = 0; i < env->expert_static_car_count; i++) env->expert_static_car_indices[i] = expert_static_car_indices[i];
 
+            free_selection_buckets(&b);
             goto finalize;
         } else {
+            free_selection_buckets(&b);
             int picked = -1;
             for (int i = 0; i < env->num_objects; i++) {
                 if (env->entities[i].type != VEHICLE) continue;
@@ -1402,12 +1758,8 @@ void set_active_agents(Drive* env){
                 for (int i = 0; i < env->num_objects; i++) {
                     if (i == picked) continue;
                     if (env->entities[i].type == VEHICLE) {
-                        if (env->static_car_count < MAX_AGENTS) {
-                            static_car_indices[env->static_car_count++] = i;
-                        }
-                        if (env->expert_static_car_count < MAX_AGENTS) {
-                            expert_static_car_indices[env->expert_static_car_count++] = i;
-                        }
+                        static_car_indices[env->static_car_count++] = i;
+                        expert_static_car_indices[env->expert_static_car_count++] = i;
                         env->entities[i].active_agent = 0;
                         env->entities[i].mark_as_expert = 1;
                     }
@@ -1425,7 +1777,7 @@ void set_active_agents(Drive* env){
     }
 
     if(env->num_agents == 0){
-        env->num_agents = MAX_AGENTS;
+        env->num_agents = env->num_objects;
     }
     int first_agent_id = env->num_objects-1;
     float distance_to_goal = valid_active_agent(env, first_agent_id);
@@ -1438,7 +1790,7 @@ void set_active_agents(Drive* env){
         env->active_agent_count = 0;
         env->num_controllable_agents = 0;
     }
-    for(int i = 0; i < env->num_objects-1 && env->num_controllable_agents < MAX_AGENTS; i++){
+    for(int i = 0; i < env->num_objects-1; i++){
 
         // Check if the entity type is controllable
         int is_type_controllable;
@@ -1489,6 +1841,9 @@ void set_active_agents(Drive* env){
         env->expert_static_car_indices[i] = expert_static_car_indices[i];
     }
 finalize:
+    free(active_agent_indices);
+    free(static_car_indices);
+    free(expert_static_car_indices);
     if (env->logs_capacity > 0 && env->active_agent_count > env->logs_capacity) {
         fprintf(stderr,
                 "[set_active_agents] ERROR map=%s active=%d exceeds logs_capacity=%d\n",
@@ -1500,7 +1855,230 @@ finalize:
     return;
 }
 
-void remove_bad_trajectories(Drive* env){
+// Memoized remove_bad_trajectories results. The pruned static cars only depend on
+// the map and on the agent selection, so the 91 step expert replay is skipped when
+// the same (map, selection) pair was seen before. Optionally persisted next to the
+// map binary as "<map>.trajcache" so that new processes start warm.
+#define TRAJECTORY_CACHE_MAGIC 0x43544450u  // "PDTC"
+#define TRAJECTORY_CACHE_VERSION 1
+#define TRAJECTORY_CACHE_MAX_ENTRIES 4096
+
+typedef struct TrajectoryCacheEntry TrajectoryCacheEntry;
+struct TrajectoryCacheEntry {
+    char* map_name;
+    uint64_t key;
+    int removed_count;
+    int* removed_indices;
+    TrajectoryCacheEntry* next;
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int64_t map_size;
+    int64_t map_mtime;
+} TrajectoryCacheHeader;
+
+static TrajectoryCacheEntry* trajectory_cache = NULL;
+static int trajectory_cache_size = 0;
+static pthread_mutex_t trajectory_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uint64_t fnv1a_ints(uint64_t hash, const int* values, int count) {
+    const unsigned char* bytes = (const unsigned char*)values;
+    for (size_t i = 0; i < count*sizeof(int); i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Everything that influences the replay: selection mode (agent shrinking differs
+// per mode), init step, collision candidate count and the three index sets.
+uint64_t trajectory_cache_key(Drive* env) {
+    int params[8] = {
+        env->init_steps, env->control_all_agents, env->policy_agents_per_env > 0,
+        env->control_non_vehicles, env->num_controllable_agents, env->active_agent_count,
+        env->static_car_count, env->expert_static_car_count
+    };
+    uint64_t hash = 14695981039346656037ULL;
+    hash = fnv1a_ints(hash, params, 8);
+    hash = fnv1a_ints(hash, env->active_agent_indices, env->active_agent_count);
+    hash = fnv1a_ints(hash, env->static_car_indices, env->static_car_count);
+    hash = fnv1a_ints(hash, env->expert_static_car_indices, env->expert_static_car_count);
+    return hash;
+}
+
+static TrajectoryCacheEntry* trajectory_cache_find(const char* map_name, uint64_t key) {
+    for (TrajectoryCacheEntry* e = trajectory_cache; e != NULL; e = e->next) {
+        if (e->key == key && strcmp(e->map_name, map_name) == 0) return e;
+    }
+    return NULL;
+}
+
+// Caller holds trajectory_cache_lock
+static void trajectory_cache_insert(const char* map_name, uint64_t key, const int* removed, int removed_count) {
+    if (trajectory_cache_size >= TRAJECTORY_CACHE_MAX_ENTRIES) return;
+    if (trajectory_cache_find(map_name, key) != NULL) return;
+    TrajectoryCacheEntry* e = (TrajectoryCacheEntry*)calloc(1, sizeof(TrajectoryCacheEntry));
+    e->map_name = strdup(map_name);
+    e->key = key;
+    e->removed_count = removed_count;
+    e->removed_indices = (int*)malloc((removed_count > 0 ? removed_count : 1) * sizeof(int));
+    memcpy(e->removed_indices, removed, removed_count * sizeof(int));
+    e->next = trajectory_cache;
+    trajectory_cache = e;
+    trajectory_cache_size++;
+}
+
+static int trajectory_cache_header(const char* map_name, TrajectoryCacheHeader* header) {
+    struct stat st;
+    if (stat(map_name, &st) != 0) return 0;
+    header->magic = TRAJECTORY_CACHE_MAGIC;
+    header->version = TRAJECTORY_CACHE_VERSION;
+    header->map_size = (int64_t)st.st_size;
+    header->map_mtime = (int64_t)st.st_mtime;
+    return 1;
+}
+
+typedef struct TrajectoryCacheFile TrajectoryCacheFile;
+struct TrajectoryCacheFile {
+    char* map_name;
+    TrajectoryCacheFile* next;
+};
+
+// Sidecar files already read into trajectory_cache, so each is parsed once
+static TrajectoryCacheFile* trajectory_cache_files = NULL;
+
+// Caller holds trajectory_cache_lock
+static int trajectory_cache_file_loaded(const char* map_name) {
+    for (TrajectoryCacheFile* f = trajectory_cache_files; f != NULL; f = f->next) {
+        if (strcmp(f->map_name, map_name) == 0) return 1;
+    }
+    return 0;
+}
+
+static void free_trajectory_cache_entries(TrajectoryCacheEntry* e) {
+    while (e != NULL) {
+        TrajectoryCacheEntry* next = e->next;
+        free(e->map_name);
+        free(e->removed_indices);
+        free(e);
+        e = next;
+    }
+}
+
+// Reads every record of the sidecar file into a list for
+// trajectory_cache_merge_file. Stale files (map binary rewritten since)
+// are ignored and replaced on the next store. Does not touch the cache, so
+// it runs without trajectory_cache_lock.
+static TrajectoryCacheEntry* trajectory_cache_read_file(const char* map_name) {
+    TrajectoryCacheHeader expected, header;
+    if (!trajectory_cache_header(map_name, &expected)) return NULL;
+    char path[512];
+    snprintf(path, sizeof(path), "%s.trajcache", map_name);
+    FILE* file = fopen(path, "rb");
+    if (!file) return NULL;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(&header, &expected, sizeof(header)) != 0) {
+        fclose(file);
+        return NULL;
+    }
+    TrajectoryCacheEntry* entries = NULL;
+    uint64_t key;
+    int count;
+    // Records are appended concurrently by other processes; stop at the first partial one
+    while (fread(&key, sizeof(key), 1, file) == 1 && fread(&count, sizeof(int), 1, file) == 1) {
+        if (count < 0 || count > 1 << 20) break;
+        int* removed = (int*)malloc((count > 0 ? count : 1) * sizeof(int));
+        if ((int)fread(removed, sizeof(int), count, file) != count) {
+            free(removed);
+            break;
+        }
+        TrajectoryCacheEntry* e = (TrajectoryCacheEntry*)calloc(1, sizeof(TrajectoryCacheEntry));
+        e->map_name = strdup(map_name);
+        e->key = key;
+        e->removed_count = count;
+        e->removed_indices = removed;
+        e->next = entries;
+        entries = e;
+    }
+    fclose(file);
+    return entries;
+}
+
+// Moves entries from trajectory_cache_read_file into the cache and marks the
+// file loaded. Another thread may have merged the same file meanwhile, in
+// which case the duplicates are dropped.
+// Caller holds trajectory_cache_lock
+static void trajectory_cache_merge_file(const char* map_name, TrajectoryCacheEntry* entries) {
+    if (!trajectory_cache_file_loaded(map_name)) {
+        TrajectoryCacheFile* f = (TrajectoryCacheFile*)calloc(1, sizeof(TrajectoryCacheFile));
+        f->map_name = strdup(map_name);
+        f->next = trajectory_cache_files;
+        trajectory_cache_files = f;
+    }
+    while (entries != NULL) {
+        TrajectoryCacheEntry* e = entries;
+        entries = e->next;
+        if (trajectory_cache_size >= TRAJECTORY_CACHE_MAX_ENTRIES || trajectory_cache_find(map_name, e->key) != NULL) {
+            e->next = NULL;
+            free_trajectory_cache_entries(e);
+            continue;
+        }
+        e->next = trajectory_cache;
+        trajectory_cache = e;
+        trajectory_cache_size++;
+    }
+}
+
+static int trajectory_cache_tmp_count = 0;
+
+// Appends a record with a single write() so concurrent writers never interleave.
+// Runs without trajectory_cache_lock; a record lost to a racing header rewrite
+// only costs a replay later.
+static void trajectory_cache_store_file(const char* map_name, uint64_t key, const int* removed, int removed_count) {
+    TrajectoryCacheHeader expected, header;
+    if (!trajectory_cache_header(map_name, &expected)) return;
+    char path[512];
+    snprintf(path, sizeof(path), "%s.trajcache", map_name);
+
+    int fd = open(path, O_RDONLY);
+    int valid = 0;
+    if (fd >= 0) {
+        valid = read(fd, &header, sizeof(header)) == sizeof(header) && memcmp(&header, &expected, sizeof(header)) == 0;
+        close(fd);
+    }
+    if (!valid) {
+        char tmp_path[544];
+        // Unique per thread as well as per process
+        snprintf(tmp_path, sizeof(tmp_path), "%s.%d.%d.tmp", path, (int)getpid(),
+            __atomic_fetch_add(&trajectory_cache_tmp_count, 1, __ATOMIC_RELAXED));
+        fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return;
+        int ok = write(fd, &expected, sizeof(expected)) == sizeof(expected);
+        close(fd);
+        if (!ok || rename(tmp_path, path) != 0) {
+            unlink(tmp_path);
+            return;
+        }
+    }
+
+    size_t record_size = sizeof(uint64_t) + sizeof(int) + removed_count*sizeof(int);
+    char* record = (char*)malloc(record_size);
+    memcpy(record, &key, sizeof(uint64_t));
+    memcpy(record + sizeof(uint64_t), &removed_count, sizeof(int));
+    memcpy(record + sizeof(uint64_t) + sizeof(int), removed, removed_count*sizeof(int));
+    fd = open(path, O_WRONLY | O_APPEND);
+    if (fd >= 0) {
+        if (write(fd, record, record_size) != (ssize_t)record_size) {
+            fprintf(stderr, "[trajectory_cache] short write to %s\n", path);
+        }
+        close(fd);
+    }
+    free(record);
+}
+
+// Replays expert motion and returns the static cars that active agents run into
+int find_bad_trajectories(Drive* env, int* removed){
     set_start_position(env);
     int collided_agents[env->active_agent_count];
     int collided_with_indices[env->active_agent_count];
@@ -1519,6 +2097,7 @@ void remove_bad_trajectories(Drive* env){
             if(env->entities[expert_idx].x == -10000) continue;
             move_expert(env, env->actions, expert_idx);
         }
+        update_agent_grid(env);
         // check collisions
         for(int i = 0; i < env->active_agent_count; i++){
             int agent_idx = env->active_agent_indices[i];
@@ -1531,17 +2110,57 @@ void remove_bad_trajectories(Drive* env){
         }
         env->timestep++;
     }
+    env->timestep = 0;
 
-    for(int i = 0; i< env->active_agent_count; i++){
-        if(collided_with_indices[i] == -1) continue;
-        for(int j = 0; j < env->static_car_count; j++){
-            int static_car_idx = env->static_car_indices[j];
-            if(static_car_idx != collided_with_indices[i]) continue;
-            env->entities[static_car_idx].traj_x[0] = -10000;
-            env->entities[static_car_idx].traj_y[0] = -10000;
+    int removed_count = 0;
+    for(int j = 0; j < env->static_car_count; j++){
+        int static_car_idx = env->static_car_indices[j];
+        for(int i = 0; i < env->active_agent_count; i++){
+            if(collided_with_indices[i] != static_car_idx) continue;
+            removed[removed_count++] = static_car_idx;
+            break;
         }
     }
-    env->timestep = 0;
+    return removed_count;
+}
+
+void remove_bad_trajectories(Drive* env){
+    int* removed = (int*)malloc((env->static_car_count > 0 ? env->static_car_count : 1) * sizeof(int));
+    int removed_count = -1;
+    uint64_t key = trajectory_cache_key(env);
+
+    pthread_mutex_lock(&trajectory_cache_lock);
+    TrajectoryCacheEntry* cached = trajectory_cache_find(env->map_name, key);
+    if (cached == NULL && env->persist_trajectory_cache && !trajectory_cache_file_loaded(env->map_name)) {
+        // Parse the sidecar without holding the lock, other envs keep loading
+        pthread_mutex_unlock(&trajectory_cache_lock);
+        TrajectoryCacheEntry* entries = trajectory_cache_read_file(env->map_name);
+        pthread_mutex_lock(&trajectory_cache_lock);
+        trajectory_cache_merge_file(env->map_name, entries);
+        cached = trajectory_cache_find(env->map_name, key);
+    }
+    if (cached != NULL && cached->removed_count <= env->static_car_count) {
+        removed_count = cached->removed_count;
+        memcpy(removed, cached->removed_indices, removed_count * sizeof(int));
+    }
+    pthread_mutex_unlock(&trajectory_cache_lock);
+
+    if (removed_count < 0) {
+        removed_count = find_bad_trajectories(env, removed);
+        pthread_mutex_lock(&trajectory_cache_lock);
+        trajectory_cache_insert(env->map_name, key, removed, removed_count);
+        pthread_mutex_unlock(&trajectory_cache_lock);
+        // The append is a single write(), safe against other threads and processes
+        if (env->persist_trajectory_cache) {
+            trajectory_cache_store_file(env->map_name, key, removed, removed_count);
+        }
+    }
+
+    for(int i = 0; i < removed_count; i++){
+        env->entities[removed[i]].traj_x[0] = -10000;
+        env->entities[removed[i]].traj_y[0] = -10000;
+    }
+    free(removed);
 }
 
 void init_goal_positions(Drive* env){
@@ -1566,19 +2185,34 @@ void init(Drive* env){
     env->logs_capacity = 0;
     set_active_agents(env);
     env->logs_capacity = env->active_agent_count;
+    if (env->max_partner_observations <= 0) env->max_partner_observations = MAX_PARTNER_OBSERVATIONS;
+    init_agent_grid(env);
     remove_bad_trajectories(env);
     set_start_position(env);
+    update_agent_grid(env);
     init_goal_positions(env);
     env->logs = (Log*)calloc(env->active_agent_count, sizeof(Log));
+    init_log_histograms(&env->histograms);
 }
 
 void c_close(Drive* env){
+    if (env->recorder) recorder_release(env->recorder);
+    // Forks share the map data; whichever env is closed last frees it
+    bool last_ref = env->map_refs == NULL
+        || __atomic_sub_fetch(env->map_refs, 1, __ATOMIC_ACQ_REL) == 0;
+    // Per-env state
+    free(env->logs);
+    free_agent_grid(env->agent_grid);
+    if (!last_ref) {
+        free(env->entities);
+        return;
+    }
+    free(env->map_refs);
     for(int i = 0; i < env->num_entities; i++){
         free_entity(&env->entities[i]);
     }
     free(env->entities);
     free(env->active_agent_indices);
-    free(env->logs);
     // GridMap cleanup
     int grid_cell_count = env->grid_map->grid_cols*env->grid_map->grid_rows;
     for(int grid_index = 0; grid_index < grid_cell_count; grid_index++){
@@ -1598,12 +2232,11 @@ void c_close(Drive* env){
     free(env->expert_static_car_indices);
     freeTopologyGraph(env->topology_graph);
     // free(env->map_name);
-    free(env->ini_file);
 }
 
 void allocate(Drive* env){
     init(env);
-    int max_obs = 7 + 7*(MAX_AGENTS - 1) + 7*MAX_ROAD_SEGMENT_OBSERVATIONS;
+    int max_obs = get_obs_size(env);
     // printf("num static cars: %d\n", env->static_car_count);
     // printf("active agent count: %d\n", env->active_agent_count);
     // printf("num objects: %d\n", env->num_objects);
@@ -1702,7 +2335,7 @@ float reverse_normalize_value(float value, float min, float max){
 }
 
 void compute_observations(Drive* env) {
-    int max_obs = 7 + 7*(MAX_AGENTS - 1) + 7*MAX_ROAD_SEGMENT_OBSERVATIONS;
+    int max_obs = get_obs_size(env);
     memset(env->observations, 0, max_obs*env->active_agent_count*sizeof(float));
     float (*observations)[max_obs] = (float(*)[max_obs])env->observations;
     for(int i = 0; i < env->active_agent_count; i++) {
@@ -1735,24 +2368,21 @@ void compute_observations(Drive* env) {
         // Relative Pos of other cars
         int obs_idx = 7;  // Start after goal distances
         int cars_seen = 0;
-        for(int j = 0; j < MAX_AGENTS; j++) {
-            int index = -1;
-            if(j < env->active_agent_count){
-                index = env->active_agent_indices[j];
-            } else if (j < env->num_controllable_agents){
-                index = env->static_car_indices[j - env->active_agent_count];
-            }
-            if(index == -1) continue;
+        int count = 0;
+        if(ego_entity->respawn_timestep == -1){
+            count = query_agent_grid(env, ego_entity->x, ego_entity->y, PARTNER_OBSERVATION_RADIUS);
+        }
+        for(int k = 0; k < count && cars_seen < env->max_partner_observations; k++) {
+            int index = agent_slot_index(env, env->agent_grid->query[k]);
             if(env->entities[index].type > 3) break;
             if(index == env->active_agent_indices[i]) continue;  // Skip self, but don't increment obs_idx
             Entity* other_entity = &env->entities[index];
-            if(ego_entity->respawn_timestep != -1) continue;
             if(other_entity->respawn_timestep != -1) continue;
             // Store original relative positions
             float dx = other_entity->x - ego_entity->x;
             float dy = other_entity->y - ego_entity->y;
             float dist = (dx*dx + dy*dy);
-            if(dist > 2500.0f) continue;
+            if(dist > PARTNER_OBSERVATION_RADIUS*PARTNER_OBSERVATION_RADIUS) continue;
             // Rotate to ego vehicle's frame
             float rel_x = dx*cos_heading + dy*sin_heading;
             float rel_y = -dx*sin_heading + dy*cos_heading;
@@ -1777,7 +2407,7 @@ void compute_observations(Drive* env) {
             cars_seen++;
             obs_idx += 7;  // Move to next observation slot
         }
-        int remaining_partner_obs = (MAX_AGENTS - 1 - cars_seen) * 7;
+        int remaining_partner_obs = (env->max_partner_observations - cars_seen) * 7;
         memset(&obs[obs_idx], 0, remaining_partner_obs * sizeof(float));
         obs_idx += remaining_partner_obs;
         // map observations
@@ -1785,6 +2415,8 @@ void compute_observations(Drive* env) {
         int grid_idx = getGridIndex(env, ego_entity->x, ego_entity->y);
 
         int list_size = get_neighbor_cache_entities(env, grid_idx, entity_list, MAX_ROAD_SEGMENT_OBSERVATIONS);
+        PROFILE_COUNT(env, road_obs_truncated, list_size == MAX_ROAD_SEGMENT_OBSERVATIONS
+                && env->grid_map->neighbor_cache_count[grid_idx] > MAX_ROAD_SEGMENT_OBSERVATIONS);
 
         for(int k = 0; k < list_size; k++) {
             int entity_idx = entity_list[k].entity_idx;
@@ -1974,11 +2606,13 @@ void compute_new_goal(Drive* env, int agent_idx) {
 void c_reset(Drive* env){
     env->timestep = env->init_steps;
     set_start_position(env);
+    update_agent_grid(env);
     for(int x = 0;x<env->active_agent_count; x++){
         env->logs[x] = (Log){0};
         int agent_idx = env->active_agent_indices[x];
         env->entities[agent_idx].respawn_timestep = -1;
         env->entities[agent_idx].collided_before_goal = 0;
+        env->entities[agent_idx].collision_timestep = -1;
         env->entities[agent_idx].reached_goal_this_episode = 0;
         env->entities[agent_idx].metrics_array[COLLISION_IDX] = 0.0f;
         env->entities[agent_idx].metrics_array[OFFROAD_IDX] = 0.0f;
@@ -1999,6 +2633,195 @@ void c_reset(Drive* env){
     compute_observations(env);
 }
 
+// Entity fields that change during an episode. Everything else in Entity
+// is fixed once the map is loaded, so snapshots only carry these.
+typedef struct {
+    float x;
+    float y;
+    float z;
+    float vx;
+    float vy;
+    float vz;
+    float heading;
+    float heading_x;
+    float heading_y;
+    float goal_position_x;
+    float goal_position_y;
+    float goal_position_z;
+    float metrics_array[5];
+    float cumulative_displacement;
+    int displacement_sample_count;
+    int collision_state;
+    int current_lane_idx;
+    int valid;
+    int respawn_timestep;
+    int collided_before_goal;
+    int collision_timestep;
+    int sampled_new_goal;
+    int reached_goal_this_episode;
+    int num_goals_reached;
+} EntityState;
+
+typedef struct {
+    int timestep;
+    int num_objects;
+    int active_agent_count;
+    uint64_t rng;
+    uint64_t scenario;  // snapshot_scenario of the env it was taken from
+} SnapshotHeader;
+
+// Identifies the map and the selected agents, so a snapshot is only
+// restored into the scenario it was taken from
+static uint64_t snapshot_scenario(Drive* env) {
+    uint64_t hash = 14695981039346656037ULL;
+    if (env->map_name != NULL) {
+        for (const unsigned char* c = (const unsigned char*)env->map_name; *c; c++) {
+            hash ^= *c;
+            hash *= 1099511628211ULL;
+        }
+    }
+    return fnv1a_ints(hash, env->active_agent_indices, env->active_agent_count);
+}
+
+// Whether c_restore accepts buffer for env
+int snapshot_matches(Drive* env, const void* buffer) {
+    const SnapshotHeader* header = (const SnapshotHeader*)buffer;
+    return header->num_objects == env->num_objects
+        && header->active_agent_count == env->active_agent_count
+        && header->scenario == snapshot_scenario(env);
+}
+
+// Bytes c_snapshot writes: a header, the state of every object, and the
+// per-agent episode logs
+size_t snapshot_size(Drive* env) {
+    return sizeof(SnapshotHeader) + env->num_objects*sizeof(EntityState)
+        + env->active_agent_count*sizeof(Log);
+}
+
+// Saves the mid-episode state of env into buffer, which must hold
+// snapshot_size(env) bytes. Cumulative env->log and histograms are
+// reporting aggregates and are not part of the snapshot.
+void c_snapshot(Drive* env, void* buffer) {
+    SnapshotHeader* header = (SnapshotHeader*)buffer;
+    header->timestep = env->timestep;
+    header->num_objects = env->num_objects;
+    header->active_agent_count = env->active_agent_count;
+    header->rng = env->rng;
+    header->scenario = snapshot_scenario(env);
+    EntityState* states = (EntityState*)(header + 1);
+    for (int i = 0; i < env->num_objects; i++) {
+        Entity* e = &env->entities[i];
+        EntityState* st = &states[i];
+        st->x = e->x;
+        st->y = e->y;
+        st->z = e->z;
+        st->vx = e->vx;
+        st->vy = e->vy;
+        st->vz = e->vz;
+        st->heading = e->heading;
+        st->heading_x = e->heading_x;
+        st->heading_y = e->heading_y;
+        st->goal_position_x = e->goal_position_x;
+        st->goal_position_y = e->goal_position_y;
+        st->goal_position_z = e->goal_position_z;
+        memcpy(st->metrics_array, e->metrics_array, sizeof(st->metrics_array));
+        st->cumulative_displacement = e->cumulative_displacement;
+        st->displacement_sample_count = e->displacement_sample_count;
+        st->collision_state = e->collision_state;
+        st->current_lane_idx = e->current_lane_idx;
+        st->valid = e->valid;
+        st->respawn_timestep = e->respawn_timestep;
+        st->collided_before_goal = e->collided_before_goal;
+        st->collision_timestep = e->collision_timestep;
+        st->sampled_new_goal = e->sampled_new_goal;
+        st->reached_goal_this_episode = e->reached_goal_this_episode;
+        st->num_goals_reached = e->num_goals_reached;
+    }
+    memcpy(states + env->num_objects, env->logs, env->active_agent_count*sizeof(Log));
+}
+
+// Restores a c_snapshot of this env and recomputes the agent grid and
+// observations. Returns -1, leaving env untouched, if the snapshot was
+// taken from a different map or agent selection.
+int c_restore(Drive* env, const void* buffer) {
+    if (!snapshot_matches(env, buffer)) {
+        return -1;
+    }
+    const SnapshotHeader* header = (const SnapshotHeader*)buffer;
+    env->timestep = header->timestep;
+    env->rng = header->rng;
+    const EntityState* states = (const EntityState*)(header + 1);
+    for (int i = 0; i < env->num_objects; i++) {
+        Entity* e = &env->entities[i];
+        const EntityState* st = &states[i];
+        e->x = st->x;
+        e->y = st->y;
+        e->z = st->z;
+        e->vx = st->vx;
+        e->vy = st->vy;
+        e->vz = st->vz;
+        e->heading = st->heading;
+        e->heading_x = st->heading_x;
+        e->heading_y = st->heading_y;
+        e->goal_position_x = st->goal_position_x;
+        e->goal_position_y = st->goal_position_y;
+        e->goal_position_z = st->goal_position_z;
+        memcpy(e->metrics_array, st->metrics_array, sizeof(e->metrics_array));
+        e->cumulative_displacement = st->cumulative_displacement;
+        e->displacement_sample_count = st->displacement_sample_count;
+        e->collision_state = st->collision_state;
+        e->current_lane_idx = st->current_lane_idx;
+        e->valid = st->valid;
+        e->respawn_timestep = st->respawn_timestep;
+        e->collided_before_goal = st->collided_before_goal;
+        e->collision_timestep = st->collision_timestep;
+        e->sampled_new_goal = st->sampled_new_goal;
+        e->reached_goal_this_episode = st->reached_goal_this_episode;
+        e->num_goals_reached = st->num_goals_reached;
+    }
+    memcpy(env->logs, states + env->num_objects, env->active_agent_count*sizeof(Log));
+    update_agent_grid(env);
+    compute_observations(env);
+    return 0;
+}
+
+// Makes fork a copy of env, including its mid-episode state, without
+// reloading the map. Trajectories, the road grid and neighbor cache, the
+// topology graph and the agent index lists are shared; the entity array,
+// per-agent logs and agent grid are the fork's own. fork must be zeroed
+// except for its observation, action, reward and terminal buffers, which
+// get the fork's observations.
+void fork_env(Drive* env, Drive* fork){
+    if (env->map_refs == NULL) {
+        env->map_refs = (int*)malloc(sizeof(int));
+        *env->map_refs = 1;
+    }
+    __atomic_add_fetch(env->map_refs, 1, __ATOMIC_ACQ_REL);
+
+    float* observations = fork->observations;
+    float* actions = fork->actions;
+    float* rewards = fork->rewards;
+    unsigned char* terminals = fork->terminals;
+    *fork = *env;
+    fork->observations = observations;
+    fork->actions = actions;
+    fork->rewards = rewards;
+    fork->terminals = terminals;
+    fork->client = NULL;
+    fork->recorder = NULL;
+    fork->log = (Log){0};
+    memset(&fork->profile, 0, sizeof(StepProfile));
+    clear_log_histograms(&fork->histograms);
+
+    fork->entities = (Entity*)malloc(env->num_entities*sizeof(Entity));
+    memcpy(fork->entities, env->entities, env->num_entities*sizeof(Entity));
+    fork->logs = (Log*)malloc(env->active_agent_count*sizeof(Log));
+    memcpy(fork->logs, env->logs, env->active_agent_count*sizeof(Log));
+    init_agent_grid(fork);
+    update_agent_grid(fork);
+    compute_observations(fork);
+}
+
 void respawn_agent(Drive* env, int agent_idx){
     env->entities[agent_idx].x = env->entities[agent_idx].traj_x[0];
     env->entities[agent_idx].y = env->entities[agent_idx].traj_y[0];
@@ -2018,15 +2841,27 @@ void respawn_agent(Drive* env, int agent_idx){
 }
 
 void c_step(Drive* env){
+    // Rows as the policy saw them: the observation acted on, with the
+    // reward and terminal returned alongside it
+    if (env->recorder) {
+        recorder_record(env->recorder, env->recorder_index,
+            env->observations, env->actions, env->rewards, env->terminals);
+    }
     memset(env->rewards, 0, env->active_agent_count * sizeof(float));
     memset(env->terminals, 0, env->active_agent_count * sizeof(unsigned char));
     env->timestep++;
     if(env->timestep == TRAJECTORY_LENGTH){
+        PROFILE_BEGIN(logging);
         add_log(env);
+        PROFILE_END(env, logging);
+        PROFILE_BEGIN(reset);
 	    c_reset(env);
+        PROFILE_END(env, reset);
         return;
     }
+    PROFILE_COUNT(env, steps, 1);
 
+    PROFILE_BEGIN(dynamics);
     // Move statix experts
     for (int i = 0; i < env->expert_static_car_count; i++) {
         int expert_idx = env->expert_static_car_indices[i];
@@ -2042,6 +2877,10 @@ void c_step(Drive* env){
         move_dynamics(env, i, agent_idx);
         // move_expert(env, env->actions, agent_idx);
     }
+    update_agent_grid(env);
+    PROFILE_END(env, dynamics);
+
+    PROFILE_BEGIN(metrics);
     for(int i = 0; i < env->active_agent_count; i++){
         int agent_idx = env->active_agent_indices[i];
         env->entities[agent_idx].collision_state = 0;
@@ -2060,6 +2899,9 @@ void c_step(Drive* env){
                     env->logs[i].clean_collision_rate = 1.0f;
                 }
                 env->logs[i].collision_rate = 1.0f;
+                if(env->entities[agent_idx].collision_timestep == -1){
+                    env->entities[agent_idx].collision_timestep = env->timestep;
+                }
             }
             else if(collision_state == OFFROAD){
                 env->rewards[i] = env->reward_offroad_collision;
@@ -2114,6 +2956,7 @@ void c_step(Drive* env){
             int reached_goal = env->entities[agent_idx].metrics_array[REACHED_GOAL_IDX];
             int collision_state = env->entities[agent_idx].collision_state;
             if(reached_goal){
+                PROFILE_COUNT(env, respawns, 1);
                 respawn_agent(env, agent_idx);
                 //env->entities[agent_idx].x = -10000;
                 //env->entities[agent_idx].y = -10000;
@@ -2121,8 +2964,12 @@ void c_step(Drive* env){
             }
         }
     }
+    PROFILE_END(env, metrics);
 
+    PROFILE_BEGIN(observations);
+    update_agent_grid(env);
     compute_observations(env);
+    PROFILE_END(env, observations);
 }
 
 const Color STONE_GRAY = (Color){80, 80, 80, 255};
@@ -2142,9 +2989,13 @@ struct Client {
     float camera_zoom;
     Camera3D camera;
     Model cars[6];
-    int car_assignments[MAX_AGENTS];  // To keep car model assignments consistent per vehicle
+    int* car_assignments;  // To keep car model assignments consistent per vehicle, one per object
     Vector3 default_camera_position;
     Vector3 default_camera_target;
+    uint64_t rng;           // UI randomness, kept apart from the env's stream
+    Model road_layer;       // Curbs of the map's road edges, see build_road_layer
+    bool has_road_layer;
+    bool road_layer_built;
 };
 
 Client* make_client(Drive* env){
@@ -2161,8 +3012,10 @@ Client* make_client(Drive* env){
     client->cars[3] = LoadModel("resources/drive/YellowCar.glb");
     client->cars[4] = LoadModel("resources/drive/GreenCar.glb");
     client->cars[5] = LoadModel("resources/drive/GreyCar.glb");
-    for (int i = 0; i < MAX_AGENTS; i++) {
-        client->car_assignments[i] = (rand() % 4) + 1;
+    client->car_assignments = (int*)malloc(env->num_objects * sizeof(int));
+    seed_rng(&client->rng, env->rng);
+    for (int i = 0; i < env->num_objects; i++) {
+        client->car_assignments[i] = rng_int(&client->rng, 4) + 1;
     }
     // Get initial target position from first active agent
     Vector3 target_pos = {
@@ -2277,7 +3130,7 @@ void draw_agent_obs(Drive* env, int agent_index, int mode, int obs_only, int las
         return;
     }
 
-    int max_obs = 7 + 7*(MAX_AGENTS - 1) + 7*MAX_ROAD_SEGMENT_OBSERVATIONS;
+    int max_obs = get_obs_size(env);
     float (*observations)[max_obs] = (float(*)[max_obs])env->observations;
     float* agent_obs = &observations[agent_index][0];
     // self
@@ -2302,7 +3155,7 @@ void draw_agent_obs(Drive* env, int agent_index, int mode, int obs_only, int las
     }
     // First draw other agent observations
     int obs_idx = 7;  // Start after goal distances
-    for(int j = 0; j < MAX_AGENTS - 1; j++) {
+    for(int j = 0; j < env->max_partner_observations; j++) {
         if(agent_obs[obs_idx] == 0 || agent_obs[obs_idx + 1] == 0) {
             obs_idx += 7;  // Move to next agent observation
             continue;
@@ -2449,7 +3302,7 @@ void draw_agent_obs(Drive* env, int agent_index, int mode, int obs_only, int las
         obs_idx += 7;  // Move to next agent observation (7 values per agent)
     }
     // Then draw map observations
-    int map_start_idx = 7 + 7*(MAX_AGENTS - 1);  // Start after agent observations
+    int map_start_idx = 7 + 7*env->max_partner_observations;  // Start after agent observations
     for(int k = 0; k < MAX_ROAD_SEGMENT_OBSERVATIONS; k++) {  // Loop through potential map entities
         int entity_idx = map_start_idx + k*7;
         if(agent_obs[entity_idx] == 0 && agent_obs[entity_idx + 1] == 0){
@@ -2499,7 +3352,11 @@ void draw_agent_obs(Drive* env, int agent_index, int mode, int obs_only, int las
     }
 }
 
-void draw_road_edge(Drive* env, float start_x, float start_y, float end_x, float end_y){
+// Vertices per road edge segment: a curb box of 14 triangles
+#define CURB_VERTICES 42
+
+// Writes the triangles of the curb along one road edge segment
+void road_edge_triangles(float start_x, float start_y, float end_x, float end_y, Vector3* vertices, Color* colors){
     Color CURB_TOP = (Color){220, 220, 220, 255};      // Top surface - lightest
     Color CURB_SIDE = (Color){180, 180, 180, 255};     // Side faces - medium
     Color CURB_BOTTOM = (Color){160, 160, 160, 255};
@@ -2554,28 +3411,96 @@ void draw_road_edge(Drive* env, float start_x, float start_y, float end_x, float
         road_z
     };
 
-    // Draw the curb faces
-    // Bottom face
-    DrawTriangle3D(b1, b2, b3, CURB_BOTTOM);
-    DrawTriangle3D(b1, b3, b4, CURB_BOTTOM);
-
-    // Top face (raised by curb_height)
+    // Top corners (raised by curb_height)
     Vector3 t1 = {b1.x, b1.y, b1.z + curb_height};
     Vector3 t2 = {b2.x, b2.y, b2.z + curb_height};
     Vector3 t3 = {b3.x, b3.y, b3.z + curb_height};
     Vector3 t4 = {b4.x, b4.y, b4.z + curb_height};
-    DrawTriangle3D(t1, t3, t2, CURB_TOP);
-    DrawTriangle3D(t1, t4, t3, CURB_TOP);
 
-    // Side faces
-    DrawTriangle3D(b1, t1, b2, CURB_SIDE);
-    DrawTriangle3D(t1, t2, b2, CURB_SIDE);
-    DrawTriangle3D(b2, t2, b3, CURB_SIDE);
-    DrawTriangle3D(t2, t3, b3, CURB_SIDE);
-    DrawTriangle3D(b3, t3, b4, CURB_SIDE);
-    DrawTriangle3D(t3, t4, b4, CURB_SIDE);
-    DrawTriangle3D(b4, t4, b1, CURB_SIDE);
-    DrawTriangle3D(t4, t1, b1, CURB_SIDE);
+    Vector3 triangles[CURB_VERTICES] = {
+        // Bottom face
+        b1, b2, b3,  b1, b3, b4,
+        // Top face
+        t1, t3, t2,  t1, t4, t3,
+        // Side faces
+        b1, t1, b2,  t1, t2, b2,
+        b2, t2, b3,  t2, t3, b3,
+        b3, t3, b4,  t3, t4, b4,
+        b4, t4, b1,  t4, t1, b1,
+    };
+    for (int i = 0; i < CURB_VERTICES; i++) {
+        vertices[i] = triangles[i];
+        colors[i] = i < 6 ? CURB_BOTTOM : (i < 12 ? CURB_TOP : CURB_SIDE);
+    }
+}
+
+void draw_road_edge(Drive* env, float start_x, float start_y, float end_x, float end_y){
+    Vector3 vertices[CURB_VERTICES];
+    Color colors[CURB_VERTICES];
+    road_edge_triangles(start_x, start_y, end_x, end_y, vertices, colors);
+    for (int i = 0; i < CURB_VERTICES; i += 3) {
+        DrawTriangle3D(vertices[i], vertices[i + 1], vertices[i + 2], colors[i]);
+    }
+}
+
+// Bakes the curbs of every road edge into one mesh. Map geometry is fixed
+// for the env's lifetime, so draw_scene uploads it once and then issues a
+// single draw call per frame instead of 14 immediate triangles per segment.
+void build_road_layer(Drive* env, Client* client){
+    int num_segments = 0;
+    for (int i = 0; i < env->num_entities; i++) {
+        if (env->entities[i].type != ROAD_EDGE) continue;
+        for (int j = 0; j < env->entities[i].array_size - 1; j++) {
+            num_segments++;
+        }
+    }
+    client->road_layer_built = true;
+    if (num_segments == 0) {
+        return;
+    }
+
+    Mesh mesh = {0};
+    mesh.vertices = (float*)MemAlloc(num_segments * CURB_VERTICES * 3 * sizeof(float));
+    mesh.colors = (unsigned char*)MemAlloc(num_segments * CURB_VERTICES * 4);
+    Vector3 vertices[CURB_VERTICES];
+    Color colors[CURB_VERTICES];
+    for (int i = 0; i < env->num_entities; i++) {
+        Entity* entity = &env->entities[i];
+        if (entity->type != ROAD_EDGE) continue;
+        for (int j = 0; j < entity->array_size - 1; j++) {
+            float dx = entity->traj_x[j + 1] - entity->traj_x[j];
+            float dy = entity->traj_y[j + 1] - entity->traj_y[j];
+            // Degenerate segments have no direction and would emit NaN vertices
+            if (dx == 0.0f && dy == 0.0f) continue;
+            road_edge_triangles(entity->traj_x[j], entity->traj_y[j],
+                entity->traj_x[j + 1], entity->traj_y[j + 1], vertices, colors);
+            for (int k = 0; k < CURB_VERTICES; k++) {
+                int v = mesh.vertexCount + k;
+                mesh.vertices[v*3 + 0] = vertices[k].x;
+                mesh.vertices[v*3 + 1] = vertices[k].y;
+                mesh.vertices[v*3 + 2] = vertices[k].z;
+                memcpy(&mesh.colors[v*4], &colors[k], 4);
+            }
+            mesh.vertexCount += CURB_VERTICES;
+        }
+    }
+    if (mesh.vertexCount == 0) {
+        MemFree(mesh.vertices);
+        MemFree(mesh.colors);
+        return;
+    }
+    mesh.triangleCount = mesh.vertexCount / 3;
+    UploadMesh(&mesh, false);
+    client->road_layer = LoadModelFromMesh(mesh);
+    client->has_road_layer = true;
+}
+
+void unload_road_layer(Client* client){
+    if (client->has_road_layer) {
+        UnloadModel(client->road_layer);
+    }
+    client->has_road_layer = false;
+    client->road_layer_built = false;
 }
 
 void draw_scene(Drive* env, Client* client, int mode, int obs_only, int lasers, int show_grid){
@@ -2703,7 +3628,8 @@ void draw_scene(Drive* env, Client* client, int mode, int obs_only, int lasers,
                 Color outline_color = PUFF_CYAN;        // not used for model tint
                 Model car_model = client->cars[5];
                 if(is_active_agent){
-                    car_model = client->cars[client->car_assignments[i %64]];
+                    // Clients made without make_client have no assignments
+                    car_model = client->cars[client->car_assignments ? client->car_assignments[i] : 0];
                 }
                 if(agent_index == env->human_agent_idx){
                     object_color = PUFF_CYAN;
@@ -2762,7 +3688,7 @@ void draw_scene(Drive* env, Client* client, int mode, int obs_only, int lasers,
             // FPV Camera Control
             if(IsKeyDown(KEY_SPACE) && env->human_agent_idx== agent_index){
                 if(env->entities[agent_index].metrics_array[REACHED_GOAL_IDX]){
-                    env->human_agent_idx = rand() % env->active_agent_count;
+                    env->human_agent_idx = rng_int(&client->rng, env->active_agent_count);
                 }
                 Vector3 camera_position = (Vector3){
                         position.x - (25.0f * cosf(heading)),
@@ -2803,32 +3729,15 @@ void draw_scene(Drive* env, Client* client, int mode, int obs_only, int lasers,
                 }, env->goal_radius, (Vector3){0, 0, 1}, 90.0f, Fade(LIGHTGREEN, 0.3f));
             }
         }
-        // Draw road elements
-        if(env->entities[i].type <=3 && env->entities[i].type >= 7){
-            continue;
+    }
+    // Draw road elements. Only road edges are drawn, as curbs baked into
+    // the static road layer on first use.
+    if(!IsKeyDown(KEY_LEFT_CONTROL) && obs_only==0){
+        if(!client->road_layer_built){
+            build_road_layer(env, client);
         }
-        for(int j = 0; j < env->entities[i].array_size - 1; j++) {
-            Vector3 start = {
-                env->entities[i].traj_x[j],
-                env->entities[i].traj_y[j],
-                1
-            };
-            Vector3 end = {
-                env->entities[i].traj_x[j + 1],
-                env->entities[i].traj_y[j + 1],
-                1
-            };
-            Color lineColor = GRAY;
-            if (env->entities[i].type == ROAD_LANE) lineColor = GRAY;
-            else if (env->entities[i].type == ROAD_LINE) lineColor = BLUE;
-            else if (env->entities[i].type == ROAD_EDGE) lineColor = WHITE;
-            else if (env->entities[i].type == DRIVEWAY) lineColor = RED;
-            if(env->entities[i].type != ROAD_EDGE){
-                continue;
-            }
-            if(!IsKeyDown(KEY_LEFT_CONTROL) && obs_only==0){
-                draw_road_edge(env, start.x, start.y, end.x, end.y);
-            }
+        if(client->has_road_layer){
+            DrawModel(client->road_layer, (Vector3){0, 0, 0}, 1.0f, WHITE);
         }
     }
     if(show_grid) {
@@ -2981,10 +3890,12 @@ void c_render(Drive* env) {
 }
 
 void close_client(Client* client){
+    unload_road_layer(client);
     for (int i = 0; i < 6; i++) {
         UnloadModel(client->cars[i]);
     }
     UnloadTexture(client->puffers);
     CloseWindow();
+    free(client->car_assignments);
     free(client);
 }
@@ -32,6 +32,8 @@ class Drive(pufferlib.PufferEnv):
         deterministic_agent_selection=False,
         use_goal_generation=False,
         control_non_vehicles=False,
+        persist_trajectory_cache=False,
+        max_partner_observations=63,
         buf=None,
         seed=1,
         init_steps=0,
@@ -50,9 +52,11 @@ class Drive(pufferlib.PufferEnv):
         self.spawn_immunity_timer = spawn_immunity_timer
         self.human_agent_idx = human_agent_idx
         self.control_non_vehicles = control_non_vehicles
+        self.persist_trajectory_cache = persist_trajectory_cache
         self.use_goal_generation = use_goal_generation
         self.resample_frequency = resample_frequency
-        self.num_obs = 7 + 63 * 7 + 200 * 7
+        self.max_partner_observations = max_partner_observations
+        self.num_obs = 7 + max_partner_observations * 7 + 200 * 7
         self.single_observation_space = gymnasium.spaces.Box(low=-1, high=1, shape=(self.num_obs,), dtype=np.float32)
         self.init_steps = init_steps
 
@@ -64,6 +68,8 @@ class Drive(pufferlib.PufferEnv):
             raise ValueError(f"action_space must be 'discrete' or 'continuous'. Got: {action_type}")
 
         self._action_type_flag = 0 if action_type == "discrete" else 1
+        # Parsed once and shared by every env_init, including resamples
+        self._config = binding.env_config("pufferlib/config/ocean/drive.ini")
 
         # Check if resources directory exists
         binary_path = "resources/drive/binaries/map_000.bin"
@@ -94,39 +100,29 @@ class Drive(pufferlib.PufferEnv):
         self.map_ids = map_ids
         self.num_envs = num_envs
         super().__init__(buf=buf)
-        env_ids = []
-        for i in range(num_envs):
-            cur = agent_offsets[i]
-            nxt = agent_offsets[i + 1]
-            env_id = binding.env_init(
-                self.observations[cur:nxt],
-                self.actions[cur:nxt],
-                self.rewards[cur:nxt],
-                self.terminals[cur:nxt],
-                self.truncations[cur:nxt],
-                seed,
-                action_type=self._action_type_flag,
-                human_agent_idx=human_agent_idx,
-                reward_vehicle_collision=reward_vehicle_collision,
-                reward_offroad_collision=reward_offroad_collision,
-                reward_goal=reward_goal,
-                reward_goal_post_respawn=reward_goal_post_respawn,
-                reward_vehicle_collision_post_respawn=reward_vehicle_collision_post_respawn,
-                reward_ade=reward_ade,
-                goal_radius=goal_radius,
-                spawn_immunity_timer=spawn_immunity_timer,
-                control_all_agents=1 if self.control_all_agents else 0,
-                num_policy_controlled_agents=self.num_policy_controlled_agents,
-                deterministic_agent_selection=1 if self.deterministic_agent_selection else 0,
-                map_id=map_ids[i],
-                max_agents=nxt - cur,
-                ini_file="pufferlib/config/ocean/drive.ini",
-                control_non_vehicles=int(control_non_vehicles),
-                init_steps=init_steps,
-            )
-            env_ids.append(env_id)
-
-        self.c_envs = binding.vectorize(*env_ids)
+        self.c_envs = self._vec_init(agent_offsets, map_ids, seed)
+
+    def _vec_init(self, agent_offsets, map_ids, seed):
+        """Build every env in one C call. Maps load in parallel with the GIL released."""
+        return binding.vec_init_drive(
+            self.observations,
+            self.actions,
+            self.rewards,
+            self.terminals,
+            self.truncations,
+            np.asarray(map_ids, dtype=np.int32),
+            np.asarray(agent_offsets, dtype=np.int32),
+            seed,
+            config=self._config,
+            human_agent_idx=self.human_agent_idx,
+            control_all_agents=1 if self.control_all_agents else 0,
+            num_policy_controlled_agents=self.num_policy_controlled_agents,
+            deterministic_agent_selection=1 if self.deterministic_agent_selection else 0,
+            control_non_vehicles=int(self.control_non_vehicles),
+            persist_trajectory_cache=int(self.persist_trajectory_cache),
+            max_partner_observations=self.max_partner_observations,
+            init_steps=self.init_steps,
+        )
 
     def reset(self, seed=0):
         binding.vec_reset(self.c_envs, seed)
@@ -137,6 +133,40 @@ class Drive(pufferlib.PufferEnv):
         self.terminals[:] = 0
         self.actions[:] = actions
         binding.vec_step(self.c_envs)
+        info = self._end_step()
+        return (self.observations, self.rewards, self.terminals, self.truncations, info)
+
+    def async_init(self, num_threads=2):
+        """Start C worker threads and allocate a second buffer set (slot 1) for step_async/wait.
+        Slot 0 is the regular observations/actions/rewards/terminals buffers."""
+        self.async_threads = num_threads
+        self.async_buffers = [
+            (self.observations, self.actions, self.rewards, self.terminals),
+            tuple(np.zeros_like(b) for b in (self.observations, self.actions, self.rewards, self.terminals)),
+        ]
+        self.async_slot = None
+        binding.vec_async_init(self.c_envs, num_threads, *self.async_buffers[0], *self.async_buffers[1])
+
+    def step_async(self, actions, slot):
+        """Step all envs on the worker threads with actions written into slot.
+        Results land in the same slot; run inference on the other slot meanwhile."""
+        observations, slot_actions, rewards, terminals = self.async_buffers[slot]
+        slot_actions[:] = actions
+        binding.vec_step_async(self.c_envs, slot)
+        self.async_slot = slot
+
+    def wait(self):
+        """Block until the step started by step_async is done and return its slot"""
+        binding.vec_wait(self.c_envs)
+        observations, actions, rewards, terminals = self.async_buffers[self.async_slot]
+        info = self._end_step()
+        if self.tick == 0 and self.async_slot != 0:
+            # Resampling reset the envs into slot 0
+            observations[:] = self.observations
+            terminals[:] = 1
+        return (observations, rewards, terminals, self.truncations, info)
+
+    def _end_step(self):
         self.tick += 1
         info = []
         if self.tick % self.report_interval == 0:
@@ -146,53 +176,38 @@ class Drive(pufferlib.PufferEnv):
                 # print(log)
         if self.tick > 0 and self.resample_frequency > 0 and self.tick % self.resample_frequency == 0:
             self.tick = 0
-            will_resample = 1
-            if will_resample:
-                binding.vec_close(self.c_envs)
-                agent_offsets, map_ids, num_envs = binding.shared(
-                    num_agents=self.num_agents,
-                    num_maps=self.num_maps,
-                    num_policy_controlled_agents=self.num_policy_controlled_agents,
-                    control_all_agents=1 if self.control_all_agents else 0,
-                    deterministic_agent_selection=1 if self.deterministic_agent_selection else 0,
-                )
-                env_ids = []
-                seed = np.random.randint(0, 2**32 - 1)
-                for i in range(num_envs):
-                    cur = agent_offsets[i]
-                    nxt = agent_offsets[i + 1]
-                    env_id = binding.env_init(
-                        self.observations[cur:nxt],
-                        self.actions[cur:nxt],
-                        self.rewards[cur:nxt],
-                        self.terminals[cur:nxt],
-                        self.truncations[cur:nxt],
-                        seed,
-                        action_type=self._action_type_flag,
-                        human_agent_idx=self.human_agent_idx,
-                        reward_vehicle_collision=self.reward_vehicle_collision,
-                        reward_offroad_collision=self.reward_offroad_collision,
-                        reward_goal=self.reward_goal,
-                        reward_goal_post_respawn=self.reward_goal_post_respawn,
-                        reward_vehicle_collision_post_respawn=self.reward_vehicle_collision_post_respawn,
-                        reward_ade=self.reward_ade,
-                        goal_radius=self.goal_radius,
-                        spawn_immunity_timer=self.spawn_immunity_timer,
-                        control_all_agents=1 if self.control_all_agents else 0,
-                        num_policy_controlled_agents=self.num_policy_controlled_agents,
-                        deterministic_agent_selection=1 if self.deterministic_agent_selection else 0,
-                        map_id=map_ids[i],
-                        max_agents=nxt - cur,
-                        ini_file="pufferlib/config/ocean/drive.ini",
-                        control_non_vehicles=int(self.control_non_vehicles),
-                        init_steps=self.init_steps,
-                    )
-                    env_ids.append(env_id)
-                self.c_envs = binding.vectorize(*env_ids)
-
-                binding.vec_reset(self.c_envs, seed)
-                self.terminals[:] = 1
-        return (self.observations, self.rewards, self.terminals, self.truncations, info)
+            self._resample()
+        return info
+
+    def _resample(self):
+        # Keep an active recording open across the new envs
+        recording = binding.vec_record_detach(self.c_envs)
+        binding.vec_close(self.c_envs)
+        agent_offsets, map_ids, num_envs = binding.shared(
+            num_agents=self.num_agents,
+            num_maps=self.num_maps,
+            num_policy_controlled_agents=self.num_policy_controlled_agents,
+            control_all_agents=1 if self.control_all_agents else 0,
+            deterministic_agent_selection=1 if self.deterministic_agent_selection else 0,
+        )
+        seed = np.random.randint(0, 2**32 - 1)
+        self.c_envs = self._vec_init(agent_offsets, map_ids, seed)
+        if recording is not None:
+            binding.vec_record_attach(self.c_envs, recording)
+
+        binding.vec_reset(self.c_envs, seed)
+        self.terminals[:] = 1
+        if getattr(self, "async_buffers", None) is not None:
+            binding.vec_async_init(self.c_envs, self.async_threads, *self.async_buffers[0], *self.async_buffers[1])
+
+    def record(self, path, chunk_steps=32):
+        """Stream every step's observations, actions, rewards and terminals to path
+        from C, across resamples, until stop_recording or close. Load it back with
+        binding.read_trajectories."""
+        binding.vec_record(self.c_envs, path, chunk_steps)
+
+    def stop_recording(self):
+        binding.vec_record(self.c_envs, None)
 
     def render(self):
         binding.vec_render(self.c_envs, 0)
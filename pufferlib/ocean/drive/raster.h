@@ -0,0 +1,271 @@
+#ifndef DRIVE_RASTER_H
+#define DRIVE_RASTER_H
+
+// CPU rasterizer for the top-down view. Draws the layers renderTopDownView
+// shows (map bounds, road edges, log trajectories, goals and agent boxes)
+// into an RGBA buffer with no raylib window or GL context, so frames can be
+// made on headless nodes. Holds no global state: threads may render
+// different frames concurrently. Include after drive.h.
+
+typedef struct RasterFrame RasterFrame;
+struct RasterFrame {
+    int width;
+    int height;
+    float scale;            // pixels per world unit
+    unsigned char* pixels;  // RGBA rows, top row first, as ffmpeg rawvideo rgba expects
+    int owns_pixels;
+};
+
+static const Color RASTER_BACKGROUND = (Color){35, 35, 37, 255};
+static const Color RASTER_CURB = (Color){220, 220, 220, 255};
+
+// Frame size for env's map, matching eval_gif: map extent times scale,
+// rounded to even dimensions for the video encoder
+static inline void raster_frame_size(Drive* env, float scale, int* width, int* height) {
+    float map_width = env->grid_map->bottom_right_x - env->grid_map->top_left_x;
+    float map_height = env->grid_map->top_left_y - env->grid_map->bottom_right_y;
+    *width = (int)roundf(map_width * scale / 2.0f) * 2;
+    *height = (int)roundf(map_height * scale / 2.0f) * 2;
+}
+
+// Wraps pixels (or allocates them when NULL) as a frame for env's map
+RasterFrame* make_raster_frame(Drive* env, float scale, unsigned char* pixels) {
+    RasterFrame* frame = (RasterFrame*)calloc(1, sizeof(RasterFrame));
+    raster_frame_size(env, scale, &frame->width, &frame->height);
+    // Same vertical extent as the orthographic camera, whose fovy is the map height
+    float map_height = env->grid_map->top_left_y - env->grid_map->bottom_right_y;
+    frame->scale = frame->height / map_height;
+    frame->owns_pixels = pixels == NULL;
+    frame->pixels = pixels != NULL ? pixels : (unsigned char*)malloc((size_t)frame->width * frame->height * 4);
+    return frame;
+}
+
+void free_raster_frame(RasterFrame* frame) {
+    if (frame->owns_pixels) {
+        free(frame->pixels);
+    }
+    free(frame);
+}
+
+// World to pixel coordinates. The camera is centered on the world origin
+// and looks down with -y up, so both axes are mirrored like the raylib view.
+static inline float raster_px(RasterFrame* frame, float x) {
+    return 0.5f*frame->width - x*frame->scale;
+}
+
+static inline float raster_py(RasterFrame* frame, float y) {
+    return 0.5f*frame->height + y*frame->scale;
+}
+
+static inline void raster_blend(RasterFrame* frame, int x, int y, Color color, float coverage) {
+    unsigned char* p = &frame->pixels[((size_t)y*frame->width + x)*4];
+    float a = coverage * color.a / 255.0f;
+    p[0] = (unsigned char)(p[0] + (color.r - p[0])*a + 0.5f);
+    p[1] = (unsigned char)(p[1] + (color.g - p[1])*a + 0.5f);
+    p[2] = (unsigned char)(p[2] + (color.b - p[2])*a + 0.5f);
+    p[3] = 255;
+}
+
+static inline float raster_clamp01(float v) {
+    return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+}
+
+// Clips a pixel-space box to the frame. Returns 0 when nothing is visible.
+static inline int raster_clip(RasterFrame* frame, float min_x, float min_y, float max_x, float max_y,
+        int* x0, int* y0, int* x1, int* y1) {
+    *x0 = (int)floorf(min_x) < 0 ? 0 : (int)floorf(min_x);
+    *y0 = (int)floorf(min_y) < 0 ? 0 : (int)floorf(min_y);
+    *x1 = (int)ceilf(max_x) > frame->width - 1 ? frame->width - 1 : (int)ceilf(max_x);
+    *y1 = (int)ceilf(max_y) > frame->height - 1 ? frame->height - 1 : (int)ceilf(max_y);
+    return *x0 <= *x1 && *y0 <= *y1;
+}
+
+// Antialiased segment of the given half width, in pixels
+static void raster_segment(RasterFrame* frame, float ax, float ay, float bx, float by,
+        float half_width, Color color) {
+    float pad = half_width + 1.0f;
+    int x0, y0, x1, y1;
+    if (!raster_clip(frame, fminf(ax, bx) - pad, fminf(ay, by) - pad,
+            fmaxf(ax, bx) + pad, fmaxf(ay, by) + pad, &x0, &y0, &x1, &y1)) {
+        return;
+    }
+    float dx = bx - ax;
+    float dy = by - ay;
+    float len2 = dx*dx + dy*dy;
+    float inv_len2 = len2 > 0.0f ? 1.0f/len2 : 0.0f;
+    for (int y = y0; y <= y1; y++) {
+        float py = y + 0.5f;
+        for (int x = x0; x <= x1; x++) {
+            float px = x + 0.5f;
+            float t = raster_clamp01(((px - ax)*dx + (py - ay)*dy)*inv_len2);
+            float ex = px - (ax + t*dx);
+            float ey = py - (ay + t*dy);
+            float coverage = raster_clamp01(half_width + 0.5f - sqrtf(ex*ex + ey*ey));
+            if (coverage > 0.0f) {
+                raster_blend(frame, x, y, color, coverage);
+            }
+        }
+    }
+}
+
+// Antialiased filled disc (ring_half_width <= 0) or ring of radius r, in pixels
+static void raster_circle(RasterFrame* frame, float cx, float cy, float r,
+        float ring_half_width, Color color) {
+    float pad = r + (ring_half_width > 0.0f ? ring_half_width : 0.0f) + 1.0f;
+    int x0, y0, x1, y1;
+    if (!raster_clip(frame, cx - pad, cy - pad, cx + pad, cy + pad, &x0, &y0, &x1, &y1)) {
+        return;
+    }
+    for (int y = y0; y <= y1; y++) {
+        float py = y + 0.5f - cy;
+        for (int x = x0; x <= x1; x++) {
+            float px = x + 0.5f - cx;
+            float d = sqrtf(px*px + py*py);
+            float coverage = ring_half_width > 0.0f
+                ? raster_clamp01(ring_half_width + 0.5f - fabsf(d - r))
+                : raster_clamp01(r + 0.5f - d);
+            if (coverage > 0.0f) {
+                raster_blend(frame, x, y, color, coverage);
+            }
+        }
+    }
+}
+
+static inline void raster_world_segment(RasterFrame* frame, float ax, float ay, float bx, float by,
+        float half_width, Color color) {
+    raster_segment(frame, raster_px(frame, ax), raster_py(frame, ay),
+        raster_px(frame, bx), raster_py(frame, by), half_width, color);
+}
+
+// Renders env's current state top-down into frame
+void raster_topdown(Drive* env, RasterFrame* frame, int log_trajectories) {
+    size_t num_pixels = (size_t)frame->width * frame->height;
+    for (size_t i = 0; i < num_pixels; i++) {
+        memcpy(&frame->pixels[i*4], &RASTER_BACKGROUND, 4);
+    }
+
+    GridMap* grid = env->grid_map;
+    raster_world_segment(frame, grid->top_left_x, grid->top_left_y, grid->bottom_right_x, grid->top_left_y, 0.5f, PUFF_CYAN);
+    raster_world_segment(frame, grid->top_left_x, grid->bottom_right_y, grid->top_left_x, grid->top_left_y, 0.5f, PUFF_CYAN);
+    raster_world_segment(frame, grid->bottom_right_x, grid->bottom_right_y, grid->bottom_right_x, grid->top_left_y, 0.5f, PUFF_CYAN);
+    raster_world_segment(frame, grid->top_left_x, grid->bottom_right_y, grid->bottom_right_x, grid->bottom_right_y, 0.5f, PUFF_CYAN);
+
+    if (log_trajectories) {
+        Color log_color = Fade(LIGHTGREEN, 0.6f);
+        for (int i = 0; i < env->active_agent_count; i++) {
+            Entity* e = &env->entities[env->active_agent_indices[i]];
+            for (int j = env->init_steps; j < TRAJECTORY_LENGTH - 1; j++) {
+                if (!e->traj_valid[j] || !e->traj_valid[j + 1]) continue;
+                raster_world_segment(frame, e->traj_x[j], e->traj_y[j],
+                    e->traj_x[j + 1], e->traj_y[j + 1], 0.5f, log_color);
+            }
+        }
+    }
+
+    // Road edges are drawn as the top face of the curb road_edge_triangles builds
+    float curb_half_width = fmaxf(0.15f*frame->scale, 0.5f);
+    for (int i = 0; i < env->num_entities; i++) {
+        Entity* e = &env->entities[i];
+        if (e->type != ROAD_EDGE) continue;
+        for (int j = 0; j < e->array_size - 1; j++) {
+            raster_world_segment(frame, e->traj_x[j], e->traj_y[j],
+                e->traj_x[j + 1], e->traj_y[j + 1], curb_half_width, RASTER_CURB);
+        }
+    }
+
+    // 1 for active agents, 2 for static cars
+    unsigned char* role = (unsigned char*)calloc(env->num_entities, 1);
+    for (int j = 0; j < env->active_agent_count; j++) role[env->active_agent_indices[j]] = 1;
+    for (int j = 0; j < env->static_car_count; j++) {
+        if (role[env->static_car_indices[j]] == 0) role[env->static_car_indices[j]] = 2;
+    }
+
+    Color goal_ring = Fade(LIGHTGREEN, 0.3f);
+    for (int i = 0; i < env->num_entities; i++) {
+        Entity* e = &env->entities[i];
+        if (role[i] != 1 || e->valid == 0 || e->respawn_timestep != -1) continue;
+        float gx = raster_px(frame, e->goal_position_x);
+        float gy = raster_py(frame, e->goal_position_y);
+        raster_circle(frame, gx, gy, env->goal_radius*frame->scale, 0.75f, goal_ring);
+        raster_circle(frame, gx, gy, 0.5f*frame->scale, 0.0f, DARKGREEN);
+    }
+
+    for (int i = 0; i < env->num_entities; i++) {
+        Entity* e = &env->entities[i];
+        // Hidden while respawning, as in draw_scene
+        if (role[i] == 0 || e->respawn_timestep != -1) continue;
+        int is_active_agent = role[i] == 1;
+        Color color = GRAY;
+        if (!is_active_agent && e->mark_as_expert == 1) color = GOLD;
+        if (is_active_agent) color = BLUE;
+        if (is_active_agent && e->collision_state > 0) color = RED;
+
+        float cos_heading = e->heading_x;
+        float sin_heading = e->heading_y;
+        float half_len = e->length * 0.5f;
+        float half_width = e->width * 0.5f;
+        float corners[4][2] = {
+            { half_len*cos_heading - half_width*sin_heading,  half_len*sin_heading + half_width*cos_heading},
+            { half_len*cos_heading + half_width*sin_heading,  half_len*sin_heading - half_width*cos_heading},
+            {-half_len*cos_heading + half_width*sin_heading, -half_len*sin_heading - half_width*cos_heading},
+            {-half_len*cos_heading - half_width*sin_heading, -half_len*sin_heading + half_width*cos_heading},
+        };
+        for (int j = 0; j < 4; j++) {
+            int k = (j + 1) % 4;
+            raster_world_segment(frame, e->x + corners[j][0], e->y + corners[j][1],
+                e->x + corners[k][0], e->y + corners[k][1], 1.5f, color);
+        }
+        float tip_x = e->x + cos_heading*half_len*1.5f;
+        float tip_y = e->y + sin_heading*half_len*1.5f;
+        raster_world_segment(frame, e->x, e->y, tip_x, tip_y, 0.75f, color);
+        raster_circle(frame, raster_px(frame, tip_x), raster_py(frame, tip_y), 0.2f*frame->scale, 0.0f, color);
+    }
+    free(role);
+}
+
+typedef struct {
+    Drive** envs;
+    RasterFrame** frames;
+    int num_frames;
+    int log_trajectories;
+    int next_frame;  // claimed by workers with an atomic add
+} RasterBatch;
+
+static void* raster_batch_worker(void* arg) {
+    RasterBatch* batch = (RasterBatch*)arg;
+    int i;
+    while ((i = __atomic_fetch_add(&batch->next_frame, 1, __ATOMIC_RELAXED)) < batch->num_frames) {
+        raster_topdown(batch->envs[i], batch->frames[i], batch->log_trajectories);
+    }
+    return NULL;
+}
+
+// Renders frames[i] from envs[i] for every i on num_threads threads,
+// including the caller
+void raster_topdown_batch(Drive** envs, RasterFrame** frames, int num_frames,
+        int num_threads, int log_trajectories) {
+    RasterBatch batch = {
+        .envs = envs,
+        .frames = frames,
+        .num_frames = num_frames,
+        .log_trajectories = log_trajectories,
+        .next_frame = 0,
+    };
+    if (num_threads > num_frames) num_threads = num_frames;
+    if (num_threads < 1) num_threads = 1;
+    pthread_t* threads = (pthread_t*)calloc(num_threads, sizeof(pthread_t));
+    int started = 0;
+    for (int t = 1; t < num_threads; t++) {
+        if (pthread_create(&threads[t], NULL, raster_batch_worker, &batch) != 0) {
+            break;
+        }
+        started = t;
+    }
+    raster_batch_worker(&batch);
+    for (int t = 1; t <= started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+}
+
+#endif
@@ -0,0 +1,380 @@
+#ifndef DRIVE_RECORDER_H
+#define DRIVE_RECORDER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Streams the (observation, action, reward, terminal) rows of every agent in
+// a vec env to a columnar file without going through Python. c_step copies
+// its env's rows into the chunk being filled; once every agent row holds
+// chunk_steps steps the chunk goes to a writer thread, which compresses each
+// column and appends it to the file while the envs fill the next chunk.
+//
+// The recorder is refcounted by the envs attached to it plus any holds.
+// Closing a vec env drops its envs, so a recording ends with its vec env
+// unless it is held across the close and attached to the next one, which
+// is what Drive does on every resample. Rows are buffer rows, so the next
+// vec env must have the same total agent count; how they split into envs
+// may change at any step.
+//
+// File layout, little endian:
+//   RecorderHeader
+//   per chunk: uint32 steps, then for the observation, action, reward and
+//   terminal columns in that order: uint64 word count, zero run encoded words
+// Columns are [steps][num_agents][width] with agents in vec env order.
+// Actions hold int32 or float32 bits per float_actions. Terminals are one
+// byte per row, zero padded to a whole word before encoding.
+
+#define RECORDER_MAGIC 0x52544450  // "PDTR"
+#define RECORDER_VERSION 1
+#define RECORDER_RING_SIZE 2
+#define RECORDER_COLUMNS 4
+
+typedef struct RecorderHeader RecorderHeader;
+struct RecorderHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_agents;
+    uint32_t obs_size;
+    uint32_t action_size;
+    uint32_t float_actions;
+};
+
+typedef struct RecorderChunk RecorderChunk;
+struct RecorderChunk {
+    float* observations;
+    uint32_t* actions;
+    float* rewards;
+    unsigned char* terminals;
+    long chunk;  // index of the chunk this slot is filling
+    long done;   // agent rows written into it
+    int ready;   // complete and waiting for the writer
+};
+
+typedef struct RecorderEnv RecorderEnv;
+struct RecorderEnv {
+    int row;     // first agent row of the env
+    int agents;
+    long steps;  // only touched by the thread stepping the env
+};
+
+typedef struct TrajectoryRecorder TrajectoryRecorder;
+struct TrajectoryRecorder {
+    FILE* file;
+    RecorderHeader header;
+    int num_envs;      // attached envs, see recorder_attach
+    int chunk_steps;
+    RecorderEnv* envs;
+    RecorderChunk ring[RECORDER_RING_SIZE];
+    uint32_t* scratch;  // encoder output, owned by the writer thread
+    long next_flush;
+    int refs;
+    int closing;
+    int failed;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t writer;
+};
+
+// Zero run encoding over 32-bit words: pairs of (zeros, literals) counts,
+// each pair followed by its literal words. Padded observation slots are
+// exact zeros, which is where most of the size goes. Output needs at most
+// 2*n + 2 words.
+size_t zero_run_encode(const uint32_t* in, size_t n, uint32_t* out) {
+    size_t i = 0;
+    size_t o = 0;
+    while (i < n) {
+        uint32_t zeros = 0;
+        while (i < n && in[i] == 0) {
+            zeros++;
+            i++;
+        }
+        size_t start = i;
+        while (i < n && !(in[i] == 0 && (i + 1 == n || in[i + 1] == 0))) {
+            i++;
+        }
+        uint32_t literals = (uint32_t)(i - start);
+        out[o++] = zeros;
+        out[o++] = literals;
+        memcpy(out + o, in + start, literals*sizeof(uint32_t));
+        o += literals;
+    }
+    return o;
+}
+
+// Returns 0 if in decodes to exactly n words, -1 otherwise
+int zero_run_decode(const uint32_t* in, size_t in_words, uint32_t* out, size_t n) {
+    size_t i = 0;
+    size_t o = 0;
+    while (i + 2 <= in_words) {
+        size_t zeros = in[i++];
+        size_t literals = in[i++];
+        if (zeros > n - o || literals > n - o - zeros || literals > in_words - i) {
+            return -1;
+        }
+        memset(out + o, 0, zeros*sizeof(uint32_t));
+        o += zeros;
+        memcpy(out + o, in + i, literals*sizeof(uint32_t));
+        o += literals;
+        i += literals;
+    }
+    return (i == in_words && o == n) ? 0 : -1;
+}
+
+static inline size_t recorder_terminal_words(size_t rows) {
+    return (rows + sizeof(uint32_t) - 1)/sizeof(uint32_t);
+}
+
+static inline size_t recorder_column_words(const RecorderHeader* h, int column, size_t steps) {
+    size_t rows = steps*h->num_agents;
+    switch (column) {
+        case 0: return rows*h->obs_size;
+        case 1: return rows*h->action_size;
+        case 2: return rows;
+        default: return recorder_terminal_words(rows);
+    }
+}
+
+static int recorder_write_chunk(TrajectoryRecorder* rec, RecorderChunk* c, int steps) {
+    size_t rows = (size_t)steps*rec->header.num_agents;
+    // Bytes past the last terminal row are left from earlier chunks
+    memset(c->terminals + rows, 0, recorder_terminal_words(rows)*sizeof(uint32_t) - rows);
+    const uint32_t* columns[RECORDER_COLUMNS] = {
+        (const uint32_t*)c->observations, c->actions, (const uint32_t*)c->rewards, (const uint32_t*)c->terminals,
+    };
+    uint32_t header = (uint32_t)steps;
+    if (fwrite(&header, sizeof(header), 1, rec->file) != 1) return -1;
+    for (int col = 0; col < RECORDER_COLUMNS; col++) {
+        uint64_t words = zero_run_encode(columns[col], recorder_column_words(&rec->header, col, steps), rec->scratch);
+        if (fwrite(&words, sizeof(words), 1, rec->file) != 1) return -1;
+        if (fwrite(rec->scratch, sizeof(uint32_t), words, rec->file) != words) return -1;
+    }
+    return 0;
+}
+
+static void* recorder_writer(void* arg) {
+    TrajectoryRecorder* rec = (TrajectoryRecorder*)arg;
+    pthread_mutex_lock(&rec->lock);
+    for (;;) {
+        RecorderChunk* c = &rec->ring[rec->next_flush % RECORDER_RING_SIZE];
+        while (!c->ready && !rec->closing) {
+            pthread_cond_wait(&rec->cond, &rec->lock);
+        }
+        if (!c->ready) break;
+        pthread_mutex_unlock(&rec->lock);
+        // Keep draining after a failed write so stepping never blocks on it
+        if (!rec->failed && recorder_write_chunk(rec, c, rec->chunk_steps) != 0) {
+            fprintf(stderr, "Trajectory recorder: write failed, dropping the rest of the recording\n");
+            rec->failed = 1;
+        }
+        pthread_mutex_lock(&rec->lock);
+        c->ready = 0;
+        c->done = 0;
+        c->chunk += RECORDER_RING_SIZE;
+        rec->next_flush++;
+        pthread_cond_broadcast(&rec->cond);
+    }
+    pthread_mutex_unlock(&rec->lock);
+    return NULL;
+}
+
+static void free_recorder(TrajectoryRecorder* rec) {
+    for (int i = 0; i < RECORDER_RING_SIZE; i++) {
+        free(rec->ring[i].observations);
+        free(rec->ring[i].actions);
+        free(rec->ring[i].rewards);
+        free(rec->ring[i].terminals);
+    }
+    free(rec->scratch);
+    free(rec->envs);
+    if (rec->file) fclose(rec->file);
+    free(rec);
+}
+
+// Opens path and starts the writer thread. Each of the RECORDER_RING_SIZE
+// chunks holds chunk_steps steps of num_agents rows, so memory grows with
+// chunk_steps*num_agents*obs_size. The recorder starts with no envs and
+// one hold for the caller to release after recorder_attach. Returns NULL
+// if the file, buffers or writer thread can't be made.
+TrajectoryRecorder* recorder_open(const char* path, int num_agents, int obs_size,
+        int action_size, int float_actions, int chunk_steps) {
+    TrajectoryRecorder* rec = (TrajectoryRecorder*)calloc(1, sizeof(TrajectoryRecorder));
+    if (!rec) return NULL;
+    rec->chunk_steps = chunk_steps;
+    rec->refs = 1;
+    rec->header = (RecorderHeader){
+        .magic = RECORDER_MAGIC,
+        .version = RECORDER_VERSION,
+        .num_agents = num_agents,
+        .obs_size = obs_size,
+        .action_size = action_size,
+        .float_actions = float_actions,
+    };
+
+    size_t rows = (size_t)chunk_steps*num_agents;
+    int ok = 1;
+    for (int i = 0; i < RECORDER_RING_SIZE; i++) {
+        RecorderChunk* c = &rec->ring[i];
+        c->observations = (float*)malloc(rows*obs_size*sizeof(float));
+        c->actions = (uint32_t*)malloc(rows*action_size*sizeof(uint32_t));
+        c->rewards = (float*)malloc(rows*sizeof(float));
+        c->terminals = (unsigned char*)malloc(recorder_terminal_words(rows)*sizeof(uint32_t));
+        c->chunk = i;
+        ok &= c->observations && c->actions && c->rewards && c->terminals;
+    }
+    rec->scratch = (uint32_t*)malloc((2*rows*obs_size + 2)*sizeof(uint32_t));
+    rec->file = fopen(path, "wb");
+    if (!ok || !rec->scratch || !rec->file
+            || fwrite(&rec->header, sizeof(RecorderHeader), 1, rec->file) != 1) {
+        free_recorder(rec);
+        return NULL;
+    }
+    pthread_mutex_init(&rec->lock, NULL);
+    pthread_cond_init(&rec->cond, NULL);
+    if (pthread_create(&rec->writer, NULL, recorder_writer, rec) != 0) {
+        pthread_mutex_destroy(&rec->lock);
+        pthread_cond_destroy(&rec->cond);
+        free_recorder(rec);
+        return NULL;
+    }
+    return rec;
+}
+
+// Steps every agent row has recorded. Envs attached together record in
+// lockstep, so between vec steps this is the step count of any of them.
+static long recorder_steps(TrajectoryRecorder* rec) {
+    if (rec->num_envs == 0) return 0;
+    long steps = rec->envs[0].steps;
+    for (int i = 1; i < rec->num_envs; i++) {
+        if (rec->envs[i].steps < steps) steps = rec->envs[i].steps;
+    }
+    return steps;
+}
+
+void recorder_hold(TrajectoryRecorder* rec) {
+    __atomic_add_fetch(&rec->refs, 1, __ATOMIC_ACQ_REL);
+}
+
+// Attaches num_envs envs with agents[i] rows each, continuing at the step
+// the previous envs reached. Each env holds a reference, released by
+// recorder_release in c_close. The previous envs must all be released.
+// Returns -1 without attaching if the rows don't add up to num_agents.
+int recorder_attach(TrajectoryRecorder* rec, int num_envs, const int* agents) {
+    int num_agents = 0;
+    for (int i = 0; i < num_envs; i++) {
+        num_agents += agents[i];
+    }
+    if (num_agents != (int)rec->header.num_agents) return -1;
+    long steps = recorder_steps(rec);
+    RecorderEnv* envs = (RecorderEnv*)calloc(num_envs, sizeof(RecorderEnv));
+    int row = 0;
+    for (int i = 0; i < num_envs; i++) {
+        envs[i].row = row;
+        envs[i].agents = agents[i];
+        envs[i].steps = steps;
+        row += agents[i];
+    }
+    free(rec->envs);
+    rec->envs = envs;
+    rec->num_envs = num_envs;
+    __atomic_add_fetch(&rec->refs, num_envs, __ATOMIC_ACQ_REL);
+    return 0;
+}
+
+// Copies one step of env_index's agent rows into the current chunk. Blocks
+// only when the writer is a whole chunk behind.
+void recorder_record(TrajectoryRecorder* rec, int env_index, const float* observations,
+        const void* actions, const float* rewards, const unsigned char* terminals) {
+    RecorderEnv* e = &rec->envs[env_index];
+    long chunk = e->steps / rec->chunk_steps;
+    size_t t = e->steps % rec->chunk_steps;
+    RecorderChunk* c = &rec->ring[chunk % RECORDER_RING_SIZE];
+    if (t == 0) {
+        pthread_mutex_lock(&rec->lock);
+        while (c->chunk != chunk) {
+            pthread_cond_wait(&rec->cond, &rec->lock);
+        }
+        pthread_mutex_unlock(&rec->lock);
+    }
+
+    const RecorderHeader* h = &rec->header;
+    size_t row = t*h->num_agents + e->row;
+    memcpy(c->observations + row*h->obs_size, observations, e->agents*h->obs_size*sizeof(float));
+    memcpy(c->actions + row*h->action_size, actions, e->agents*h->action_size*sizeof(uint32_t));
+    memcpy(c->rewards + row, rewards, e->agents*sizeof(float));
+    memcpy(c->terminals + row, terminals, e->agents);
+    e->steps++;
+
+    if (__atomic_add_fetch(&c->done, e->agents, __ATOMIC_ACQ_REL) == (long)rec->chunk_steps*h->num_agents) {
+        pthread_mutex_lock(&rec->lock);
+        c->ready = 1;
+        pthread_cond_broadcast(&rec->cond);
+        pthread_mutex_unlock(&rec->lock);
+    }
+}
+
+// Drops one env's reference or a hold. The last one flushes the steps every
+// row has recorded, closes the file and frees the recorder. Envs must not
+// step while the last reference is released.
+void recorder_release(TrajectoryRecorder* rec) {
+    if (__atomic_sub_fetch(&rec->refs, 1, __ATOMIC_ACQ_REL) > 0) return;
+    pthread_mutex_lock(&rec->lock);
+    rec->closing = 1;
+    pthread_cond_broadcast(&rec->cond);
+    pthread_mutex_unlock(&rec->lock);
+    pthread_join(rec->writer, NULL);
+
+    int tail = (int)(recorder_steps(rec) - rec->next_flush*rec->chunk_steps);
+    RecorderChunk* c = &rec->ring[rec->next_flush % RECORDER_RING_SIZE];
+    if (tail > 0 && !rec->failed && recorder_write_chunk(rec, c, tail) != 0) {
+        fprintf(stderr, "Trajectory recorder: write failed, dropping the rest of the recording\n");
+    }
+    pthread_mutex_destroy(&rec->lock);
+    pthread_cond_destroy(&rec->cond);
+    free_recorder(rec);
+}
+
+// Reading a recording back: recorder_read_header, then recorder_read_chunk
+// until it returns 0. Both return -1 on a malformed file.
+int recorder_read_header(FILE* file, RecorderHeader* h) {
+    if (fread(h, sizeof(RecorderHeader), 1, file) != 1) return -1;
+    if (h->magic != RECORDER_MAGIC || h->version != RECORDER_VERSION) return -1;
+    return 0;
+}
+
+// Decodes the next chunk into columns[0..3] (observations, actions, rewards,
+// terminals), each with room for max_steps steps. Returns the chunk's step
+// count, 0 at end of file. With columns NULL the chunk is skipped, which is
+// how a reader sizes its arrays.
+int recorder_read_chunk(FILE* file, const RecorderHeader* h, void** columns, int max_steps) {
+    uint32_t steps;
+    if (fread(&steps, sizeof(steps), 1, file) != 1) return feof(file) ? 0 : -1;
+    if (steps == 0 || (columns && (int)steps > max_steps)) return -1;
+    for (int col = 0; col < RECORDER_COLUMNS; col++) {
+        uint64_t words;
+        if (fread(&words, sizeof(words), 1, file) != 1) return -1;
+        if (columns == NULL) {
+            if (fseek(file, words*sizeof(uint32_t), SEEK_CUR) != 0) return -1;
+            continue;
+        }
+        size_t n = recorder_column_words(h, col, steps);
+        uint32_t* encoded = (uint32_t*)malloc(words*sizeof(uint32_t));
+        // Terminals are padded to whole words, so decode them aside
+        uint32_t* out = col == 3 ? (uint32_t*)malloc(n*sizeof(uint32_t)) : (uint32_t*)columns[col];
+        int bad = encoded == NULL || out == NULL
+            || fread(encoded, sizeof(uint32_t), words, file) != words
+            || zero_run_decode(encoded, words, out, n) != 0;
+        if (col == 3) {
+            if (!bad) memcpy(columns[col], out, (size_t)steps*h->num_agents);
+            free(out);
+        }
+        free(encoded);
+        if (bad) return -1;
+    }
+    return (int)steps;
+}
+
+#endif
@@ -1,6 +1,9 @@
 #include <../../inih-r62/ini.h>
 #include <Python.h>
 #include <numpy/arrayobject.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/stat.h>
 
 // Forward declarations for env-specific functions supplied by user
 static int my_log(PyObject* dict, Log* log);
@@ -27,10 +30,35 @@ static int my_put(Env* env, PyObject* args, PyObject* kwargs) {
 }
 #endif
 
+// Optional per-env log state that cannot be averaged like Log (e.g. histograms).
+// Merged from each env in the same pass vec_log makes over Log.
+#ifndef MY_LOG_MERGE
+typedef struct { char unused; } LogMerge;
+#endif
+static void my_log_merge(LogMerge* merged, Env* env);
+static int my_log_merged(PyObject* dict, LogMerge* merged);
+#ifndef MY_LOG_MERGE
+static void my_log_merge(LogMerge* merged, Env* env) {}
+static int my_log_merged(PyObject* dict, LogMerge* merged) {
+    return 0;
+}
+#endif
+
+// Envs with their own RNG state define MY_SEED and seed it here. It runs
+// before my_init and on vec_reset; the default seeds the global rand().
+static void my_seed(Env* env, int seed);
+#ifndef MY_SEED
+static void my_seed(Env* env, int seed) {
+    srand(seed);
+}
+#endif
+
 #ifndef MY_METHODS
 #define MY_METHODS {NULL, NULL, 0, NULL}
 #endif
 
+static PyObject* env_config(PyObject* self, PyObject* args);
+
 static Env* unpack_env(PyObject* args) {
     PyObject* handle_obj = PyTuple_GetItem(args, 0);
     if (!PyObject_TypeCheck(handle_obj, &PyLong_Type)) {
@@ -145,7 +173,7 @@ static PyObject* env_init(PyObject* self, PyObject* args, PyObject* kwargs) {
     int seed = PyLong_AsLong(seed_arg);
 
     // Assumes each process has the same number of environments
-    srand(seed);
+    my_seed(env, seed);
 
     // If kwargs is NULL, create a new dictionary
     if (kwargs == NULL) {
@@ -260,9 +288,12 @@ static PyObject* env_put(PyObject* self, PyObject* args, PyObject* kwargs) {
     Py_RETURN_NONE;
 }
 
+typedef struct VecAsync VecAsync;
+
 typedef struct {
     Env** envs;
     int num_envs;
+    VecAsync* async;
 } VecEnv;
 
 static VecEnv* unpack_vecenv(PyObject* args) {
@@ -286,6 +317,267 @@ static VecEnv* unpack_vecenv(PyObject* args) {
     return vec;
 }
 
+// Double-buffered asynchronous stepping. Two buffer sets (slots) share the same
+// per-env offsets. vec_step_async points every env at one slot and wakes the
+// worker threads; vec_wait blocks until they are done. The caller runs inference
+// on the other slot in the meantime. At most one step is in flight. vec_step and
+// vec_reset always use slot 0, the buffers the envs were initialized with.
+#define VEC_ASYNC_SLOTS 2
+#define VEC_ASYNC_BUFFERS 4  // observations, actions, rewards, terminals
+
+struct VecAsync {
+    int num_threads;
+    pthread_t* threads;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    int generation;
+    int running;    // workers that have not finished the current generation
+    int next_env;   // claimed by workers with an atomic add
+    int in_flight;
+    int shutdown;
+    char* slots[VEC_ASYNC_SLOTS][VEC_ASYNC_BUFFERS];
+    ptrdiff_t* offsets;  // [num_envs][VEC_ASYNC_BUFFERS] byte offsets into a slot
+};
+
+static void* vec_async_worker(void* arg) {
+    VecEnv* vec = (VecEnv*)arg;
+    VecAsync* async = vec->async;
+    int seen = 0;
+    pthread_mutex_lock(&async->lock);
+    while (1) {
+        while (async->generation == seen && !async->shutdown) {
+            pthread_cond_wait(&async->start, &async->lock);
+        }
+        if (async->shutdown) {
+            break;
+        }
+        seen = async->generation;
+        pthread_mutex_unlock(&async->lock);
+
+        int i;
+        while ((i = __atomic_fetch_add(&async->next_env, 1, __ATOMIC_RELAXED)) < vec->num_envs) {
+            c_step(vec->envs[i]);
+        }
+
+        pthread_mutex_lock(&async->lock);
+        async->running--;
+        if (async->running == 0) {
+            pthread_cond_broadcast(&async->done);
+        }
+    }
+    pthread_mutex_unlock(&async->lock);
+    return NULL;
+}
+
+// Points every env at the buffers of one slot
+static void vec_async_bind(VecEnv* vec, int slot) {
+    VecAsync* async = vec->async;
+    for (int i = 0; i < vec->num_envs; i++) {
+        Env* env = vec->envs[i];
+        ptrdiff_t* offset = &async->offsets[i*VEC_ASYNC_BUFFERS];
+        env->observations = (void*)(async->slots[slot][0] + offset[0]);
+        env->actions = (void*)(async->slots[slot][1] + offset[1]);
+        env->rewards = (void*)(async->slots[slot][2] + offset[2]);
+        env->terminals = (void*)(async->slots[slot][3] + offset[3]);
+    }
+}
+
+// Blocks until the in-flight step (if any) is done. Call without the GIL.
+static void vec_async_drain(VecEnv* vec) {
+    VecAsync* async = vec->async;
+    if (async == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&async->lock);
+    while (async->running > 0) {
+        pthread_cond_wait(&async->done, &async->lock);
+    }
+    async->in_flight = 0;
+    pthread_mutex_unlock(&async->lock);
+}
+
+static void vec_async_close(VecEnv* vec) {
+    VecAsync* async = vec->async;
+    if (async == NULL) {
+        return;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    vec_async_drain(vec);
+    pthread_mutex_lock(&async->lock);
+    async->shutdown = 1;
+    pthread_cond_broadcast(&async->start);
+    pthread_mutex_unlock(&async->lock);
+    for (int i = 0; i < async->num_threads; i++) {
+        pthread_join(async->threads[i], NULL);
+    }
+    Py_END_ALLOW_THREADS
+    pthread_mutex_destroy(&async->lock);
+    pthread_cond_destroy(&async->start);
+    pthread_cond_destroy(&async->done);
+    free(async->threads);
+    free(async->offsets);
+    free(async);
+    vec->async = NULL;
+}
+
+static PyArrayObject* unpack_contiguous_array(PyObject* obj, const char* name) {
+    if (!PyObject_TypeCheck(obj, &PyArray_Type)) {
+        char error_msg[100];
+        snprintf(error_msg, sizeof(error_msg), "%s must be a NumPy array", name);
+        PyErr_SetString(PyExc_TypeError, error_msg);
+        return NULL;
+    }
+    PyArrayObject* array = (PyArrayObject*)obj;
+    if (!PyArray_ISCONTIGUOUS(array)) {
+        char error_msg[100];
+        snprintf(error_msg, sizeof(error_msg), "%s must be contiguous", name);
+        PyErr_SetString(PyExc_ValueError, error_msg);
+        return NULL;
+    }
+    return array;
+}
+
+// vec_async_init(vec, num_threads, obs0, act0, rew0, term0, obs1, act1, rew1, term1)
+// Slot 0 must be the buffer set the envs were initialized with.
+static PyObject* vec_async_init(PyObject* self, PyObject* args) {
+    if (PyTuple_Size(args) != 2 + VEC_ASYNC_SLOTS*VEC_ASYNC_BUFFERS) {
+        PyErr_SetString(PyExc_TypeError, "vec_async_init requires 10 arguments");
+        return NULL;
+    }
+    VecEnv* vec = unpack_vecenv(args);
+    if (!vec) {
+        return NULL;
+    }
+    if (vec->async != NULL) {
+        // Re-registering: return the envs to their original buffers first
+        Py_BEGIN_ALLOW_THREADS
+        vec_async_drain(vec);
+        Py_END_ALLOW_THREADS
+        vec_async_bind(vec, 0);
+        vec_async_close(vec);
+    }
+
+    PyObject* threads_arg = PyTuple_GetItem(args, 1);
+    if (!PyObject_TypeCheck(threads_arg, &PyLong_Type)) {
+        PyErr_SetString(PyExc_TypeError, "num_threads must be an integer");
+        return NULL;
+    }
+    int num_threads = PyLong_AsLong(threads_arg);
+    if (num_threads <= 0) {
+        PyErr_SetString(PyExc_ValueError, "num_threads must be greater than 0");
+        return NULL;
+    }
+
+    static const char* names[VEC_ASYNC_BUFFERS] = {"Observations", "Actions", "Rewards", "Terminals"};
+    char* slots[VEC_ASYNC_SLOTS][VEC_ASYNC_BUFFERS];
+    npy_intp nbytes[VEC_ASYNC_BUFFERS];
+    for (int slot = 0; slot < VEC_ASYNC_SLOTS; slot++) {
+        for (int b = 0; b < VEC_ASYNC_BUFFERS; b++) {
+            PyArrayObject* array = unpack_contiguous_array(
+                PyTuple_GetItem(args, 2 + slot*VEC_ASYNC_BUFFERS + b), names[b]);
+            if (!array) {
+                return NULL;
+            }
+            if (slot == 0) {
+                nbytes[b] = PyArray_NBYTES(array);
+            } else if (PyArray_NBYTES(array) != nbytes[b]) {
+                PyErr_SetString(PyExc_ValueError, "Async buffer sets must have matching sizes");
+                return NULL;
+            }
+            slots[slot][b] = PyArray_DATA(array);
+        }
+    }
+
+    ptrdiff_t* offsets = (ptrdiff_t*)calloc(vec->num_envs*VEC_ASYNC_BUFFERS, sizeof(ptrdiff_t));
+    for (int i = 0; i < vec->num_envs; i++) {
+        Env* env = vec->envs[i];
+        char* current[VEC_ASYNC_BUFFERS] = {
+            (char*)env->observations, (char*)env->actions, (char*)env->rewards, (char*)env->terminals
+        };
+        for (int b = 0; b < VEC_ASYNC_BUFFERS; b++) {
+            ptrdiff_t offset = current[b] - slots[0][b];
+            if (offset < 0 || offset > nbytes[b]) {
+                free(offsets);
+                PyErr_SetString(PyExc_ValueError, "Slot 0 buffers must be the ones the envs were initialized with");
+                return NULL;
+            }
+            offsets[i*VEC_ASYNC_BUFFERS + b] = offset;
+        }
+    }
+
+    VecAsync* async = (VecAsync*)calloc(1, sizeof(VecAsync));
+    async->num_threads = num_threads;
+    async->offsets = offsets;
+    memcpy(async->slots, slots, sizeof(slots));
+    pthread_mutex_init(&async->lock, NULL);
+    pthread_cond_init(&async->start, NULL);
+    pthread_cond_init(&async->done, NULL);
+    async->threads = (pthread_t*)calloc(num_threads, sizeof(pthread_t));
+    vec->async = async;
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&async->threads[i], NULL, vec_async_worker, vec) != 0) {
+            async->num_threads = i;
+            vec_async_close(vec);
+            PyErr_SetString(PyExc_RuntimeError, "Failed to start async worker threads");
+            return NULL;
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+// Steps every env into the given slot on the worker threads and returns immediately
+static PyObject* vec_step_async(PyObject* self, PyObject* args) {
+    if (PyTuple_Size(args) != 2) {
+        PyErr_SetString(PyExc_TypeError, "vec_step_async requires 2 arguments");
+        return NULL;
+    }
+    VecEnv* vec = unpack_vecenv(args);
+    if (!vec) {
+        return NULL;
+    }
+    VecAsync* async = vec->async;
+    if (async == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Call vec_async_init before vec_step_async");
+        return NULL;
+    }
+    PyObject* slot_arg = PyTuple_GetItem(args, 1);
+    if (!PyObject_TypeCheck(slot_arg, &PyLong_Type)) {
+        PyErr_SetString(PyExc_TypeError, "slot must be an integer");
+        return NULL;
+    }
+    int slot = PyLong_AsLong(slot_arg);
+    if (slot < 0 || slot >= VEC_ASYNC_SLOTS) {
+        PyErr_SetString(PyExc_ValueError, "slot must be 0 or 1");
+        return NULL;
+    }
+    if (async->in_flight) {
+        PyErr_SetString(PyExc_RuntimeError, "vec_step_async called twice without vec_wait");
+        return NULL;
+    }
+
+    vec_async_bind(vec, slot);
+    pthread_mutex_lock(&async->lock);
+    async->next_env = 0;
+    async->running = async->num_threads;
+    async->in_flight = 1;
+    async->generation++;
+    pthread_cond_broadcast(&async->start);
+    pthread_mutex_unlock(&async->lock);
+    Py_RETURN_NONE;
+}
+
+static PyObject* vec_wait(PyObject* self, PyObject* args) {
+    VecEnv* vec = unpack_vecenv(args);
+    if (!vec) {
+        return NULL;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    vec_async_drain(vec);
+    Py_END_ALLOW_THREADS
+    Py_RETURN_NONE;
+}
+
 static PyObject* vec_init(PyObject* self, PyObject* args, PyObject* kwargs) {
     if (PyTuple_Size(args) != 7) {
         PyErr_SetString(PyExc_TypeError, "vec_init requires 6 arguments");
@@ -423,7 +715,7 @@ static PyObject* vec_init(PyObject* self, PyObject* args, PyObject* kwargs) {
 
         // Assumes each process has the same number of environments
         int env_seed = i + seed*vec->num_envs;
-        srand(env_seed);
+        my_seed(env, env_seed);
 
         // Add the seed to kwargs for this environment
         PyObject* py_seed = PyLong_FromLong(env_seed);
@@ -498,9 +790,15 @@ static PyObject* vec_reset(PyObject* self, PyObject* args) {
     }
     int seed = PyLong_AsLong(seed_arg);
 
+    Py_BEGIN_ALLOW_THREADS
+    vec_async_drain(vec);
+    Py_END_ALLOW_THREADS
+    if (vec->async != NULL) {
+        vec_async_bind(vec, 0);
+    }
     for (int i = 0; i < vec->num_envs; i++) {
         // Assumes each process has the same number of environments
-        srand(i + seed*vec->num_envs);
+        my_seed(vec->envs[i], i + seed*vec->num_envs);
         c_reset(vec->envs[i]);
     }
     Py_RETURN_NONE;
@@ -518,6 +816,12 @@ static PyObject* vec_step(PyObject* self, PyObject* arg) {
         return NULL;
     }
 
+    Py_BEGIN_ALLOW_THREADS
+    vec_async_drain(vec);
+    Py_END_ALLOW_THREADS
+    if (vec->async != NULL) {
+        vec_async_bind(vec, 0);
+    }
     for (int i = 0; i < vec->num_envs; i++) {
         c_step(vec->envs[i]);
     }
@@ -544,6 +848,9 @@ static PyObject* vec_render(PyObject* self, PyObject* args) {
     }
     int env_id = PyLong_AsLong(env_id_arg);
 
+    Py_BEGIN_ALLOW_THREADS
+    vec_async_drain(vec);
+    Py_END_ALLOW_THREADS
     c_render(vec->envs[env_id]);
     Py_RETURN_NONE;
 }
@@ -568,9 +875,14 @@ static PyObject* vec_log(PyObject* self, PyObject* args) {
         return NULL;
     }
 
+    Py_BEGIN_ALLOW_THREADS
+    vec_async_drain(vec);
+    Py_END_ALLOW_THREADS
+
     // Iterates over logs one float at a time. Will break
     // horribly if Log has non-float data.
     Log aggregate = {0};
+    LogMerge merged = {0};
     int num_keys = sizeof(Log) / sizeof(float);
     for (int i = 0; i < vec->num_envs; i++) {
         Env* env = vec->envs[i];
@@ -578,6 +890,7 @@ static PyObject* vec_log(PyObject* self, PyObject* args) {
             ((float*)&aggregate)[j] += ((float*)&env->log)[j];
             ((float*)&env->log)[j] = 0.0f;
         }
+        my_log_merge(&merged, env);
     }
 
     PyObject* dict = PyDict_New();
@@ -593,6 +906,7 @@ static PyObject* vec_log(PyObject* self, PyObject* args) {
 
     // User populates dict
     my_log(dict, &aggregate);
+    my_log_merged(dict, &merged);
     assign_to_dict(dict, "n", n);
 
     return dict;
@@ -604,6 +918,7 @@ static PyObject* vec_close(PyObject* self, PyObject* args) {
         return NULL;
     }
 
+    vec_async_close(vec);
     for (int i = 0; i < vec->num_envs; i++) {
         c_close(vec->envs[i]);
         free(vec->envs[i]);
@@ -641,32 +956,6 @@ static double unpack(PyObject* kwargs, char* key) {
     return 1;
 }
 
-static char* unpack_str(PyObject* kwargs, char* key) {
-    PyObject* val = PyDict_GetItemString(kwargs, key);
-    if (val == NULL) {
-        char error_msg[100];
-        snprintf(error_msg, sizeof(error_msg), "Missing required keyword argument '%s'", key);
-        PyErr_SetString(PyExc_TypeError, error_msg);
-        return NULL;
-    }
-    if (!PyUnicode_Check(val)) {
-        char error_msg[100];
-        snprintf(error_msg, sizeof(error_msg), "Keyword argument '%s' must be a string", key);
-        PyErr_SetString(PyExc_TypeError, error_msg);
-        return NULL;
-    }
-    const char* str_val = PyUnicode_AsUTF8(val);
-    if (str_val == NULL) {
-        // PyUnicode_AsUTF8 sets an error on failure
-        return NULL;
-    }
-    char* ret = strdup(str_val);
-    if (ret == NULL) {
-        PyErr_SetString(PyExc_MemoryError, "strdup failed in unpack_str");
-    }
-    return ret;
-}
-
 // Method table
 static PyMethodDef methods[] = {
     {"env_init", (PyCFunction)env_init, METH_VARARGS | METH_KEYWORDS, "Init environment with observation, action, reward, terminal, truncation arrays"},
@@ -683,7 +972,11 @@ static PyMethodDef methods[] = {
     {"vec_log", vec_log, METH_VARARGS, "Log the vector of environments"},
     {"vec_render", vec_render, METH_VARARGS, "Render the vector of environments"},
     {"vec_close", vec_close, METH_VARARGS, "Close the vector of environments"},
+    {"vec_async_init", vec_async_init, METH_VARARGS, "Start worker threads and register a second buffer set for async stepping"},
+    {"vec_step_async", vec_step_async, METH_VARARGS, "Step the vector of environments into a buffer slot on worker threads"},
+    {"vec_wait", vec_wait, METH_VARARGS, "Wait for the in-flight async step"},
     {"shared", (PyCFunction)my_shared, METH_VARARGS | METH_KEYWORDS, "Shared state"},
+    {"env_config", env_config, METH_VARARGS, "Parse an ini file once and return a config handle for env_init/vec_init"},
     MY_METHODS,
     {NULL, NULL, 0, NULL}
 };
@@ -760,3 +1053,96 @@ static int handler(
     }
     return 1;
 }
+
+// Parsed ini files, keyed by path and modification time. vec_init and
+// resampling create thousands of envs that all read the same file, so
+// each file is parsed once per process and reparsed only when it changes.
+// Entries are never freed: config handles and ini_file pointers handed
+// out to envs stay valid for the life of the process.
+typedef struct EnvConfigEntry EnvConfigEntry;
+struct EnvConfigEntry {
+    char* path;
+    struct timespec mtime;
+    env_init_config config;
+    EnvConfigEntry* next;
+};
+
+static EnvConfigEntry* env_config_cache = NULL;
+static pthread_mutex_t env_config_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Returns the cached entry for path, parsing the file on a miss. NULL if
+// the file cannot be read.
+static EnvConfigEntry* load_env_config(const char* path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&env_config_lock);
+    EnvConfigEntry* entry = env_config_cache;
+    while (entry != NULL) {
+        if (strcmp(entry->path, path) == 0
+                && entry->mtime.tv_sec == st.st_mtim.tv_sec
+                && entry->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            pthread_mutex_unlock(&env_config_lock);
+            return entry;
+        }
+        entry = entry->next;
+    }
+
+    entry = (EnvConfigEntry*)calloc(1, sizeof(EnvConfigEntry));
+    if (ini_parse(path, handler, &entry->config) < 0) {
+        pthread_mutex_unlock(&env_config_lock);
+        free(entry);
+        return NULL;
+    }
+    entry->path = strdup(path);
+    entry->mtime = st.st_mtim;
+    entry->next = env_config_cache;
+    env_config_cache = entry;
+    pthread_mutex_unlock(&env_config_lock);
+    return entry;
+}
+
+// Python function to parse an ini file into a config handle. Passing
+// config=<handle> to env_init or vec_init skips all file I/O at env creation.
+static PyObject* env_config(PyObject* self, PyObject* args) {
+    const char* path;
+    if (!PyArg_ParseTuple(args, "s", &path)) {
+        return NULL;
+    }
+    EnvConfigEntry* entry = load_env_config(path);
+    if (entry == NULL) {
+        PyErr_Format(PyExc_FileNotFoundError, "Error while loading %s", path);
+        return NULL;
+    }
+    return PyLong_FromVoidPtr(entry);
+}
+
+// Config for my_init: the prebuilt config kwarg when given, otherwise the
+// cached parse of the ini_file kwarg. NULL with a Python error set on failure.
+static EnvConfigEntry* unpack_config(PyObject* kwargs) {
+    PyObject* handle = PyDict_GetItemString(kwargs, "config");
+    if (handle != NULL && handle != Py_None) {
+        if (!PyLong_Check(handle)) {
+            PyErr_SetString(PyExc_TypeError, "config must be a handle from env_config");
+            return NULL;
+        }
+        return (EnvConfigEntry*)PyLong_AsVoidPtr(handle);
+    }
+
+    PyObject* val = PyDict_GetItemString(kwargs, "ini_file");
+    if (val == NULL || !PyUnicode_Check(val)) {
+        PyErr_SetString(PyExc_TypeError, "Missing required keyword argument 'config' or 'ini_file'");
+        return NULL;
+    }
+    const char* path = PyUnicode_AsUTF8(val);
+    if (path == NULL) {
+        return NULL;
+    }
+    EnvConfigEntry* entry = load_env_config(path);
+    if (entry == NULL) {
+        PyErr_Format(PyExc_FileNotFoundError, "Error while loading %s", path);
+    }
+    return entry;
+}
@@ -13,9 +13,14 @@ Recurrent = pufferlib.models.LSTMWrapper
 
 
 class Drive(nn.Module):
+    # The C set encoder runs these on fp32 activations in int8 checkpoints
+    fp32_activation_modules = ("road_encoder", "partner_encoder")
+
     def __init__(self, env, input_size=128, hidden_size=128, **kwargs):
         super().__init__()
         self.hidden_size = hidden_size
+        # Partner slot count follows the env's max_partner_observations
+        self.num_partners = (env.single_observation_space.shape[0] - 7 - 200 * 7) // 7
         self.ego_encoder = nn.Sequential(
             pufferlib.pytorch.layer_init(nn.Linear(7, input_size)),
             nn.LayerNorm(input_size),
@@ -61,13 +66,13 @@ class Drive(nn.Module):
 
     def encode_observations(self, observations, state=None):
         ego_dim = 7
-        partner_dim = 63 * 7
+        partner_dim = self.num_partners * 7
         road_dim = 200 * 7
         ego_obs = observations[:, :ego_dim]
         partner_obs = observations[:, ego_dim : ego_dim + partner_dim]
         road_obs = observations[:, ego_dim + partner_dim : ego_dim + partner_dim + road_dim]
 
-        partner_objects = partner_obs.view(-1, 63, 7)
+        partner_objects = partner_obs.view(-1, self.num_partners, 7)
         road_objects = road_obs.view(-1, 200, 7)
         road_continuous = road_objects[:, :, :6]  # First 6 features
         road_categorical = road_objects[:, :, 6]
@@ -11,9 +11,11 @@ import os
 import sys
 import glob
 import ast
+import copy
 import time
 import random
 import shutil
+import struct
 import subprocess
 import argparse
 import importlib
@@ -1234,26 +1236,185 @@ def profile(args=None, env_name=None, vecenv=None, policy=None):
 
 
 def export(args=None, env_name=None, vecenv=None, policy=None, path=None, silent=False):
+    """Writes the policy weights for puffernet: a manifest of tensor names,
+    shapes and offsets (see load_weights in puffernet.h) followed by every
+    parameter flattened in named_parameters() order as float32."""
     args = args or load_config(env_name)
     vecenv = vecenv or load_env(env_name, args)
     policy = policy or load_policy(args, vecenv)
 
     weights = []
+    manifest = []
+    offset = 0
     for name, param in policy.named_parameters():
-        weights.append(param.data.cpu().numpy().flatten())
+        data = param.data.cpu().numpy().astype(np.float32)
+        weights.append(data.flatten())
+        encoded = name.encode()
+        shape = struct.pack(f"<I{data.ndim}I", data.ndim, *data.shape)
+        manifest.append(struct.pack("<I", len(encoded)) + encoded + shape + struct.pack("<Q", offset))
+        offset += data.size
         if not silent:
-            print(name, param.shape, param.data.cpu().numpy().ravel()[0])
+            print(name, param.shape, data.ravel()[0])
 
     weights = np.concatenate(weights)
     if path is None:
         path = f"{args['env_name']}_weights.bin"
 
-    weights.tofile(path)
+    # Header is padded so the data starts 64 byte aligned
+    header_size = 16 + sum(len(entry) for entry in manifest)
+    data_offset = (header_size + 63) // 64 * 64
+    with open(path, "wb") as f:
+        f.write(b"PUFW" + struct.pack("<III", 1, len(manifest), data_offset))
+        for entry in manifest:
+            f.write(entry)
+        f.write(bytes(data_offset - header_size))
+        f.write(weights.tobytes())
 
     if not silent:
         print(f"Saved {len(weights)} weights to {path}")
 
 
+def _fake_quantize_rows(x):
+    scale = x.abs().amax(dim=-1, keepdim=True) / 127
+    scale = torch.where(scale == 0, torch.ones_like(scale), scale)
+    return torch.round(x / scale).clamp(-127, 127) * scale
+
+
+def _logit_heads(logits):
+    if isinstance(logits, torch.distributions.Normal):
+        return [logits.loc]
+    if isinstance(logits, torch.Tensor):
+        return [logits]
+    return list(logits)
+
+
+def quantize(args=None, env_name=None, vecenv=None, policy=None, path=None, num_steps=128, silent=False):
+    """Writes an int8 checkpoint for the puffernet int8 path and reports its
+    accuracy against fp32 on observations recorded from the env.
+
+    Unlike export(), the file has no manifest: parameters follow each other in
+    named_parameters() order and are read positionally by load_weights_int8.
+    Linear and LSTM weight matrices are stored as fp32 per-row scales followed
+    by int8 values padded to 4 bytes. The report runs a copy of the policy with
+    the dequantized weights and per-row activation quantization, as the C
+    kernels do. Linear layers listed in a module's fp32_activation_modules run
+    with dequantized weights on fp32 activations in C, so they are not
+    activation quantized here."""
+    args = args or load_config(env_name)
+    vecenv = vecenv or load_env(env_name, args)
+    policy = policy or load_policy(args, vecenv)
+    device = args["train"]["device"]
+
+    quantized = set()
+    for module_name, module in policy.named_modules():
+        prefix = f"{module_name}." if module_name else ""
+        if isinstance(module, torch.nn.Linear):
+            quantized.add(prefix + "weight")
+        elif isinstance(module, (torch.nn.LSTM, torch.nn.LSTMCell)):
+            for name, _ in module.named_parameters(recurse=False):
+                if name.startswith("weight"):
+                    quantized.add(prefix + name)
+
+    chunks = []
+    dequantized = {}
+    for name, param in policy.named_parameters():
+        data = param.data.cpu().numpy().astype(np.float32)
+        if name not in quantized:
+            chunks.append(data.tobytes())
+            continue
+
+        rows = data.reshape(data.shape[0], -1)
+        scales = np.abs(rows).max(axis=1) / 127
+        scales[scales == 0] = 1
+        q = np.clip(np.round(rows / scales[:, None]), -127, 127).astype(np.int8)
+        chunks.append(scales.astype(np.float32).tobytes())
+        chunks.append(q.tobytes() + bytes((-q.size) % 4))
+        dequantized[name] = torch.from_numpy((q * scales[:, None]).reshape(data.shape).astype(np.float32))
+        if not silent:
+            print(name, param.shape, "int8")
+
+    weights = b"".join(chunks)
+    if path is None:
+        path = f"{args['env_name']}_weights_int8.bin"
+
+    with open(path, "wb") as f:
+        f.write(weights)
+    if not silent:
+        print(f"Saved {len(dequantized)} int8 matrices ({len(weights)} bytes) to {path}")
+
+    # Record observations with the fp32 policy
+    use_rnn = args["train"]["use_rnn"]
+
+    def initial_state(num_agents):
+        if not use_rnn:
+            return {}
+        return dict(
+            lstm_h=torch.zeros(num_agents, policy.hidden_size, device=device),
+            lstm_c=torch.zeros(num_agents, policy.hidden_size, device=device),
+        )
+
+    observations = []
+    ob, _ = vecenv.reset()
+    state = initial_state(ob.shape[0])
+    with torch.no_grad():
+        for _ in range(num_steps):
+            ob = torch.as_tensor(ob).to(device)
+            observations.append(ob)
+            logits, _ = policy.forward_eval(ob, state)
+            action, _, _ = pufferlib.pytorch.sample_logits(logits)
+            action = action.cpu().numpy().reshape(vecenv.action_space.shape)
+            if isinstance(logits, torch.distributions.Normal):
+                action = np.clip(action, vecenv.action_space.low, vecenv.action_space.high)
+            ob = vecenv.step(action)[0]
+
+    qpolicy = copy.deepcopy(policy)
+    qparams = dict(qpolicy.named_parameters())
+    for name, value in dequantized.items():
+        qparams[name].data.copy_(value.to(qparams[name].device))
+
+    fp32_activations = []
+    for module_name, module in qpolicy.named_modules():
+        prefix = f"{module_name}." if module_name else ""
+        fp32_activations += [prefix + name for name in getattr(module, "fp32_activation_modules", ())]
+
+    for module_name, module in qpolicy.named_modules():
+        if any(module_name == name or module_name.startswith(name + ".") for name in fp32_activations):
+            continue
+        if isinstance(module, torch.nn.Linear):
+            module.register_forward_pre_hook(lambda m, inputs: (_fake_quantize_rows(inputs[0]),))
+        elif isinstance(module, torch.nn.LSTMCell):
+            module.register_forward_pre_hook(
+                lambda m, inputs: (_fake_quantize_rows(inputs[0]), (_fake_quantize_rows(inputs[1][0]), inputs[1][1]))
+            )
+
+    # Replay the recording through both policies, each with its own state
+    fp32_state = initial_state(observations[0].shape[0])
+    int8_state = initial_state(observations[0].shape[0])
+    max_diff = mean_diff = value_diff = agree = 0
+    with torch.no_grad():
+        for ob in observations:
+            fp32_logits, fp32_value = policy.forward_eval(ob, fp32_state)
+            int8_logits, int8_value = qpolicy.forward_eval(ob, int8_state)
+            fp32_heads = _logit_heads(fp32_logits)
+            int8_heads = _logit_heads(int8_logits)
+            diff = torch.cat([(a - b).abs().flatten() for a, b in zip(fp32_heads, int8_heads)])
+            max_diff = max(max_diff, diff.max().item())
+            mean_diff += diff.mean().item() / len(observations)
+            value_diff = max(value_diff, (fp32_value - int8_value).abs().max().item())
+            same = torch.ones(ob.shape[0], dtype=torch.bool, device=ob.device)
+            for a, b in zip(fp32_heads, int8_heads):
+                same &= a.argmax(dim=-1) == b.argmax(dim=-1)
+            agree += same.float().mean().item() / len(observations)
+
+    report = dict(max_logit_diff=max_diff, mean_logit_diff=mean_diff, max_value_diff=value_diff, argmax_agreement=agree)
+    if not silent:
+        print(f"int8 vs fp32 over {num_steps} recorded steps:")
+        for key, value in report.items():
+            print(f"  {key}: {value:.6f}")
+
+    return report
+
+
 def ensure_drive_binary():
     """Ensure the drive binary exists, build it once if necessary. This
     is required for rendering with raylib.
@@ -1416,7 +1577,7 @@ def load_config(env_name):
 
 def main():
     err = (
-        "Usage: puffer [train, eval, sweep, autotune, profile, export] [env_name] [optional args]. --help for more info"
+        "Usage: puffer [train, eval, sweep, autotune, profile, export, quantize] [env_name] [optional args]. --help for more info"
     )
     if len(sys.argv) < 3:
         raise pufferlib.APIUsageError(err)
@@ -1435,6 +1596,8 @@ def main():
         profile(env_name=env_name)
     elif mode == "export":
         export(env_name=env_name)
+    elif mode == "quantize":
+        quantize(env_name=env_name)
     else:
         raise pufferlib.APIUsageError(err)
 
@@ -1,6 +1,6 @@
 #!/bin/bash
 
-# Usage: ./build_env.sh pong [local|fast|web]
+# Usage: ./build_env.sh pong [local|fast|bench|web]
 
 ENV=$1
 MODE=${2:-local}
@@ -114,7 +114,11 @@ elif [ "$MODE" = "fast" ]; then
     echo "Building optimized $ENV for local testing..."
     $COMPILER -pg -O2 -DNDEBUG ${FLAGS[@]}
     echo "Built to: $ENV"
+elif [ "$MODE" = "bench" ]; then
+    echo "Building optimized $ENV with per-phase profiling..."
+    $COMPILER -O2 -DNDEBUG -DDRIVE_PROFILE ${FLAGS[@]}
+    echo "Built to: $ENV"
 else
-    echo "Invalid mode specified: local|fast|web"
+    echo "Invalid mode specified: local|fast|bench|web"
     exit 1
 fi
@@ -22,6 +22,8 @@ from torch.utils.cpp_extension import (
 
 # Build with DEBUG=1 to enable debug symbols
 DEBUG = os.getenv("DEBUG", "0") == "1"
+# Build with DRIVE_PROFILE=1 to log per-phase step timings and counters from drive
+DRIVE_PROFILE = os.getenv("DRIVE_PROFILE", "0") == "1"
 NO_OCEAN = os.getenv("NO_OCEAN", "0") == "1"
 NO_TRAIN = os.getenv("NO_TRAIN", "0") == "1"
 
@@ -259,6 +261,8 @@ if not NO_OCEAN:
                     '-DINI_INLINE_COMMENT_PREFIXES="#"',
                 ]
             )
+            if DRIVE_PROFILE:
+                c_ext.extra_compile_args.append("-DDRIVE_PROFILE")
 
         if "impulse_wars" in c_ext.name:
             print(f"Adding {c_ext.name} to extra objects")
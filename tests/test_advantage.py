@@ -0,0 +1,77 @@
+import numpy as np
+import torch
+
+from pufferlib import _C  # noqa: F401 registers torch.ops.pufferlib
+
+
+def advantage_reference(values, rewards, dones, importance, gamma, lam, rho_clip, c_clip):
+    num_steps, horizon = values.shape
+    advantages = np.zeros((num_steps, horizon), dtype=np.float32)
+    for row in range(num_steps):
+        lastpufferlam = 0
+        for t in range(horizon - 2, -1, -1):
+            nextnonterminal = 1.0 - dones[row, t + 1]
+            rho_t = min(importance[row, t], rho_clip)
+            c_t = min(importance[row, t], c_clip)
+            delta = rho_t * (rewards[row, t + 1] + gamma * values[row, t + 1] * nextnonterminal - values[row, t])
+            lastpufferlam = delta + gamma * lam * c_t * lastpufferlam * nextnonterminal
+            advantages[row, t] = lastpufferlam
+    return advantages
+
+
+def make_inputs(num_steps, horizon, seed=0):
+    rng = np.random.default_rng(seed)
+    values = rng.standard_normal((num_steps, horizon)).astype(np.float32)
+    rewards = rng.standard_normal((num_steps, horizon)).astype(np.float32)
+    dones = (rng.random((num_steps, horizon)) < 0.1).astype(np.float32)
+    importance = rng.uniform(0, 2, (num_steps, horizon)).astype(np.float32)
+    return values, rewards, dones, importance
+
+
+def test_puff_advantage_cpu():
+    # 37 rows covers both full row blocks and the leftover rows
+    values, rewards, dones, importance = make_inputs(37, 16)
+    expected = advantage_reference(values, rewards, dones, importance, 0.99, 0.95, 1.0, 1.0)
+
+    advantages = torch.zeros(37, 16)
+    torch.ops.pufferlib.compute_puff_advantage(
+        torch.from_numpy(values),
+        torch.from_numpy(rewards),
+        torch.from_numpy(dones),
+        torch.from_numpy(importance),
+        advantages,
+        0.99,
+        0.95,
+        1.0,
+        1.0,
+    )
+    assert np.allclose(advantages.numpy(), expected, atol=1e-5)
+
+
+def test_puff_advantage_cpu_strided():
+    values, rewards, dones, importance = make_inputs(24, 16, seed=1)
+    expected = advantage_reference(values, rewards, dones, importance, 0.99, 0.95, 1.0, 1.0)
+
+    # Column-major views of the same data, including the output
+    def strided(x):
+        return torch.from_numpy(np.ascontiguousarray(x.T)).t()
+
+    advantages = torch.zeros(16, 24).t()
+    assert not advantages.is_contiguous()
+    torch.ops.pufferlib.compute_puff_advantage(
+        strided(values),
+        strided(rewards),
+        strided(dones),
+        strided(importance),
+        advantages,
+        0.99,
+        0.95,
+        1.0,
+        1.0,
+    )
+    assert np.allclose(advantages.numpy(), expected, atol=1e-5)
+
+
+if __name__ == "__main__":
+    test_puff_advantage_cpu()
+    test_puff_advantage_cpu_strided()
@@ -0,0 +1,237 @@
+import os
+import shutil
+import subprocess
+import sys
+
+import numpy as np
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path.insert(0, REPO)
+
+from pufferlib.ocean.drive import binding  # noqa: E402
+
+CONFIG = os.path.join(REPO, "pufferlib/config/ocean/drive.ini")
+MAP = os.path.join(REPO, "resources/drive/binaries/map_000.bin")
+OBS_SIZE = 7 + 63 * 7 + 200 * 7
+
+
+def make_workdir(tmp_path):
+    """Working directory with its own copy of map_000, so sidecar files and
+    map timestamps can be changed without touching the repo's resources"""
+    binaries = tmp_path / "resources/drive/binaries"
+    binaries.mkdir(parents=True)
+    shutil.copy(MAP, binaries / "map_000.bin")
+    os.chdir(tmp_path)
+    return binaries / "map_000.bin"
+
+
+def make_buffers(num_agents):
+    return (
+        np.zeros((num_agents, OBS_SIZE), dtype=np.float32),
+        np.zeros((num_agents, 2), dtype=np.int32),
+        np.zeros(num_agents, dtype=np.float32),
+        np.zeros(num_agents, dtype=np.uint8),
+        np.zeros(num_agents, dtype=np.uint8),
+    )
+
+
+def make_vec(num_envs, buffers=None, seed=0, persist_trajectory_cache=0, map_id=0):
+    agent_offsets, map_ids, num_envs = binding.shared(num_agents=num_envs, num_maps=1)
+    if buffers is None:
+        buffers = make_buffers(agent_offsets[-1])
+    vec = binding.vec_init_drive(
+        *buffers,
+        np.full(num_envs, map_id, dtype=np.int32),
+        np.asarray(agent_offsets, dtype=np.int32),
+        seed,
+        config=binding.env_config(CONFIG),
+        human_agent_idx=0,
+        control_all_agents=0,
+        num_policy_controlled_agents=-1,
+        deterministic_agent_selection=0,
+        control_non_vehicles=0,
+        persist_trajectory_cache=persist_trajectory_cache,
+        max_partner_observations=63,
+        init_steps=0,
+    )
+    return vec, buffers
+
+
+INIT_IN_NEW_PROCESS = f"""
+import sys
+sys.path.insert(0, {REPO!r})
+sys.path.insert(0, {os.path.dirname(os.path.abspath(__file__))!r})
+import test_drive_binding as t
+vec, _ = t.make_vec(2, persist_trajectory_cache=1)
+t.binding.vec_close(vec)
+"""
+
+
+def sidecar_header(path):
+    # packed magic and version, map size, map mtime
+    return np.fromfile(path, dtype=np.int64, count=3)
+
+
+def test_trajectory_cache_sidecar(tmp_path):
+    map_path = make_workdir(tmp_path)
+    sidecar = str(map_path) + ".trajcache"
+
+    # A miss replays the map and appends one record
+    vec, _ = make_vec(2, persist_trajectory_cache=1)
+    binding.vec_close(vec)
+    assert os.path.exists(sidecar)
+    size = os.path.getsize(sidecar)
+
+    # Hits in memory and, from a new process, in the sidecar add nothing
+    vec, _ = make_vec(2, persist_trajectory_cache=1)
+    binding.vec_close(vec)
+    subprocess.run([sys.executable, "-c", INIT_IN_NEW_PROCESS], check=True)
+    assert os.path.getsize(sidecar) == size
+
+    # Rewriting the map invalidates the sidecar, which is replaced
+    header = sidecar_header(sidecar)
+    stat = os.stat(map_path)
+    os.utime(map_path, (stat.st_atime, stat.st_mtime + 10))
+    subprocess.run([sys.executable, "-c", INIT_IN_NEW_PROCESS], check=True)
+    assert os.path.getsize(sidecar) == size
+    assert sidecar_header(sidecar)[2] == header[2] + 10
+    assert not [name for name in os.listdir(map_path.parent) if name.endswith(".tmp")]
+
+
+def test_sync_step_after_async_step(tmp_path):
+    make_workdir(tmp_path)
+    mixed, mixed_buffers = make_vec(2, seed=3)
+    plain, plain_buffers = make_vec(2, seed=3)
+    slot1 = make_buffers(len(mixed_buffers[0]))
+    binding.vec_async_init(mixed, 1, *mixed_buffers[:4], *slot1[:4])
+    for buffers in (mixed_buffers, slot1, plain_buffers):
+        buffers[1][:] = (3, 5)
+    binding.vec_reset(mixed, 0)
+    binding.vec_reset(plain, 0)
+
+    # Step once on the workers into slot 1, then go back to synchronous steps
+    binding.vec_step_async(mixed, 1)
+    binding.vec_wait(mixed)
+    binding.vec_step(plain)
+    np.testing.assert_array_equal(slot1[0], plain_buffers[0])
+    for _ in range(8):
+        binding.vec_step(mixed)
+        binding.vec_step(plain)
+        for mixed_buffer, plain_buffer in zip(mixed_buffers[:4], plain_buffers[:4]):
+            np.testing.assert_array_equal(mixed_buffer, plain_buffer)
+
+    binding.vec_close(mixed)
+    binding.vec_close(plain)
+
+
+def test_restore_replays_bit_for_bit(tmp_path):
+    make_workdir(tmp_path)
+    vec, buffers = make_vec(2, seed=5)
+    observations, actions, rewards, terminals, truncations = buffers
+    rng = np.random.default_rng(0)
+    binding.vec_reset(vec, 0)
+    for _ in range(5):
+        actions[:] = rng.integers(0, 7, actions.shape)
+        binding.vec_step(vec)
+
+    snapshot = binding.vec_snapshot(vec)
+    plan = [rng.integers(0, 7, actions.shape) for _ in range(20)]
+    runs = []
+    for _ in range(2):
+        run = []
+        for step_actions in plan:
+            actions[:] = step_actions
+            binding.vec_step(vec)
+            run.append([buffer.copy() for buffer in (observations, rewards, terminals, truncations)])
+        runs.append(run)
+        binding.vec_restore(vec, snapshot)
+
+    for first, second in zip(*runs):
+        for a, b in zip(first, second):
+            assert a.tobytes() == b.tobytes()
+    binding.vec_close(vec)
+
+
+def test_restore_rejects_other_scenario(tmp_path):
+    map_path = make_workdir(tmp_path)
+    # Same objects and agent count, different map
+    shutil.copy(map_path, map_path.parent / "map_001.bin")
+    vec, buffers = make_vec(2)
+    other, _ = make_vec(2, map_id=1)
+    binding.vec_reset(vec, 0)
+    binding.vec_step(vec)
+    observations = buffers[0].copy()
+
+    try:
+        binding.vec_restore(vec, binding.vec_snapshot(other))
+        raise Exception("vec_restore accepted a snapshot of another map")
+    except ValueError:
+        pass
+    np.testing.assert_array_equal(buffers[0], observations)
+    binding.vec_close(vec)
+    binding.vec_close(other)
+
+
+def test_record_round_trip(tmp_path):
+    make_workdir(tmp_path)
+    vec, buffers = make_vec(3)
+    observations, actions, rewards, terminals, _ = buffers
+    rng = np.random.default_rng(0)
+    binding.vec_reset(vec, 0)
+
+    # Steps cross chunk boundaries, and a detach/attach as in Drive._resample
+    binding.vec_record(vec, str(tmp_path / "record.bin"), 7)
+    expected = []
+    for step in range(30):
+        if step == 16:
+            handle = binding.vec_record_detach(vec)
+            binding.vec_close(vec)
+            vec, _ = make_vec(3, buffers=buffers, seed=1)
+            binding.vec_record_attach(vec, handle)
+            binding.vec_reset(vec, 1)
+        actions[:] = rng.integers(0, 7, actions.shape)
+        expected.append([buffer.copy() for buffer in (observations, actions, rewards, terminals)])
+        binding.vec_step(vec)
+    binding.vec_record(vec, None)
+
+    recording = binding.read_trajectories(str(tmp_path / "record.bin"))
+    for i, key in enumerate(("observations", "actions", "rewards", "terminals")):
+        np.testing.assert_array_equal(recording[key], np.stack([row[i] for row in expected]))
+    binding.vec_close(vec)
+
+
+def test_record_across_resample(tmp_path):
+    make_workdir(tmp_path)
+    config = tmp_path / "pufferlib/config/ocean"
+    config.mkdir(parents=True)
+    shutil.copy(CONFIG, config / "drive.ini")
+    from pufferlib.ocean.drive.drive import Drive
+
+    env = Drive(num_agents=2, num_maps=1, resample_frequency=5, report_interval=1000)
+    env.reset()
+    env.record(str(tmp_path / "record.bin"), chunk_steps=3)
+    rng = np.random.default_rng(0)
+    expected = []
+    for _ in range(12):
+        actions = rng.integers(0, 7, env.actions.shape)
+        # step clears terminals before the envs record
+        expected.append([env.observations.copy(), actions, env.rewards.copy(), np.zeros_like(env.terminals)])
+        env.step(actions)
+    env.stop_recording()
+
+    recording = binding.read_trajectories(str(tmp_path / "record.bin"))
+    for i, key in enumerate(("observations", "actions", "rewards", "terminals")):
+        np.testing.assert_array_equal(recording[key], np.stack([row[i] for row in expected]))
+    env.close()
+
+
+if __name__ == "__main__":
+    import tempfile
+    from pathlib import Path
+
+    test_trajectory_cache_sidecar(Path(tempfile.mkdtemp()))
+    test_sync_step_after_async_step(Path(tempfile.mkdtemp()))
+    test_restore_replays_bit_for_bit(Path(tempfile.mkdtemp()))
+    test_restore_rejects_other_scenario(Path(tempfile.mkdtemp()))
+    test_record_round_trip(Path(tempfile.mkdtemp()))
+    test_record_across_resample(Path(tempfile.mkdtemp()))
@@ -197,6 +197,50 @@ def test_puffernet_lstm(batch_size=16, input_size=128, hidden_size=128):
     assert_near(state_c_np, state_c_torch.numpy()[0])
 
 
+def test_puffernet_lstm_sequence(seq_len=8, batch_size=16, input_size=128, hidden_size=128):
+    input_np = make_dummy_data(seq_len, batch_size, input_size, seed=42)
+    state_h_np = make_dummy_data(batch_size, hidden_size, seed=43)
+    state_c_np = make_dummy_data(batch_size, hidden_size, seed=44)
+    weights_input_np = make_dummy_data(4 * hidden_size, input_size, seed=45)
+    weights_state_np = make_dummy_data(4 * hidden_size, hidden_size, seed=46)
+    bias_input_np = make_dummy_data(4 * hidden_size, seed=47)
+    bias_state_np = make_dummy_data(4 * hidden_size, seed=48)
+    output_np = np.zeros((seq_len, batch_size, hidden_size), dtype=np.float32)
+    buffer_np = np.zeros(4 * seq_len * batch_size * hidden_size, dtype=np.float32)
+
+    torch_lstm = torch.nn.LSTM(input_size, hidden_size, num_layers=1)
+    torch_lstm.weight_ih_l0.data = torch.from_numpy(weights_input_np)
+    torch_lstm.weight_hh_l0.data = torch.from_numpy(weights_state_np)
+    torch_lstm.bias_ih_l0.data = torch.from_numpy(bias_input_np)
+    torch_lstm.bias_hh_l0.data = torch.from_numpy(bias_state_np)
+    output_torch, (state_h_torch, state_c_torch) = torch_lstm(
+        torch.from_numpy(input_np),
+        (torch.from_numpy(state_h_np).view(1, batch_size, hidden_size).clone(),
+         torch.from_numpy(state_c_np).view(1, batch_size, hidden_size).clone()),
+    )
+
+    # PufferNet done second because it is in-place on the state vars
+    puffernet.puf_lstm_sequence(
+        input_np,
+        state_h_np,
+        state_c_np,
+        weights_input_np,
+        weights_state_np,
+        bias_input_np,
+        bias_state_np,
+        output_np,
+        buffer_np,
+        seq_len,
+        batch_size,
+        input_size,
+        hidden_size,
+    )
+
+    assert_near(output_np, output_torch.detach().numpy())
+    assert_near(state_h_np, state_h_torch.detach().numpy()[0])
+    assert_near(state_c_np, state_c_torch.detach().numpy()[0])
+
+
 def test_puffernet_embedding(batch_size=16, num_embeddings=128, embedding_dim=32):
     input_np = make_dummy_int_data(num_embeddings, batch_size, seed=42)
     weights_np = make_dummy_data(num_embeddings, embedding_dim, seed=43)
@@ -272,6 +316,28 @@ def test_puffernet_argmax_multidiscrete(batch_size=16, logit_sizes=[5, 7, 2]):
     assert_near(output_puffer, output_torch.numpy())
 
 
+def test_puffernet_sample_multidiscrete(batch_size=4096, logit_sizes=[5, 7, 2]):
+    logit_sizes = np.array(logit_sizes).astype(np.int32)
+    num_actions = len(logit_sizes)
+    logits = 4 * make_dummy_data(logit_sizes.sum())
+    input_np = np.ascontiguousarray(np.tile(logits, (batch_size, 1)))
+    probs = [torch.softmax(s, dim=0).numpy() for s in torch.split(torch.from_numpy(logits), logit_sizes.tolist())]
+
+    for gumbel in (False, True):
+        output_puffer = np.zeros((batch_size, num_actions), dtype=np.int32)
+        puffernet.puf_sample_multidiscrete(input_np, output_puffer, batch_size, logit_sizes, num_actions, 7, 3, 0, gumbel)
+        for a, p in enumerate(probs):
+            freq = np.bincount(output_puffer[:, a], minlength=len(p)) / batch_size
+            assert np.all(np.abs(freq - p) < 0.05)
+
+        # Same seed, step and agent index give the same actions for any split of the batch
+        half = batch_size // 2
+        output_split = np.zeros((batch_size, num_actions), dtype=np.int32)
+        puffernet.puf_sample_multidiscrete(input_np[:half], output_split[:half], half, logit_sizes, num_actions, 7, 3, 0, gumbel)
+        puffernet.puf_sample_multidiscrete(input_np[half:], output_split[half:], half, logit_sizes, num_actions, 7, 3, half, gumbel)
+        assert np.array_equal(output_puffer, output_split)
+
+
 def test_nmmo3(batch_size=1, input_size=512, hidden_size=512):
     input_torch = torch.arange(11 * 15 * 10 + 47 + 10) % 4
     input_torch = input_torch.view(1, -1)
@@ -304,8 +370,10 @@ if __name__ == "__main__":
     test_puffernet_convolution_layer()
     test_puffernet_convolution_3d_layer()
     test_puffernet_lstm()
+    test_puffernet_lstm_sequence()
     test_puffernet_embedding()
     test_puffernet_layernorm()
     test_puffernet_one_hot()
     test_puffernet_cat_dim1()
     test_puffernet_argmax_multidiscrete()
+    test_puffernet_sample_multidiscrete()